@@ -0,0 +1,488 @@
+#include "gemini.h"
+#include "bench/Synthetic.h"
+#include "managers/TaskScheduling.h"
+#include "managers/Platform.h"
+
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <vector>
+#include <cstdio>
+#include <mm_malloc.h>
+
+using namespace MTaskScheduling;
+using namespace MPlatform;
+
+namespace SSynthetic
+{
+    config_t config;
+    thread_stats_t thread_stats[MAX_NUM_THREADS];
+    std::atomic<uint32_t> num_frames;
+    system_t* systems;
+
+    // simulated GPU. frames are queued by the present task and finish gpu_us
+    // apart. presenting waits for the frame FRAMES_IN_FLIGHT - 1 frames back
+    uint32_t present_frame;
+    std::chrono::steady_clock::time_point gpu_done[MAX_FRAMES_IN_FLIGHT];
+
+    // frame latency. frame f starts when the first system submits it at the
+    // end of frame f - 1 and ends when the last system submits frame f + 1
+    const uint32_t LATENCY_RING_SIZE = 2 * MAX_FRAMES_IN_FLIGHT;
+    std::atomic<int64_t> frame_start_ns[LATENCY_RING_SIZE];
+    std::chrono::steady_clock::time_point start_time;
+    double latency_sum_ns;
+    uint32_t latency_frames;
+    std::vector<int64_t> frame_starts_ns; // by the first system, for frame times
+
+    uint32_t recorded_tasks_per_frame;
+
+    // one shot timer standing in for an event source such as I/O completions
+    std::thread timer_thread;
+    std::mutex timer_mutex;
+    std::condition_variable timer_cv;
+    task_event_t* timer_event; // armed while not nullptr
+    std::chrono::steady_clock::time_point timer_deadline;
+    bool timer_quit;
+
+    task_event_t input_event;
+    ALIGN(64) const task_dependencies_t resume_dependencies = {};
+
+    static void timer_loop()
+    {
+        std::unique_lock<std::mutex> l(timer_mutex);
+        while (!timer_quit)
+        {
+            if (!timer_event)
+                timer_cv.wait(l);
+            else if (timer_cv.wait_until(l, timer_deadline) == std::cv_status::timeout)
+            {
+                signal_event(timer_event);
+                timer_event = nullptr;
+            }
+        }
+    }
+
+    static void arm_timer(task_event_t* event, uint32_t us)
+    {
+        std::unique_lock<std::mutex> l(timer_mutex);
+        timer_event = event;
+        timer_deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+        timer_cv.notify_one();
+    }
+
+    static void init_gemini_preset();
+    static void init_wired_systems();
+    static void record_tasks(system_t* system);
+
+    uint32_t tasks_per_frame()
+    {
+        return recorded_tasks_per_frame;
+    }
+
+    double frame_latency_ns()
+    {
+        return latency_frames ? latency_sum_ns / latency_frames : 0.0;
+    }
+
+    frame_time_stats_t frame_time_stats()
+    {
+        frame_time_stats_t stats = {};
+        std::vector<int64_t> frame_times;
+        for (size_t i = 1; i < frame_starts_ns.size(); ++i)
+        {
+            frame_times.push_back(frame_starts_ns[i] - frame_starts_ns[i - 1]);
+        }
+        if (frame_times.empty())
+            return stats;
+
+        std::sort(frame_times.begin(), frame_times.end());
+        stats.p50_ns = frame_times[frame_times.size() / 2];
+        stats.p99_ns = frame_times[frame_times.size() * 99 / 100];
+        stats.max_ns = frame_times.back();
+        for (int64_t t : frame_times)
+        {
+            stats.hitches += t > 2.0 * stats.p50_ns;
+        }
+
+        return stats;
+    }
+
+    inline bool ranged(const system_t* system, uint32_t g)
+    {
+        return config.range_grain != NO_RANGE_TASKS && system->group_tasks[g] > 1;
+    }
+
+    inline uint32_t group_task_count(const system_t* system, uint32_t g)
+    {
+        return ranged(system, g) ? range_task_count(0, system->group_tasks[g], config.range_grain) : system->group_tasks[g];
+    }
+
+    inline bool presents(const system_t* system)
+    {
+        return config.gpu_us && system->index + 1 == config.num_systems;
+    }
+
+    inline int64_t elapsed_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+    }
+
+    bool init_synthetic(const config_t& c)
+    {
+        config = c;
+        if (config.preset == PRESET_GEMINI)
+        {
+            config.num_systems = 5;
+            config.num_groups = 4;
+        }
+
+        if (config.num_systems == 0 || config.num_systems > NUM_STACKS)
+        {
+            std::cout << "number of systems must be in [1, " << NUM_STACKS << "]\n";
+            return false;
+        }
+        if (config.num_groups == 0 || config.num_groups > MAX_GROUPS || config.tasks_per_group == 0)
+        {
+            std::cout << "number of groups must be in [1, " << MAX_GROUPS << "] with at least one task each\n";
+            return false;
+        }
+        if (config.num_systems * (config.num_groups + 1) > MAX_CHECKPOINTS - NUM_NAMED_CHECKPOINTS)
+        {
+            std::cout << "systems * (groups + 1) must be at most " << MAX_CHECKPOINTS - NUM_NAMED_CHECKPOINTS << " checkpoints\n";
+            return false;
+        }
+
+        for (uint32_t i = 0; i < MAX_NUM_THREADS; ++i)
+        {
+            thread_stats[i].exec_cycles = 0;
+            thread_stats[i].submit_cycles = 0;
+        }
+        num_frames.store(0, std::memory_order_relaxed);
+        start_time = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < LATENCY_RING_SIZE; ++i)
+        {
+            frame_start_ns[i].store(0, std::memory_order_relaxed);
+        }
+        latency_sum_ns = 0.0;
+        latency_frames = 0;
+        frame_starts_ns.clear();
+        frame_starts_ns.reserve(config.num_frames);
+        present_frame = 0;
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+        {
+            gpu_done[i] = std::chrono::steady_clock::now();
+        }
+
+        // new does not honour the cache line alignment of the range tasks in c++11.
+        // all members are trivially constructible and set before they are used
+        systems = (system_t*) _mm_malloc(sizeof(system_t) * config.num_systems, 64);
+        for (uint32_t s = 0; s < config.num_systems; ++s)
+        {
+            system_t* system = &systems[s];
+            system->task_stack = &s_stacks[s];
+            system->index = s;
+            system->num_groups = config.num_groups;
+            system->frame = 0;
+            system->recording = task_recording_t();
+            snprintf(system->name, sizeof(system->name), "system %u", s);
+            name_stack(s, system->name);
+            for (uint32_t g = 0; g < config.num_groups; ++g)
+            {
+                system->group_tasks[g] = config.tasks_per_group;
+                system->independent_tasks[g] = config.independent_tasks;
+                snprintf(system->checkpoint_names[g], sizeof(system->checkpoint_names[g]), "system %u group %u", s, g);
+                system->checkpoints[g] = allocate_checkpoint(system->checkpoint_names[g]);
+                system->group_args[g].system = system;
+                system->group_args[g].group = g;
+            }
+            snprintf(system->checkpoint_names[MAX_GROUPS], sizeof(system->checkpoint_names[MAX_GROUPS]), "system %u present", s);
+            system->present_checkpoint = allocate_checkpoint(system->checkpoint_names[MAX_GROUPS]);
+        }
+
+        if (config.preset == PRESET_GEMINI)
+            init_gemini_preset();
+        else
+            init_wired_systems();
+
+        timer_event = nullptr;
+        timer_quit = false;
+        timer_thread = std::thread(timer_loop);
+
+        recorded_tasks_per_frame = 0;
+        for (uint32_t s = 0; s < config.num_systems; ++s)
+        {
+            system_t* system = &systems[s];
+            uint32_t last_checkpoint = system->checkpoints[system->num_groups - 1];
+            system->present_dependencies = with_flags(dependencies({}, {last_checkpoint}), config.lanes ? TF_BLOCKING : TF_NONE);
+            system->submit_dependencies = dependencies({}, {presents(system) ? system->present_checkpoint : last_checkpoint});
+
+            recorded_tasks_per_frame += 1 + presents(system);
+            for (uint32_t g = 0; g < system->num_groups; ++g)
+            {
+                recorded_tasks_per_frame += group_task_count(system, g) + system->independent_tasks[g];
+            }
+
+            record_tasks(system);
+            if (config.replay)
+            {
+                save_task_recording(system->task_stack, &system->recording);
+            }
+            submit_task_recording(system->task_stack);
+        }
+
+        return true;
+    }
+
+    static void init_wired_systems()
+    {
+        for (uint32_t s = 0; s < config.num_systems; ++s)
+        {
+            system_t* system = &systems[s];
+            for (uint32_t g = 0; g < config.num_groups; ++g)
+            {
+                uint32_t previous_group = g > 0 ? system->checkpoints[g - 1] : ECP_NONE;
+                uint32_t previous_system = config.wiring >= WIRING_CHAIN && s > 0 ? systems[s - 1].checkpoints[g] : ECP_NONE;
+                uint32_t next_system = config.wiring >= WIRING_CROSS && s + 1 < config.num_systems ? systems[s + 1].checkpoints[g] : ECP_NONE;
+                system->group_dependencies[g] = add_dependencies(dependencies({}, {previous_group, previous_system}),
+                                                                 FRAMES_IN_FLIGHT - 1, {next_system});
+            }
+        }
+    }
+
+    // same stacks, groups and checkpoint graph as SInput, SPhysics, SAnimation, SAI
+    // and SRendering. the critical path runs input -> physics -> rendering
+    static void init_gemini_preset()
+    {
+        system_t* input = &systems[0];
+        system_t* physics = &systems[1];
+        system_t* animation = &systems[2];
+        system_t* ai = &systems[3];
+        system_t* rendering = &systems[4];
+
+        input->num_groups = 1;
+        input->group_tasks[0] = 1;
+        input->independent_tasks[0] = 0;
+        animation->num_groups = 3;
+        ai->num_groups = 2;
+        rendering->group_tasks[3] = NUM_WORKER_THREADS; // performance overlay, one task per thread
+        rendering->independent_tasks[3] = 0;
+
+        uint32_t* i = input->checkpoints;
+        uint32_t* p = physics->checkpoints;
+        uint32_t* an = animation->checkpoints;
+        uint32_t* a = ai->checkpoints;
+        uint32_t* r = rendering->checkpoints;
+        uint32_t present = config.gpu_us ? rendering->present_checkpoint : r[3];
+
+        input->group_dependencies[0]     = with_flags(dependencies({present}, {}), config.lanes ? TF_MAIN_THREAD : TF_NONE);
+        physics->group_dependencies[0]   = dependencies({}, {i[0]});
+        physics->group_dependencies[1]   = dependencies({}, {p[0]});
+        physics->group_dependencies[2]   = dependencies({r[1]}, {p[1]});
+        physics->group_dependencies[3]   = dependencies({}, {p[2]});
+        animation->group_dependencies[0] = dependencies({}, {});
+        animation->group_dependencies[1] = dependencies({}, {i[0], an[0]});
+        animation->group_dependencies[2] = dependencies({}, {an[1]});
+        ai->group_dependencies[0]        = dependencies({}, {});
+        ai->group_dependencies[1]        = dependencies({}, {a[0]});
+        rendering->group_dependencies[0] = dependencies({}, {i[0]});
+        rendering->group_dependencies[1] = dependencies({}, {p[3], r[0]});
+        rendering->group_dependencies[2] = dependencies({}, {r[1]});
+        rendering->group_dependencies[3] = dependencies({}, {r[2]});
+    }
+
+    void clear_synthetic()
+    {
+        {
+            std::unique_lock<std::mutex> l(timer_mutex);
+            timer_quit = true;
+            timer_cv.notify_one();
+        }
+        timer_thread.join();
+
+        for (uint32_t s = 0; s < config.num_systems; ++s)
+        {
+            clear_task_recording(&systems[s].recording);
+        }
+        _mm_free(systems);
+    }
+
+    // the groups recorded one task per element count down to their checkpoint
+    static void reset_counters(system_t* system)
+    {
+        for (uint32_t g = 0; g < system->num_groups; ++g)
+        {
+            if (!ranged(system, g))
+                system->counters[g].store(system->group_tasks[g] - 1, std::memory_order_relaxed);
+        }
+    }
+
+    static void record_tasks(system_t* system)
+    {
+        reset_counters(system);
+        begin_task_recording(system->task_stack);
+
+        record_task(system->task_stack, {submit_tasks, system, &system->submit_dependencies});
+        if (presents(system))
+        {
+            record_task(system->task_stack, {present_task, system, &system->present_dependencies});
+        }
+
+        // groups are recorded in reverse so that group 0 is executed first
+        for (uint32_t g = system->num_groups; g-- > 0; )
+        {
+            if (ranged(system, g))
+            {
+                record_range_task(system->task_stack, &system->ranges[g], group_range, nullptr,
+                                  0, system->group_tasks[g], config.range_grain,
+                                  system->checkpoints[g], &system->group_dependencies[g]);
+            }
+            else
+            {
+                bool input = config.preset == PRESET_GEMINI && system->index == 0;
+                for (uint32_t i = 0; i < system->group_tasks[g]; ++i)
+                {
+                    record_task(system->task_stack, {input ? input_task : group_task, &system->group_args[g], &system->group_dependencies[g]});
+                }
+            }
+
+            for (uint32_t i = 0; i < system->independent_tasks[g]; ++i)
+            {
+                record_task(system->task_stack, {independent_task, nullptr, &no_dependencies});
+            }
+        }
+    }
+
+    uint64_t submit_tasks(void* args, uint32_t thread_id)
+    {
+        uint64_t start = asm_rdtscp();
+
+        system_t* system = (system_t*) args;
+
+        // the first system counts frames and starts the next one, the last one ends them
+        uint32_t frame = system->frame++;
+        if (system->index == 0)
+        {
+            int64_t now = elapsed_ns();
+            frame_start_ns[(frame + 1) % LATENCY_RING_SIZE].store(now, std::memory_order_relaxed);
+            frame_starts_ns.push_back(now);
+            if (num_frames.fetch_add(1, std::memory_order_relaxed) + 1 == config.num_frames)
+            {
+                signal_shutdown();
+            }
+        }
+        if (system->index + 1 == config.num_systems)
+        {
+            latency_sum_ns += elapsed_ns() - frame_start_ns[frame % LATENCY_RING_SIZE].load(std::memory_order_relaxed);
+            ++latency_frames;
+        }
+
+        uint64_t submit_start = asm_rdtscp();
+        if (config.replay)
+        {
+            reset_counters(system);
+            replay_task_recording(system->task_stack, &system->recording);
+        }
+        else
+        {
+            record_tasks(system);
+            submit_task_recording(system->task_stack);
+        }
+
+        uint64_t end = asm_rdtscp();
+        thread_stats[thread_id].submit_cycles += end - submit_start;
+        thread_stats[thread_id].exec_cycles += end - start;
+
+        return ECP_NONE;
+    }
+
+    uint64_t group_task(void* args, uint32_t thread_id)
+    {
+        uint64_t start = asm_rdtscp();
+
+        group_task_args_t* pargs = (group_task_args_t*) args;
+
+        simulate_work(config.work);
+
+        uint32_t count = pargs->system->counters[pargs->group].fetch_sub(1, std::memory_order_release);
+        uint64_t reached_checkpoints = ECP_NONE;
+        if (count == 0)
+            reached_checkpoints = pargs->system->checkpoints[pargs->group];
+
+        thread_stats[thread_id].exec_cycles += asm_rdtscp() - start;
+
+        return reached_checkpoints;
+    }
+
+    void group_range(void* args, uint32_t begin, uint32_t end, uint32_t thread_id)
+    {
+        uint64_t start = asm_rdtscp();
+
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            simulate_work(config.work);
+        }
+
+        thread_stats[thread_id].exec_cycles += asm_rdtscp() - start;
+    }
+
+    uint64_t present_task(void* args, uint32_t thread_id)
+    {
+        system_t* system = (system_t*) args;
+
+        // block like a fence wait until the GPU has a free frame
+        uint32_t f = present_frame++;
+        std::this_thread::sleep_until(gpu_done[(f + 1) % FRAMES_IN_FLIGHT]);
+
+        auto now = std::chrono::steady_clock::now();
+        auto start = std::max(now, gpu_done[(f + FRAMES_IN_FLIGHT - 1) % FRAMES_IN_FLIGHT]);
+        gpu_done[f % FRAMES_IN_FLIGHT] = start + std::chrono::microseconds(config.gpu_us);
+
+        return system->present_checkpoint;
+    }
+
+    // like SInput::input_task before it ran in the main lane, waits for the event poll.
+    // or suspends until the timer signals, which keeps the worker busy meanwhile
+    uint64_t input_task(void* args, uint32_t thread_id)
+    {
+        if (config.suspend)
+        {
+            reset_event(&input_event);
+            arm_timer(&input_event, config.input_us);
+            if (suspend_task(thread_id, {input_resume, args, &resume_dependencies}, &input_event))
+                return ECP_NONE;
+
+            // no free slot, block on the timer like the sleeping input task
+            while (!input_event.signaled.load(std::memory_order_acquire))
+            {
+                if (g_quit_request.load(std::memory_order_relaxed))
+                    return ECP_NONE;
+                std::this_thread::sleep_for(std::chrono::microseconds(10));
+            }
+
+            return input_resume(args, thread_id);
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(config.input_us));
+
+        return group_task(args, thread_id);
+    }
+
+    uint64_t input_resume(void* args, uint32_t thread_id)
+    {
+        return group_task(args, thread_id);
+    }
+
+    uint64_t independent_task(void* args, uint32_t thread_id)
+    {
+        uint64_t start = asm_rdtscp();
+
+        simulate_work(config.work);
+
+        thread_stats[thread_id].exec_cycles += asm_rdtscp() - start;
+
+        return ECP_NONE;
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "managers/TaskScheduling.h"
+
+#include <atomic>
+
+// Synthetic systems for exercising the scheduler without a window or GPU.
+// Every system owns one task stack and records the same shape of work as
+// SPhysics and SRendering: dependent task groups, each finished by the
+// task that brings the group counter to zero, with independent tasks in
+// between and the submit task at the bottom of the stack. the gemini preset
+// instead mirrors the groups and checkpoint graph of the game's five systems.
+namespace SSynthetic
+{
+    const uint32_t MAX_GROUPS = 16;
+    const uint32_t NO_RANGE_TASKS = 0xFFFFFFFF; // record one task per group element
+
+    enum wiring_t : uint32_t
+    {
+        WIRING_NONE,  // systems only depend on themselves
+        WIRING_CHAIN, // group g waits for group g of the previous system (current frame)
+        WIRING_CROSS, // chain, and group g waits for group g of the next system (FRAMES_IN_FLIGHT - 1 frames back)
+    };
+
+    enum preset_t : uint32_t
+    {
+        PRESET_NONE,   // num_systems systems of num_groups groups, wired by wiring
+        PRESET_GEMINI, // input, physics, animation, ai and rendering as recorded by the game
+    };
+
+    typedef struct
+    {
+        uint32_t num_systems;
+        uint32_t num_groups;
+        uint32_t tasks_per_group;
+        uint32_t independent_tasks;
+        uint32_t work;
+        wiring_t wiring;
+        uint32_t num_frames;
+        uint32_t range_grain; // NO_RANGE_TASKS, or the grain of the group range tasks (0 = automatic)
+        uint32_t gpu_us;      // 0, or the GPU time per frame of a simulated present in the last system
+        preset_t preset;      // PRESET_GEMINI overrides num_systems, num_groups and wiring
+        uint32_t input_us;    // time the gemini preset's input task waits for the main thread's event poll
+        bool lanes;           // run the input task in the main lane and the present in the blocking lane
+        bool suspend;         // the input task suspends on an event a timer signals after input_us instead of sleeping
+        bool replay;          // submit tasks replay the recording saved at init instead of recording every frame
+    } config_t;
+
+    struct system_t;
+
+    typedef struct
+    {
+        system_t* system;
+        uint32_t group;
+    } group_task_args_t;
+
+    typedef struct system_t
+    {
+        MTaskScheduling::task_stack_t* task_stack;
+        uint32_t index;
+        uint32_t num_groups;
+        uint32_t group_tasks[MAX_GROUPS];
+        uint32_t independent_tasks[MAX_GROUPS]; // recorded above each group
+        uint32_t frame;                         // frames submitted so far
+        uint32_t checkpoints[MAX_GROUPS];
+        uint32_t present_checkpoint;
+        MTaskScheduling::task_dependencies_t present_dependencies;
+        std::atomic<uint32_t> counters[MAX_GROUPS];
+        MTaskScheduling::range_task_t ranges[MAX_GROUPS];
+        MTaskScheduling::task_dependencies_t submit_dependencies;
+        MTaskScheduling::task_dependencies_t group_dependencies[MAX_GROUPS];
+        group_task_args_t group_args[MAX_GROUPS]; // shared by all tasks of a group
+        MTaskScheduling::task_recording_t recording; // saved when config.replay
+        char name[24];                          // of the stack, for traces
+        char checkpoint_names[MAX_GROUPS + 1][32]; // of the groups, then of the present
+    } system_t;
+
+    typedef struct
+    {
+        ALIGN(64) uint64_t exec_cycles;
+        uint64_t submit_cycles; // recording or replaying, part of exec_cycles
+    } thread_stats_t;
+
+    // time between consecutive frame starts
+    typedef struct
+    {
+        double p50_ns;
+        double p99_ns;
+        double max_ns;
+        uint32_t hitches; // frames longer than twice the median
+    } frame_time_stats_t;
+
+    extern config_t config;
+    extern thread_stats_t thread_stats[MTaskScheduling::MAX_NUM_THREADS];
+    extern std::atomic<uint32_t> num_frames;
+
+    uint32_t tasks_per_frame();
+    double frame_latency_ns(); // average time from a frame's first task to its last submit
+    frame_time_stats_t frame_time_stats();
+    bool init_synthetic(const config_t&);
+    void clear_synthetic();
+
+    uint64_t submit_tasks(void*, uint32_t);
+
+    uint64_t group_task(void*, uint32_t);
+    void group_range(void*, uint32_t, uint32_t, uint32_t);
+    uint64_t independent_task(void*, uint32_t);
+    uint64_t present_task(void*, uint32_t);
+    uint64_t input_task(void*, uint32_t);
+    uint64_t input_resume(void*, uint32_t);
+}
@@ -6,24 +6,80 @@
 #include "systems/animation/Animation.h"
 #include "systems/ai/AI.h"
 #include "systems/rendering/Rendering.h"
+#include "systems/streaming/Streaming.h"
+#include "systems/sound/Sound.h"
 
 #include <iostream>
 #include <thread>
-#include <mutex>
+#include <cstring>
 
 #include <GLFW/glfw3.h>
 
-int main()
+void usage()
 {
+    std::cout << "usage: gemini [options]\n"
+              << "  --profiling L     off | counters | trace, trace fills the overlay's log (default: trace with --trace, otherwise off)\n"
+              << "  --trace PATH      write a continuous trace of every task to PATH (default: off)\n";
+}
+
+int main(int argc, char** argv)
+{
+    // profiling and tracing are opt-in
+    const char* trace_path = nullptr;
+    MTaskScheduling::profiling_level_t profiling_level = MTaskScheduling::PL_OFF;
+    bool profiling_set = false;
+    for (int i = 1; i < argc; i += 2)
+    {
+        const char* option = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value)
+        {
+            usage();
+            return 1;
+        }
+
+        if (!strcmp(option, "--trace"))            trace_path = value;
+        else if (!strcmp(option, "--profiling"))
+        {
+            profiling_set = true;
+            if (!strcmp(value, "off"))           profiling_level = MTaskScheduling::PL_OFF;
+            else if (!strcmp(value, "counters")) profiling_level = MTaskScheduling::PL_COUNTERS;
+            else if (!strcmp(value, "trace"))    profiling_level = MTaskScheduling::PL_TRACE;
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if (!profiling_set && trace_path)
+        profiling_level = MTaskScheduling::PL_TRACE;
+
     // Determine number of worker threads
     uint32_t num_threads;
     std::cout << "Number of worker threads: ";
     std::cin >> num_threads;
+    if (!std::cin || num_threads == 0 || num_threads > MTaskScheduling::MAX_NUM_WORKER_THREADS)
+    {
+        std::cout << "number of worker threads must be in [1, " << MTaskScheduling::MAX_NUM_WORKER_THREADS << "]\n";
+        return 1;
+    }
     MTaskScheduling::NUM_WORKER_THREADS = num_threads;
+    // counters that can not be opened read as 0
+    MTaskScheduling::PERF_COUNTERS = profiling_level != MTaskScheduling::PL_OFF;
+    MTaskScheduling::set_profiling_level(profiling_level);
 
     // Initialize managers
     MMemory::init_memory();
     MTaskScheduling::init_scheduler();
+    if (trace_path && !MTaskScheduling::start_tracing(trace_path))
+        std::cout << "could not trace to " << trace_path << "\n";
+    MTaskScheduling::start_metrics("/gemini");
 
     // Initialize window
     glfwInit();
@@ -32,11 +88,14 @@ int main()
     GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "gemini", nullptr, nullptr);
 
     // Initialize systems
-    SInput::init_input(&MTaskScheduling::s_stacks[0]);
+    SInput::init_input(&MTaskScheduling::s_stacks[0], window);
     SPhysics::init_physics(&MTaskScheduling::s_stacks[1]);
     SAnimation::init_animation(&MTaskScheduling::s_stacks[2]);
     SAI::init_ai(&MTaskScheduling::s_stacks[3]);
     SRendering::init_rendering(&MTaskScheduling::s_stacks[4], window);
+    SStreaming::init_streaming(&MTaskScheduling::s_stacks[5], MPlatform::IO_URING);
+    SSound::init_sound(&MTaskScheduling::s_stacks[6]);
+    SSound::start_sink(SSound::SINK_NULL, nullptr); // no audio device output yet
 
     // Launch worker threads
     std::thread workers[MTaskScheduling::MAX_NUM_WORKER_THREADS];
@@ -45,20 +104,25 @@ int main()
         workers[i] = std::thread(MTaskScheduling::worker_thread, i);
     }
 
+    std::thread blocking_lane(MTaskScheduling::run_lane, MTaskScheduling::LANE_BLOCKING);
+
     // Enter input event loop
-    SInput::input_loop(window);
+    SInput::input_loop();
 
     // Shut down worker threads
     for (uint32_t i = 0; i < num_threads; ++i)
     {
         workers[i].join();
     }
+    blocking_lane.join();
 
-    MTaskScheduling::write_profiling();
+    MTaskScheduling::stop_tracing();
 
     std::cout << "total executed: " << MTaskScheduling::g_total_executed.load(std::memory_order_relaxed) << "\n";
 
     // Clear resources
+    SSound::clear_sound();
+    SStreaming::clear_streaming();
     SRendering::clear_rendering();
     MTaskScheduling::clear_scheduler();
     MMemory::clear_memory();
@@ -74,12 +138,6 @@ void signal_shutdown()
 {
     // signal task scheduling manager
     MTaskScheduling::g_quit_request.store(1, std::memory_order_relaxed);
-
-    // signal input handling
-    {
-        std::unique_lock<std::mutex> l(SInput::input_loop_sync.m);
-        SInput::input_loop_sync.gather_input = true;
-        SInput::input_loop_sync.input_gathered = true;
-    }
-    SInput::input_loop_sync.cv.notify_one();
+    MTaskScheduling::wake_workers();
+    MTaskScheduling::wake_lanes();
 }
@@ -0,0 +1,834 @@
+#include "gemini.h"
+#include "managers/Memory.h"
+#include "managers/TaskScheduling.h"
+#include "managers/Platform.h"
+#include "bench/Synthetic.h"
+#include "systems/streaming/Streaming.h"
+#include "systems/sound/Sound.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+#include <cmath>
+
+typedef struct
+{
+    uint32_t num_threads;
+    uint32_t num_frames;
+    uint64_t num_tasks;
+    double elapsed_ns;
+    double cycles_per_ns;
+    uint64_t sched_cycles;
+    uint64_t exec_cycles;
+    uint64_t submit_cycles;
+    uint64_t num_parks;
+    uint64_t num_wakes;
+    uint64_t wake_latency_ticks;
+    uint64_t woken_picks;
+    uint64_t num_out_of_order;
+    uint64_t num_suspended;
+    uint64_t contention[MTaskScheduling::NUM_CONTENTION_COUNTERS];
+    double frame_latency_ns;
+    uint64_t critical_path_cycles;
+    SSynthetic::frame_time_stats_t frame_times;
+    MPlatform::io_backend_t io_backend;
+    uint64_t bytes_read;
+    uint64_t bytes_loaded;
+    uint64_t loads_finished;
+    uint64_t loads_failed;
+    uint64_t voice_frames;
+    uint64_t mix_cycles;
+    uint64_t audio_frames_mixed;
+    uint64_t audio_frames_played;
+    uint64_t underruns;
+    uint64_t underrun_frames;
+    uint64_t trace_events;
+    uint64_t trace_dropped;
+    uint64_t trace_bytes;
+    uint32_t perf_available;
+    uint32_t stack_frames; // summed in stack_counters
+    MTaskScheduling::stack_counters_t stack_counters[MTaskScheduling::NUM_STACKS];
+} result_t;
+
+const char* trace_path = nullptr; // continuous trace of every run, the last one is kept
+const char* metrics_name = nullptr; // shared memory block for gemini_metrics
+MTaskScheduling::profiling_level_t profiling_level = MTaskScheduling::PL_OFF;
+
+// streaming load. num_loads files are kept loading, each finished load is requested again
+typedef struct
+{
+    uint32_t num_loads;
+    uint32_t load_kb;
+    MPlatform::io_backend_t backend;
+} stream_config_t;
+
+stream_config_t stream_config = { 0, 1024, MPlatform::IO_URING };
+SStreaming::load_t* stream_loads;
+char (*stream_paths)[64];
+
+void reload(SStreaming::load_t* load, uint32_t thread_id)
+{
+    SStreaming::release_load(load);
+    if (!MTaskScheduling::g_quit_request.load(std::memory_order_relaxed))
+        SStreaming::request_load(load);
+}
+
+// compressible files, about 2:1 with zlib
+bool init_stream_files()
+{
+    uint32_t size = stream_config.load_kb * 1024;
+    uint8_t* data = (uint8_t*) malloc(size);
+    uint32_t x = 1;
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        x = x * 1664525 + 1013904223;
+        data[i] = (i & 3) ? (uint8_t) i : (uint8_t) (x >> 24);
+    }
+
+    stream_loads = new SStreaming::load_t[stream_config.num_loads];
+    stream_paths = new char[stream_config.num_loads][64];
+    bool ok = true;
+    for (uint32_t i = 0; i < stream_config.num_loads && ok; ++i)
+    {
+        snprintf(stream_paths[i], sizeof(stream_paths[i]), "/tmp/gemini_bench_stream_%u_%u", (uint32_t) getpid(), i);
+        data[0] = (uint8_t) i;
+        ok = SStreaming::write_compressed_file(stream_paths[i], data, size);
+    }
+    free(data);
+
+    if (!ok)
+        std::cout << "could not write the streamed files to /tmp\n";
+
+    return ok;
+}
+
+void clear_stream_files()
+{
+    for (uint32_t i = 0; i < stream_config.num_loads; ++i)
+    {
+        unlink(stream_paths[i]);
+    }
+    delete[] stream_paths;
+    delete[] stream_loads;
+}
+
+// sound load. num_voices looping voices spread over a few resampled tones
+typedef struct
+{
+    uint32_t num_voices;
+    const char* wav_path;
+} sound_config_t;
+
+const uint32_t NUM_TONES = 4;
+sound_config_t sound_config = { 0, nullptr };
+SSound::sound_t* tones[NUM_TONES];
+
+void init_tones()
+{
+    const uint32_t rate = 44100;
+    float* samples = (float*) malloc(sizeof(float) * rate);
+    for (uint32_t t = 0; t < NUM_TONES; ++t)
+    {
+        // whole periods, so the tones loop without a click
+        double frequency = 110.0 * (t + 1);
+        for (uint32_t i = 0; i < rate; ++i)
+        {
+            samples[i] = (float) sin(2.0 * M_PI * frequency * i / rate);
+        }
+        tones[t] = SSound::create_sound(samples, rate, rate);
+    }
+    free(samples);
+}
+
+void clear_tones()
+{
+    for (uint32_t t = 0; t < NUM_TONES; ++t)
+    {
+        SSound::destroy_sound(tones[t]);
+    }
+}
+
+// the streamed files and the tones
+void clear_loads()
+{
+    if (stream_config.num_loads)
+        clear_stream_files();
+    clear_tones();
+}
+
+void usage()
+{
+    std::cout << "usage: gemini_bench [options]\n"
+              << "  --threads N       worker threads (default: hardware threads)\n"
+              << "  --systems N       synthetic systems, one stack each (default: 5)\n"
+              << "  --groups N        dependent task groups per system (default: 4)\n"
+              << "  --tasks N         tasks per group (default: 10)\n"
+              << "  --independent N   independent tasks after each group (default: 4)\n"
+              << "  --work N          simulate_work amount per task (default: 1000)\n"
+              << "  --wiring W        none | chain | cross (default: cross)\n"
+              << "  --frames N        frames to run (default: 1000)\n"
+              << "  --range G         record groups as range tasks with grain G (0 = automatic, default: off)\n"
+              << "  --gpu-us N        simulate a GPU-bound present taking N us per frame in the last system (default: off)\n"
+              << "  --depth D         frames in flight, in [2, " << MTaskScheduling::MAX_FRAMES_IN_FLIGHT << "] (default: 2)\n"
+              << "  --ooo W           out of order window below a blocked stack top, 0 disables (default: 8)\n"
+              << "  --lanes L         on | off, run the present (and the gemini preset's input task) in lanes (default: off)\n"
+              << "  --input-us N      time the gemini preset's input task waits for the event poll (default: 0)\n"
+              << "  --suspend S       on | off, the gemini preset's input task suspends on a timer event instead of sleeping (default: off)\n"
+              << "  --replay R        on | off, submit tasks replay the recording saved at init instead of recording every frame (default: on)\n"
+              << "  --stream N        keep N compressed files streaming in on an extra stack (default: 0)\n"
+              << "  --stream-kb N     uncompressed size of the streamed files in KB (default: 1024)\n"
+              << "  --stream-io B     uring | threads, asynchronous read backend (default: uring)\n"
+              << "  --sound N         mix N looping voices on an extra stack, drained by a real time sink (default: 0)\n"
+              << "  --sound-wav PATH  write the mix to a wav file instead of dropping it\n"
+              << "  --trace PATH      write a continuous trace of every task to PATH (default: off)\n"
+              << "  --metrics NAME    publish live metrics to the shared memory block NAME, e.g. /gemini (default: off)\n"
+              << "  --perf P          on | off, count instructions, cycles, LLC and branch misses per task (default: off)\n"
+              << "  --profiling L     off | counters | trace | all, all runs each level in turn (default: trace with --trace,\n"
+              << "                    counters with --perf on, otherwise off)\n"
+              << "  --pin P           none | spread | compact worker pinning from the sysfs topology (default: none)\n"
+              << "  --critical C      on | off, try stacks on the estimated critical path first (default: on)\n"
+              << "  --preset P        none | gemini, gemini mirrors the game's five systems and ignores\n"
+              << "                    --systems, --groups and --wiring (default: none)\n"
+              << "  --policy P        stack | steal | both (default: stack)\n"
+              << "  --sweep-systems L comma separated list of system counts to run one after another\n"
+              << "  --sweep-threads L comma separated list of worker thread counts to run one after another\n"
+              << "  --sweep-depth L   comma separated list of frames in flight to run one after another\n";
+}
+
+// parses a comma separated list of numbers, returns the number of parsed values
+uint32_t parse_list(const char* value, uint32_t* list, uint32_t max_size)
+{
+    uint32_t size = 0;
+    for (const char* v = value; *v && size < max_size; )
+    {
+        char* end;
+        list[size++] = strtoul(v, &end, 10);
+        v = *end == ',' ? end + 1 : end;
+    }
+
+    return size;
+}
+
+const char* policy_name(MTaskScheduling::scheduling_policy_t policy)
+{
+    return policy == MTaskScheduling::SP_WORK_STEALING ? "steal" : "stack";
+}
+
+const char* backend_name(MPlatform::io_backend_t backend)
+{
+    return backend == MPlatform::IO_URING ? "io_uring" : "thread pool";
+}
+
+const char* pinning_name(MPlatform::pinning_t pinning)
+{
+    return pinning == MPlatform::PIN_SPREAD ? "spread" : pinning == MPlatform::PIN_COMPACT ? "compact" : "none";
+}
+
+// runs the scheduler until config.num_frames frames are finished
+bool run(const SSynthetic::config_t& config, MTaskScheduling::scheduling_policy_t policy, uint32_t num_threads, uint32_t depth, result_t* result)
+{
+    MTaskScheduling::FRAMES_IN_FLIGHT = depth;
+    MTaskScheduling::SCHEDULING_POLICY = policy;
+    MTaskScheduling::NUM_WORKER_THREADS = num_threads;
+    uint32_t stream_stack = config.num_systems;
+    uint32_t sound_stack = stream_stack + (stream_config.num_loads > 0);
+    MTaskScheduling::NUM_ACTIVE_STACKS = sound_stack + (sound_config.num_voices > 0);
+    MTaskScheduling::MAX_EXECUTED_TASKS = 0xFFFFFFFF; // run until the requested number of frames
+
+    // Initialize managers
+    MMemory::init_memory();
+    MTaskScheduling::set_profiling_level(profiling_level);
+    MTaskScheduling::init_scheduler();
+    if (trace_path && !MTaskScheduling::start_tracing(trace_path))
+        std::cout << "could not trace to " << trace_path << "\n";
+    if (metrics_name && !MTaskScheduling::start_metrics(metrics_name))
+        std::cout << "could not publish metrics to " << metrics_name << "\n";
+
+    // Initialize systems
+    if (!SSynthetic::init_synthetic(config))
+    {
+        MTaskScheduling::clear_scheduler();
+        MMemory::clear_memory();
+        return false;
+    }
+
+    // the streaming stack goes after the synthetic systems
+    if (stream_config.num_loads)
+    {
+        result->io_backend = SStreaming::init_streaming(&MTaskScheduling::s_stacks[stream_stack], stream_config.backend);
+        for (uint32_t i = 0; i < stream_config.num_loads; ++i)
+        {
+            SStreaming::load_t* load = &stream_loads[i];
+            load->path = stream_paths[i];
+            load->on_finished = reload;
+            load->user = nullptr;
+            load->data = nullptr;
+            SStreaming::request_load(load);
+        }
+    }
+
+    if (sound_config.num_voices)
+    {
+        SSound::init_sound(&MTaskScheduling::s_stacks[sound_stack]);
+        for (uint32_t i = 0; i < sound_config.num_voices; ++i)
+        {
+            float pan = 2.0f * i / sound_config.num_voices - 1.0f;
+            float pitch = 0.5f + 1.5f * (i % 7) / 6.0f;
+            SSound::play(tones[i % NUM_TONES], 1.0f / sound_config.num_voices, pan, pitch, true);
+        }
+        if (!SSound::start_sink(sound_config.wav_path ? SSound::SINK_WAV : SSound::SINK_NULL, sound_config.wav_path))
+            std::cout << "could not open " << sound_config.wav_path << ", dropping the mix\n";
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+    uint64_t start_cycles = MPlatform::asm_rdtscp();
+
+    // Launch worker threads
+    std::thread workers[MTaskScheduling::MAX_NUM_WORKER_THREADS];
+    for (uint32_t i = 0; i < num_threads; ++i)
+    {
+        workers[i] = std::thread(MTaskScheduling::worker_thread, i);
+    }
+
+    std::thread blocking_lane(MTaskScheduling::run_lane, MTaskScheduling::LANE_BLOCKING);
+
+    // the main thread runs the main lane like gemini's input loop
+    MTaskScheduling::run_lane(MTaskScheduling::LANE_MAIN);
+
+    // Shut down worker threads
+    for (uint32_t i = 0; i < num_threads; ++i)
+    {
+        workers[i].join();
+    }
+    blocking_lane.join();
+
+    MTaskScheduling::stop_tracing();
+
+    uint64_t elapsed_cycles = MPlatform::asm_rdtscp() - start_cycles;
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start_time;
+
+    result->num_threads = num_threads;
+    result->num_frames = SSynthetic::num_frames.load(std::memory_order_relaxed);
+    result->num_tasks = MTaskScheduling::g_total_executed.load(std::memory_order_relaxed);
+    result->elapsed_ns = elapsed.count();
+    result->num_parks = MTaskScheduling::g_total_parks.load(std::memory_order_relaxed);
+    result->num_wakes = MTaskScheduling::g_total_wakes.load(std::memory_order_relaxed);
+    result->wake_latency_ticks = MTaskScheduling::g_total_wake_latency_ticks.load(std::memory_order_relaxed);
+    result->woken_picks = MTaskScheduling::g_total_woken_picks.load(std::memory_order_relaxed);
+    result->num_out_of_order = MTaskScheduling::g_total_out_of_order.load(std::memory_order_relaxed);
+    MTaskScheduling::contention_counters(result->contention);
+    result->num_suspended = MTaskScheduling::g_total_suspended.load(std::memory_order_relaxed);
+    result->trace_events = MTaskScheduling::g_trace_events.load(std::memory_order_relaxed);
+    result->trace_dropped = MTaskScheduling::g_trace_dropped.load(std::memory_order_relaxed);
+    result->trace_bytes = MTaskScheduling::g_trace_bytes.load(std::memory_order_relaxed);
+
+    // the last frames every stack finished before the shutdown
+    result->perf_available = MTaskScheduling::perf_counters_available();
+    result->stack_frames = MTaskScheduling::PROFILING_ITERATIONS - 2;
+    for (uint32_t s = 0; s < MTaskScheduling::NUM_ACTIVE_STACKS; ++s)
+    {
+        MTaskScheduling::stack_counters_t* sum = &result->stack_counters[s];
+        uint32_t last = MTaskScheduling::s_iterations[s].load(std::memory_order_relaxed) - 2;
+        *sum = {};
+        for (uint32_t f = 0; f < result->stack_frames; ++f)
+        {
+            MTaskScheduling::stack_counters_t c;
+            MTaskScheduling::stack_counters(s, last - f, &c);
+            sum->tasks += c.tasks;
+            sum->sched_ticks += c.sched_ticks;
+            sum->exec_ticks += c.exec_ticks;
+            sum->perf_tasks += c.perf_tasks;
+            for (uint32_t k = 0; k < MPlatform::NUM_PERF_COUNTERS; ++k)
+            {
+                sum->perf[k] += c.perf[k];
+            }
+            for (uint32_t k = 0; k < MTaskScheduling::NUM_CONTENTION_COUNTERS; ++k)
+            {
+                sum->contention[k] += c.contention[k];
+            }
+        }
+    }
+    result->frame_latency_ns = SSynthetic::frame_latency_ns();
+    result->critical_path_cycles = MTaskScheduling::g_critical_path_cycles.load(std::memory_order_relaxed);
+    result->cycles_per_ns = elapsed_cycles / result->elapsed_ns;
+    result->frame_times = SSynthetic::frame_time_stats();
+
+    result->exec_cycles = 0;
+    result->submit_cycles = 0;
+    for (uint32_t i = 0; i < num_threads; ++i)
+    {
+        result->exec_cycles += SSynthetic::thread_stats[i].exec_cycles;
+        result->submit_cycles += SSynthetic::thread_stats[i].submit_cycles;
+    }
+    uint64_t total_cycles = elapsed_cycles * num_threads;
+    result->sched_cycles = total_cycles > result->exec_cycles ? total_cycles - result->exec_cycles : 0;
+
+    // Clear resources
+    if (sound_config.num_voices)
+    {
+        SSound::clear_sound();
+        result->voice_frames = SSound::g_stats.voice_frames.load(std::memory_order_relaxed);
+        result->mix_cycles = SSound::g_stats.mix_cycles.load(std::memory_order_relaxed);
+        result->audio_frames_mixed = SSound::g_stats.frames_mixed.load(std::memory_order_relaxed);
+        result->audio_frames_played = SSound::g_stats.frames_played.load(std::memory_order_relaxed);
+        result->underruns = SSound::g_stats.underruns.load(std::memory_order_relaxed);
+        result->underrun_frames = SSound::g_stats.underrun_frames.load(std::memory_order_relaxed);
+    }
+    if (stream_config.num_loads)
+    {
+        SStreaming::clear_streaming();
+        for (uint32_t i = 0; i < stream_config.num_loads; ++i)
+        {
+            SStreaming::release_load(&stream_loads[i]);
+        }
+        result->bytes_read = SStreaming::g_stats.bytes_read.load(std::memory_order_relaxed);
+        result->bytes_loaded = SStreaming::g_stats.bytes_loaded.load(std::memory_order_relaxed);
+        result->loads_finished = SStreaming::g_stats.loads_finished.load(std::memory_order_relaxed);
+        result->loads_failed = SStreaming::g_stats.loads_failed.load(std::memory_order_relaxed);
+    }
+    SSynthetic::clear_synthetic();
+    MTaskScheduling::clear_scheduler();
+    MMemory::clear_memory();
+
+    return true;
+}
+
+double tasks_per_second(const result_t& r)  { return r.num_tasks / (r.elapsed_ns / 1e9); }
+double frames_per_second(const result_t& r) { return r.num_frames / (r.elapsed_ns / 1e9); }
+double sched_overhead(const result_t& r)    { return (double) r.sched_cycles / r.exec_cycles; }
+double submit_us_per_frame(const result_t& r) { return r.submit_cycles / r.cycles_per_ns / 1e3 / std::max(r.num_frames, 1u); }
+double ns_per_pick(const result_t& r)       { return r.sched_cycles / r.cycles_per_ns / r.num_tasks; }
+double wake_latency_us(const result_t& r)      { return r.woken_picks ? r.wake_latency_ticks / MPlatform::g_clock.ticks_per_ns / r.woken_picks / 1e3 : 0.0; }
+double per_task(const result_t& r, MTaskScheduling::contention_counter_t c) { return (double) r.contention[c] / r.num_tasks; }
+double read_mb_per_second(const result_t& r)   { return r.bytes_read / (r.elapsed_ns / 1e3); }
+double loaded_mb_per_second(const result_t& r) { return r.bytes_loaded / (r.elapsed_ns / 1e3); }
+double mix_ms(const result_t& r)                { return r.mix_cycles / r.cycles_per_ns / 1e6; }
+double voices_per_ms(const result_t& r)         { return r.voice_frames / (SSound::SAMPLE_RATE / 1e3) / mix_ms(r); } // voice ms of audio per ms mixing
+
+int main(int argc, char** argv)
+{
+    uint32_t num_threads = MPlatform::NUM_HARDWARE_THREADS;
+    SSynthetic::config_t config;
+    config.num_systems = 5;
+    config.num_groups = 4;
+    config.tasks_per_group = 10;
+    config.independent_tasks = 4;
+    config.work = 1000;
+    config.wiring = SSynthetic::WIRING_CROSS;
+    config.num_frames = 1000;
+    config.range_grain = SSynthetic::NO_RANGE_TASKS;
+    config.gpu_us = 0;
+    config.preset = SSynthetic::PRESET_NONE;
+    config.input_us = 0;
+    config.lanes = false;
+    config.suspend = false;
+    config.replay = true;
+    uint32_t sweep_systems[MTaskScheduling::NUM_STACKS];
+    uint32_t num_sweep_systems = 0;
+    uint32_t sweep_threads[MTaskScheduling::MAX_NUM_WORKER_THREADS];
+    uint32_t num_sweep_threads = 0;
+    uint32_t sweep_depths[MTaskScheduling::MAX_FRAMES_IN_FLIGHT];
+    uint32_t num_sweep_depths = 0;
+    uint32_t depth = 2;
+    MTaskScheduling::scheduling_policy_t policies[2] = { MTaskScheduling::SP_STACK_TOP, MTaskScheduling::SP_WORK_STEALING };
+    uint32_t num_policies = 1;
+    MTaskScheduling::profiling_level_t profiling_levels[3] = { MTaskScheduling::PL_OFF, MTaskScheduling::PL_COUNTERS, MTaskScheduling::PL_TRACE };
+    uint32_t num_profiling_levels = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* option = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value)
+        {
+            usage();
+            return 1;
+        }
+
+        if (!strcmp(option, "--threads"))            num_threads = atoi(value);
+        else if (!strcmp(option, "--systems"))       config.num_systems = atoi(value);
+        else if (!strcmp(option, "--groups"))        config.num_groups = atoi(value);
+        else if (!strcmp(option, "--tasks"))         config.tasks_per_group = atoi(value);
+        else if (!strcmp(option, "--independent"))   config.independent_tasks = atoi(value);
+        else if (!strcmp(option, "--work"))          config.work = atoi(value);
+        else if (!strcmp(option, "--frames"))        config.num_frames = atoi(value);
+        else if (!strcmp(option, "--range"))         config.range_grain = atoi(value);
+        else if (!strcmp(option, "--gpu-us"))        config.gpu_us = atoi(value);
+        else if (!strcmp(option, "--depth"))         depth = atoi(value);
+        else if (!strcmp(option, "--ooo"))           MTaskScheduling::OUT_OF_ORDER_WINDOW = atoi(value);
+        else if (!strcmp(option, "--sweep-depth"))   num_sweep_depths = parse_list(value, sweep_depths, MTaskScheduling::MAX_FRAMES_IN_FLIGHT);
+        else if (!strcmp(option, "--sweep-systems")) num_sweep_systems = parse_list(value, sweep_systems, MTaskScheduling::NUM_STACKS);
+        else if (!strcmp(option, "--sweep-threads")) num_sweep_threads = parse_list(value, sweep_threads, MTaskScheduling::MAX_NUM_WORKER_THREADS);
+        else if (!strcmp(option, "--wiring"))
+        {
+            if (!strcmp(value, "none"))       config.wiring = SSynthetic::WIRING_NONE;
+            else if (!strcmp(value, "chain")) config.wiring = SSynthetic::WIRING_CHAIN;
+            else if (!strcmp(value, "cross")) config.wiring = SSynthetic::WIRING_CROSS;
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+        else if (!strcmp(option, "--input-us"))      config.input_us = atoi(value);
+        else if (!strcmp(option, "--stream"))        stream_config.num_loads = atoi(value);
+        else if (!strcmp(option, "--sound"))         sound_config.num_voices = atoi(value);
+        else if (!strcmp(option, "--sound-wav"))     sound_config.wav_path = value;
+        else if (!strcmp(option, "--trace"))         trace_path = value;
+        else if (!strcmp(option, "--metrics"))       metrics_name = value;
+        else if (!strcmp(option, "--perf"))
+        {
+            if (!strcmp(value, "on"))         MTaskScheduling::PERF_COUNTERS = true;
+            else if (!strcmp(value, "off"))   MTaskScheduling::PERF_COUNTERS = false;
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+        else if (!strcmp(option, "--profiling"))
+        {
+            if (!strcmp(value, "off"))           { profiling_levels[0] = MTaskScheduling::PL_OFF;      num_profiling_levels = 1; }
+            else if (!strcmp(value, "counters")) { profiling_levels[0] = MTaskScheduling::PL_COUNTERS; num_profiling_levels = 1; }
+            else if (!strcmp(value, "trace"))    { profiling_levels[0] = MTaskScheduling::PL_TRACE;    num_profiling_levels = 1; }
+            else if (!strcmp(value, "all"))      { profiling_levels[0] = MTaskScheduling::PL_OFF;      num_profiling_levels = 3; }
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+        else if (!strcmp(option, "--stream-kb"))     stream_config.load_kb = atoi(value);
+        else if (!strcmp(option, "--stream-io"))
+        {
+            if (!strcmp(value, "uring"))        stream_config.backend = MPlatform::IO_URING;
+            else if (!strcmp(value, "threads")) stream_config.backend = MPlatform::IO_THREAD_POOL;
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+        else if (!strcmp(option, "--lanes"))
+        {
+            if (!strcmp(value, "on"))         config.lanes = true;
+            else if (!strcmp(value, "off"))   config.lanes = false;
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+        else if (!strcmp(option, "--suspend"))
+        {
+            if (!strcmp(value, "on"))         config.suspend = true;
+            else if (!strcmp(value, "off"))   config.suspend = false;
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+        else if (!strcmp(option, "--replay"))
+        {
+            if (!strcmp(value, "on"))         config.replay = true;
+            else if (!strcmp(value, "off"))   config.replay = false;
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+        else if (!strcmp(option, "--pin"))
+        {
+            if (!strcmp(value, "none"))         MTaskScheduling::WORKER_PINNING = MPlatform::PIN_NONE;
+            else if (!strcmp(value, "spread"))  MTaskScheduling::WORKER_PINNING = MPlatform::PIN_SPREAD;
+            else if (!strcmp(value, "compact")) MTaskScheduling::WORKER_PINNING = MPlatform::PIN_COMPACT;
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+        else if (!strcmp(option, "--critical"))
+        {
+            if (!strcmp(value, "on"))         MTaskScheduling::CRITICAL_PATH_PRIORITY = true;
+            else if (!strcmp(value, "off"))   MTaskScheduling::CRITICAL_PATH_PRIORITY = false;
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+        else if (!strcmp(option, "--preset"))
+        {
+            if (!strcmp(value, "none"))        config.preset = SSynthetic::PRESET_NONE;
+            else if (!strcmp(value, "gemini")) config.preset = SSynthetic::PRESET_GEMINI;
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+        else if (!strcmp(option, "--policy"))
+        {
+            if (!strcmp(value, "stack"))      { policies[0] = MTaskScheduling::SP_STACK_TOP;     num_policies = 1; }
+            else if (!strcmp(value, "steal")) { policies[0] = MTaskScheduling::SP_WORK_STEALING; num_policies = 1; }
+            else if (!strcmp(value, "both"))  { policies[0] = MTaskScheduling::SP_STACK_TOP;     num_policies = 2; }
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+        ++i;
+    }
+
+    if (config.preset == SSynthetic::PRESET_GEMINI)
+    {
+        config.num_systems = 5;
+        num_sweep_systems = 0;
+    }
+
+    if (!num_sweep_threads)
+    {
+        sweep_threads[num_sweep_threads++] = num_threads;
+    }
+
+    for (uint32_t i = 0; i < num_sweep_threads; ++i)
+    {
+        // the lanes use the thread ids after the workers
+        if (sweep_threads[i] == 0 || sweep_threads[i] > MTaskScheduling::MAX_NUM_WORKER_THREADS)
+        {
+            std::cout << "number of worker threads must be in [1, " << MTaskScheduling::MAX_NUM_WORKER_THREADS << "]\n";
+            return 1;
+        }
+    }
+
+    if (stream_config.num_loads > SStreaming::MAX_REQUESTS || stream_config.load_kb == 0)
+    {
+        std::cout << "streamed files must be in [0, " << SStreaming::MAX_REQUESTS << "] of at least 1 KB\n";
+        return 1;
+    }
+
+    if (sound_config.num_voices > SSound::MAX_VOICES)
+    {
+        std::cout << "voices must be in [0, " << SSound::MAX_VOICES << "]\n";
+        return 1;
+    }
+
+    if (!num_sweep_depths)
+    {
+        sweep_depths[num_sweep_depths++] = depth;
+    }
+
+    for (uint32_t i = 0; i < num_sweep_depths; ++i)
+    {
+        if (sweep_depths[i] < 2 || sweep_depths[i] > MTaskScheduling::MAX_FRAMES_IN_FLIGHT)
+        {
+            std::cout << "frames in flight must be in [2, " << MTaskScheduling::MAX_FRAMES_IN_FLIGHT << "]\n";
+            return 1;
+        }
+    }
+
+    if (!num_profiling_levels)
+    {
+        profiling_levels[num_profiling_levels++] = trace_path ? MTaskScheduling::PL_TRACE :
+                                                   MTaskScheduling::PERF_COUNTERS ? MTaskScheduling::PL_COUNTERS : MTaskScheduling::PL_OFF;
+    }
+    profiling_level = profiling_levels[0];
+
+    if (stream_config.num_loads && !init_stream_files())
+        return 1;
+
+    init_tones();
+
+    if (num_profiling_levels > 1)
+    {
+        // the cost of each level on the scheduler, everything else as configured
+        const char* level_names[] = { "off", "counters", "trace" };
+        std::cout << "profiling | tasks/s | sched overhead | ns per pick\n";
+        for (uint32_t i = 0; i < num_profiling_levels; ++i)
+        {
+            profiling_level = profiling_levels[i];
+            result_t r;
+            if (!run(config, policies[0], sweep_threads[0], sweep_depths[0], &r))
+            {
+                clear_loads();
+                return 1;
+            }
+
+            std::cout << level_names[profiling_level] << " | "
+                      << tasks_per_second(r) << " | "
+                      << sched_overhead(r) << " | "
+                      << ns_per_pick(r) << "\n";
+        }
+
+        clear_loads();
+
+        return 0;
+    }
+
+    if (num_sweep_systems || num_sweep_threads > 1 || num_sweep_depths > 1 || num_policies > 1)
+    {
+        if (!num_sweep_systems)
+        {
+            sweep_systems[num_sweep_systems++] = config.num_systems;
+        }
+
+        std::cout << "policy | threads | depth | systems | tasks/frame | tasks/s | frames/s | sched overhead | ns per pick | CAS retries/task | blocked picks/task | parks | wakes | wake us | out of order | frame ms | critical path us\n";
+        for (uint32_t i = 0; i < num_sweep_systems; ++i)
+        {
+            config.num_systems = sweep_systems[i];
+            for (uint32_t j = 0; j < num_sweep_threads; ++j)
+            {
+                for (uint32_t d = 0; d < num_sweep_depths; ++d)
+                {
+                    for (uint32_t k = 0; k < num_policies; ++k)
+                    {
+                        result_t r;
+                        if (!run(config, policies[k], sweep_threads[j], sweep_depths[d], &r))
+                        {
+                            clear_loads();
+                            return 1;
+                        }
+
+                        std::cout << policy_name(policies[k]) << " | "
+                                  << sweep_threads[j] << " | "
+                                  << sweep_depths[d] << " | "
+                                  << config.num_systems << " | "
+                                  << SSynthetic::tasks_per_frame() << " | "
+                                  << tasks_per_second(r) << " | "
+                                  << frames_per_second(r) << " | "
+                                  << sched_overhead(r) << " | "
+                                  << ns_per_pick(r) << " | "
+                                  << per_task(r, MTaskScheduling::CC_CAS_RETRIES) << " | "
+                                  << per_task(r, MTaskScheduling::CC_BLOCKED_PICKS) << " | "
+                                  << r.num_parks << " | "
+                                  << r.num_wakes << " | "
+                                  << wake_latency_us(r) << " | "
+                                  << r.num_out_of_order << " | "
+                                  << r.frame_latency_ns / 1e6 << " | "
+                                  << r.critical_path_cycles / MPlatform::g_clock.ticks_per_ns / 1e3 << "\n";
+                    }
+                }
+            }
+        }
+
+        clear_loads();
+
+        return 0;
+    }
+
+    result_t r;
+    bool ok = run(config, policies[0], sweep_threads[0], sweep_depths[0], &r);
+    clear_loads();
+    if (!ok)
+        return 1;
+
+    MPlatform::discover_topology();
+    const MPlatform::cpu_topology_t& t = MPlatform::g_topology;
+
+    std::cout << "policy: " << policy_name(policies[0]) << "\n"
+              << "pinning: " << pinning_name(MTaskScheduling::WORKER_PINNING) << "\n"
+              << "topology: " << t.num_cpus << " cpus, " << t.num_cores << " cores, " << t.num_packages << " packages, "
+              << t.num_numa_nodes << " numa nodes, " << t.num_l3 << " l3 domains\n"
+              << "clock: " << (MPlatform::g_clock.tsc ? "invariant tsc, " : "monotonic, ") << MPlatform::g_clock.ticks_per_ns << " ticks/ns\n"
+              << "profiling: " << (profiling_level == MTaskScheduling::PL_TRACE ? "trace" : profiling_level == MTaskScheduling::PL_COUNTERS ? "counters" : "off") << "\n"
+              << "threads: " << r.num_threads << "\n"
+              << "frames in flight: " << sweep_depths[0] << "\n"
+              << "systems: " << config.num_systems << "\n"
+              << "tasks per frame: " << SSynthetic::tasks_per_frame() << "\n"
+              << "frames: " << r.num_frames << "\n"
+              << "tasks: " << r.num_tasks << "\n"
+              << "elapsed: " << r.elapsed_ns / 1e6 << " ms\n"
+              << "tasks/s: " << tasks_per_second(r) << "\n"
+              << "frames/s: " << frames_per_second(r) << "\n"
+              << "scheduling overhead: " << sched_overhead(r) << "\n"
+              << "ns per pick: " << ns_per_pick(r) << "\n"
+              << "parks: " << r.num_parks << "\n"
+              << "wakes: " << r.num_wakes << "\n"
+              << "wake latency: " << wake_latency_us(r) << " us (mean of " << r.woken_picks << " parked workers to their next pick)\n"
+              << "out of order picks: " << r.num_out_of_order << "\n"
+              << "CAS retries: " << r.contention[MTaskScheduling::CC_CAS_RETRIES] << " (" << per_task(r, MTaskScheduling::CC_CAS_RETRIES) << " per task)\n"
+              << "main stack CAS retries: " << r.contention[MTaskScheduling::CC_MAIN_STACK_RETRIES] << "\n"
+              << "blocked picks: " << r.contention[MTaskScheduling::CC_BLOCKED_PICKS] << " (" << per_task(r, MTaskScheduling::CC_BLOCKED_PICKS) << " per task)\n"
+              << "priority mask reloads: " << r.contention[MTaskScheduling::CC_MASK_RELOADS] << "\n"
+              << "suspended tasks: " << r.num_suspended << "\n"
+              << "submit per frame: " << submit_us_per_frame(r) << " us\n"
+              << "frame latency: " << r.frame_latency_ns / 1e6 << " ms\n"
+              << "critical path estimate: " << r.critical_path_cycles / MPlatform::g_clock.ticks_per_ns / 1e3 << " us\n"
+              << "frame time p50/p99/max: " << r.frame_times.p50_ns / 1e6 << " / " << r.frame_times.p99_ns / 1e6 << " / "
+              << r.frame_times.max_ns / 1e6 << " ms\n"
+              << "hitches (> 2x p50): " << r.frame_times.hitches << "\n";
+
+    if (profiling_level >= MTaskScheduling::PL_COUNTERS)
+    {
+        std::cout << "stack counters per frame:\n";
+        for (uint32_t s = 0; s < MTaskScheduling::NUM_ACTIVE_STACKS; ++s)
+        {
+            const MTaskScheduling::stack_counters_t& c = r.stack_counters[s];
+            std::cout << "  stack " << s << ": " << c.tasks / r.stack_frames << " tasks, "
+                      << c.exec_ticks / r.stack_frames / MPlatform::g_clock.ticks_per_ns / 1e3 << " us executing, "
+                      << c.sched_ticks / r.stack_frames / MPlatform::g_clock.ticks_per_ns / 1e3 << " us picking, "
+                      << (double) c.contention[MTaskScheduling::CC_CAS_RETRIES] / r.stack_frames << " CAS retries, "
+                      << (double) c.contention[MTaskScheduling::CC_BLOCKED_PICKS] / r.stack_frames << " blocked picks";
+            if (r.perf_available)
+            {
+                std::cout << ", " << c.perf[MPlatform::PC_INSTRUCTIONS] / r.stack_frames << " instructions, "
+                          << "IPC " << (double) c.perf[MPlatform::PC_INSTRUCTIONS] / std::max(c.perf[MPlatform::PC_CYCLES], (uint64_t) 1) << ", "
+                          << c.perf[MPlatform::PC_LLC_MISSES] / r.stack_frames << " LLC misses, "
+                          << c.perf[MPlatform::PC_BRANCH_MISSES] / r.stack_frames << " branch misses";
+            }
+            std::cout << "\n";
+        }
+    }
+
+    if (MTaskScheduling::PERF_COUNTERS && (!r.perf_available || profiling_level == MTaskScheduling::PL_OFF))
+    {
+        std::cout << "perf counters: unavailable\n";
+    }
+
+    if (trace_path)
+    {
+        std::cout << "trace: " << r.trace_events << " events (" << r.trace_dropped << " dropped), "
+                  << r.trace_bytes / 1e6 << " MB, " << (double) r.trace_bytes / std::max(r.trace_events, (uint64_t) 1) << " bytes per event\n";
+    }
+
+    if (stream_config.num_loads)
+    {
+        std::cout << "streaming: " << stream_config.num_loads << " x " << stream_config.load_kb << " KB, " << backend_name(r.io_backend) << "\n"
+                  << "loads: " << r.loads_finished << " (" << r.loads_failed << " failed)\n"
+                  << "read: " << read_mb_per_second(r) << " MB/s\n"
+                  << "loaded: " << loaded_mb_per_second(r) << " MB/s\n";
+    }
+
+    if (sound_config.num_voices)
+    {
+        std::cout << "voices: " << sound_config.num_voices << "\n"
+                  << "audio mixed/played: " << r.audio_frames_mixed / (SSound::SAMPLE_RATE / 1e3) << " / "
+                  << r.audio_frames_played / (SSound::SAMPLE_RATE / 1e3) << " ms\n"
+                  << "mixing: " << mix_ms(r) << " ms\n"
+                  << "voices mixed per ms: " << voices_per_ms(r) << "\n"
+                  << "underruns: " << r.underruns << " (" << r.underrun_frames / (SSound::SAMPLE_RATE / 1e3) << " ms of silence)\n";
+    }
+
+    return 0;
+}
+
+void signal_shutdown()
+{
+    // signal task scheduling manager
+    MTaskScheduling::g_quit_request.store(1, std::memory_order_relaxed);
+    MTaskScheduling::wake_workers();
+    MTaskScheduling::wake_lanes();
+}
@@ -0,0 +1,139 @@
+#include "managers/Metrics.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+
+void usage()
+{
+    std::cout << "usage: gemini_metrics [options]\n"
+              << "  tails the metrics a running gemini or gemini_bench publishes with start_metrics\n"
+              << "  --name NAME       shared memory block (default: /gemini)\n"
+              << "  --interval MS     time between lines (default: 1000)\n"
+              << "  --count N         lines to print, 0 runs until the process exits (default: 0)\n";
+}
+
+// smallest frame time in us that at least fraction p of the frames in the histogram took at most
+uint64_t frame_time_percentile(const uint64_t* frames, uint64_t num_frames, double p)
+{
+    uint64_t n = 0;
+    for (uint32_t i = 0; i < MMetrics::FRAME_TIME_BUCKETS; ++i)
+    {
+        n += frames[i];
+        if (n && n >= p * num_frames)
+            return MMetrics::frame_time_bucket_us(i + 1);
+    }
+
+    return 0;
+}
+
+void print_line(const MMetrics::metrics_t& m, const MMetrics::metrics_t& previous)
+{
+    double s = std::max(m.published_ns - previous.published_ns, (int64_t) 1) * 1e-9;
+
+    uint64_t frames[MMetrics::FRAME_TIME_BUCKETS];
+    uint64_t num_frames = m.frames - previous.frames;
+    for (uint32_t i = 0; i < MMetrics::FRAME_TIME_BUCKETS; ++i)
+    {
+        frames[i] = m.frame_times[i] - previous.frame_times[i];
+    }
+
+    std::cout << std::fixed << std::setprecision(1)
+              << std::setw(9) << num_frames / s
+              << std::setw(8) << frame_time_percentile(frames, num_frames, 0.5) * 1e-3
+              << std::setw(8) << frame_time_percentile(frames, num_frames, 0.99) * 1e-3
+              << std::setw(8) << frame_time_percentile(frames, num_frames, 1.0) * 1e-3
+              << std::setprecision(0)
+              << std::setw(11) << (m.tasks - previous.tasks) / s
+              << std::setw(11) << (m.cas_retries - previous.cas_retries) / s
+              << std::setw(11) << (m.main_stack_retries - previous.main_stack_retries) / s
+              << std::setw(11) << (m.blocked_picks - previous.blocked_picks) / s
+              << std::setw(11) << (m.mask_reloads - previous.mask_reloads) / s
+              << std::setw(6) << m.arena_blocks_used << "/" << m.arena_blocks << "  ";
+    for (uint32_t i = 0; i < m.num_stacks && i < MMetrics::MAX_STACKS; ++i)
+    {
+        if (m.stack_names[i][0])
+            std::cout << " " << std::string(m.stack_names[i], strnlen(m.stack_names[i], MMetrics::STACK_NAME_SIZE));
+        else
+            std::cout << " " << i;
+        std::cout << "=" << m.queue_depth[i];
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    const char* name = "/gemini";
+    uint32_t interval_ms = 1000;
+    uint32_t count = 0;
+    for (int i = 1; i < argc; i += 2)
+    {
+        const char* option = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value)
+        {
+            usage();
+            return 1;
+        }
+
+        if (!strcmp(option, "--name"))             name = value;
+        else if (!strcmp(option, "--interval"))    interval_ms = std::max(atoi(value), 1);
+        else if (!strcmp(option, "--count"))       count = atoi(value);
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    const MMetrics::metrics_block_t* block = MMetrics::open_metrics(name);
+    if (!block)
+    {
+        std::cout << "no version " << MMetrics::METRICS_VERSION << " metrics at " << name << "\n";
+        return 1;
+    }
+
+    MMetrics::metrics_t previous;
+    if (!MMetrics::read_metrics(block, &previous))
+    {
+        std::cout << "could not read " << name << "\n";
+        MMetrics::close_metrics(block);
+        return 1;
+    }
+
+    std::cout << "pid " << block->pid << ", " << previous.num_workers << " workers, frame times in ms, rates per second\n"
+              << " frames/s     p50     p99     max      tasks  CAS retry main retry    blocked    reloads  arena     queue depth\n";
+
+    // reading never blocks the writer, a line is skipped when every try overlapped a publish
+    for (uint32_t line = 0; !count || line < count; )
+    {
+        usleep(interval_ms * 1000);
+
+        MMetrics::metrics_t m;
+        if (!MMetrics::read_metrics(block, &m))
+            continue;
+
+        if (m.sequence == previous.sequence)
+        {
+            if (kill(block->pid, 0) != 0)
+            {
+                std::cout << "pid " << block->pid << " exited\n";
+                break;
+            }
+            continue; // not published since, e.g. a short interval
+        }
+
+        print_line(m, previous);
+        previous = m;
+        ++line;
+    }
+
+    MMetrics::close_metrics(block);
+
+    return 0;
+}
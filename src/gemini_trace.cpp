@@ -0,0 +1,476 @@
+#include "managers/Trace.h"
+
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+// a task of the trace, times in clock ticks
+typedef struct
+{
+    uint64_t pick_start;
+    uint64_t start;         // of execution
+    uint64_t end;
+    uint32_t thread;
+    uint32_t stack;
+    uint32_t iteration;
+    uint32_t reached_checkpoint;
+    uint32_t dependencies;
+    uint32_t contention[MTrace::NUM_CONTENTION];
+    // derived
+    uint64_t top;           // became the top of its stack
+    uint64_t ready;         // its last checkpoint was reached, 0 without checkpoints in the trace
+    uint32_t gate;          // that checkpoint
+    uint32_t predecessor;   // on the critical path, NO_TASK at the start of a frame
+    bool by_checkpoint;     // the predecessor had to finish, not just to be picked
+} task_t;
+
+// per frame, i.e. per iteration
+typedef struct
+{
+    uint64_t first;         // earliest pick start and latest end of the frame's tasks
+    uint64_t last;
+    uint64_t tasks;
+    uint64_t exec;
+    uint64_t sched;
+    uint64_t contention[MTrace::NUM_CONTENTION];
+    uint64_t path;          // critical path, from its first pick to the frame's last end
+    uint64_t path_exec;     // execution on the path
+    uint32_t path_tasks;
+    uint32_t last_task;
+} frame_t;
+
+const uint32_t NO_TASK = 0xFFFFFFFF;
+
+void usage()
+{
+    std::cout << "usage: gemini_trace <command> TRACE [options]\n"
+              << "  info TRACE        summary of the trace file\n"
+              << "  json TRACE OUT    export to chrome://tracing / Perfetto JSON\n"
+              << "  analyze TRACE     utilization, scheduling overhead, blocked picks, checkpoint wait\n"
+              << "                    latencies and critical paths per frame\n"
+              << "    --frames        print every frame, not just the longest ones\n";
+}
+
+int info(const MTrace::trace_file_t& trace)
+{
+    const MTrace::trace_header_t* header = trace.header;
+
+    uint64_t num_records = 0;
+    uint64_t event_bytes = 0;
+    uint64_t first_ticks = ~(uint64_t) 0;
+    uint64_t last_ticks = 0;
+    for (const MTrace::trace_record_t* record = MTrace::next_record(&trace, nullptr); record; record = MTrace::next_record(&trace, record))
+    {
+        ++num_records;
+        if (record->type == MTrace::TR_EVENTS)
+        {
+            event_bytes += ((const MTrace::trace_events_t*) MTrace::record_payload(record))->bytes;
+        }
+    }
+    MTrace::for_each_event(&trace, [&](uint32_t thread, const MTrace::trace_event_t& event)
+    {
+        first_ticks = std::min(first_ticks, event.sched_start);
+        last_ticks = std::max(last_ticks, event.sched_start + event.sched_cycles + event.exec_cycles);
+    });
+
+    std::cout << "size: " << trace.size / 1e6 << " MB\n"
+              << "records: " << num_records << (trace.end ? "" : " (no end record, cut off)") << "\n"
+              << "workers: " << header->num_workers << ", threads with events: " << trace.num_threads << "\n"
+              << "frames in flight: " << header->frames_in_flight << "\n"
+              << "clock: " << header->ticks_per_ns << " ticks/ns\n"
+              << "events: " << trace.num_events << ", " << (double) event_bytes / std::max(trace.num_events, (uint64_t) 1) << " bytes each\n";
+    if (trace.num_events)
+    {
+        std::cout << "span: " << (last_ticks - first_ticks) / header->ticks_per_ns / 1e6 << " ms\n";
+    }
+    if (trace.end)
+    {
+        std::cout << "dropped: " << trace.end->dropped << "\n";
+    }
+
+    std::cout << "stacks:";
+    for (uint32_t i = 0; i < MTrace::MAX_STACK_IDS; ++i)
+    {
+        if (trace.stack_names[i])
+            std::cout << " " << i << "=" << trace.stack_names[i];
+    }
+    std::cout << "\n";
+
+    return 0;
+}
+
+double percentile(std::vector<uint64_t>* values, double p)
+{
+    if (values->empty())
+        return 0;
+
+    size_t k = std::min((size_t) (p * values->size()), values->size() - 1);
+    std::nth_element(values->begin(), values->begin() + k, values->end());
+
+    return (*values)[k];
+}
+
+const char* stack_name(const MTrace::trace_file_t& trace, uint32_t stack, char* buffer)
+{
+    if (stack < MTrace::MAX_STACK_IDS && trace.stack_names[stack])
+        return trace.stack_names[stack];
+    sprintf(buffer, "stack %u", stack);
+
+    return buffer;
+}
+
+const char* checkpoint_name(const MTrace::trace_file_t& trace, uint32_t checkpoint, char* buffer)
+{
+    if (checkpoint < MTrace::MAX_CHECKPOINT_IDS && trace.checkpoint_names[checkpoint])
+        return trace.checkpoint_names[checkpoint];
+    sprintf(buffer, "checkpoint %u", checkpoint);
+
+    return buffer;
+}
+
+// a stack's top is blocked from when the task above it was picked, or the
+// stack was submitted again, until the last checkpoint it waits for is
+// reached. the critical path follows whatever released a task last: the
+// task that reached its last checkpoint or the task picked above it
+int analyze(const MTrace::trace_file_t& trace, bool all_frames)
+{
+    const MTrace::trace_header_t* header = trace.header;
+    double us_per_tick = 1e-3 / header->ticks_per_ns;
+
+    std::vector<task_t> tasks;
+    tasks.reserve(trace.num_events);
+    uint32_t first_iteration = 0xFFFFFFFF;
+    uint32_t last_iteration = 0;
+    uint32_t num_stacks = 0;
+    MTrace::for_each_event(&trace, [&](uint32_t thread, const MTrace::trace_event_t& event)
+    {
+        task_t task = {};
+        task.pick_start = event.sched_start;
+        task.start = event.sched_start + event.sched_cycles;
+        task.end = task.start + event.exec_cycles;
+        task.thread = thread;
+        task.stack = event.stack;
+        task.iteration = event.iteration;
+        task.reached_checkpoint = event.reached_checkpoint;
+        task.dependencies = event.dependencies;
+        for (uint32_t k = 0; k < MTrace::NUM_CONTENTION; ++k)
+        {
+            task.contention[k] = event.contention[k];
+        }
+        task.predecessor = NO_TASK;
+        tasks.push_back(task);
+        first_iteration = std::min(first_iteration, event.iteration);
+        last_iteration = std::max(last_iteration, event.iteration);
+        num_stacks = std::max(num_stacks, event.stack + 1);
+    });
+    if (tasks.empty())
+    {
+        std::cout << "no tasks\n";
+        return 1;
+    }
+
+    // who reached which checkpoint in which iteration
+    std::unordered_map<uint64_t, uint32_t> reached;
+    reached.reserve(tasks.size() / 4);
+    for (uint32_t i = 0; i < tasks.size(); ++i)
+    {
+        if (tasks[i].reached_checkpoint)
+        {
+            reached[(uint64_t) tasks[i].iteration << 32 | tasks[i].reached_checkpoint] = i;
+        }
+    }
+
+    // pick order per stack
+    std::vector<uint32_t> order(tasks.size());
+    for (uint32_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+    {
+        const task_t& x = tasks[a];
+        const task_t& y = tasks[b];
+        if (x.stack != y.stack)
+            return x.stack < y.stack;
+        if (x.iteration != y.iteration)
+            return x.iteration < y.iteration;
+        return x.start < y.start;
+    });
+
+    for (uint32_t k = 0; k < order.size(); ++k)
+    {
+        task_t& task = tasks[order[k]];
+        const task_t* above = k > 0 && tasks[order[k - 1]].stack == task.stack ? &tasks[order[k - 1]] : nullptr;
+        uint32_t stack_predecessor = NO_TASK;
+        if (above && above->iteration == task.iteration)
+        {
+            task.top = above->start;
+            stack_predecessor = order[k - 1];
+        }
+        else if (above)
+            task.top = above->end; // submitted again by the last task of the previous iteration
+        else
+            task.top = task.pick_start;
+        task.top = std::min(task.top, task.start);
+
+        const MTrace::trace_dependencies_t* dependencies = task.dependencies < trace.num_dependencies ? trace.dependencies[task.dependencies] : nullptr;
+        uint32_t gate_task = NO_TASK;
+        for (uint32_t f = 0; dependencies && f <= dependencies->frames_back && f < MTrace::MAX_FRAMES_BACK && f <= task.iteration; ++f)
+        {
+            for (uint32_t w = 0; w < MTrace::CHECKPOINT_WORDS; ++w)
+            {
+                for (uint64_t bits = dependencies->frames[f][w]; bits; bits &= bits - 1)
+                {
+                    uint32_t checkpoint = w * 64 + __builtin_ctzll(bits);
+                    auto r = reached.find((uint64_t) (task.iteration - f) << 32 | checkpoint);
+                    if (r == reached.end() || tasks[r->second].end <= task.ready)
+                        continue;
+                    task.ready = tasks[r->second].end;
+                    task.gate = checkpoint;
+                    gate_task = r->second;
+                }
+            }
+        }
+
+        if (gate_task != NO_TASK && task.ready >= task.top)
+        {
+            task.predecessor = gate_task;
+            task.by_checkpoint = true;
+        }
+        else
+        {
+            task.predecessor = stack_predecessor;
+        }
+    }
+
+    // per frame sums
+    uint32_t num_frames = last_iteration - first_iteration + 1;
+    std::vector<frame_t> frames(num_frames);
+    for (frame_t& frame : frames)
+    {
+        frame = {};
+        frame.first = ~(uint64_t) 0;
+        frame.last_task = NO_TASK;
+    }
+    std::vector<uint64_t> blocked((size_t) num_frames * num_stacks, 0);
+    std::vector<uint64_t> stack_blocked(num_stacks, 0);
+    std::vector<uint64_t> stack_contention((size_t) num_stacks * MTrace::NUM_CONTENTION, 0); // of the picks that ended with the stack's tasks
+    std::vector<std::vector<uint64_t>> waits(MTrace::MAX_CHECKPOINT_IDS);
+    for (uint32_t i = 0; i < tasks.size(); ++i)
+    {
+        const task_t& task = tasks[i];
+        frame_t& frame = frames[task.iteration - first_iteration];
+        frame.first = std::min(frame.first, task.pick_start);
+        if (task.end > frame.last)
+        {
+            frame.last = task.end;
+            frame.last_task = i;
+        }
+        ++frame.tasks;
+        frame.exec += task.end - task.start;
+        frame.sched += task.start - task.pick_start;
+        for (uint32_t k = 0; k < MTrace::NUM_CONTENTION; ++k)
+        {
+            frame.contention[k] += task.contention[k];
+            stack_contention[(size_t) task.stack * MTrace::NUM_CONTENTION + k] += task.contention[k];
+        }
+
+        if (task.ready > task.top)
+        {
+            uint64_t b = std::min(task.ready, task.start) - task.top;
+            blocked[(size_t) (task.iteration - first_iteration) * num_stacks + task.stack] += b;
+            stack_blocked[task.stack] += b;
+            waits[task.gate].push_back(task.start - std::min(task.ready, task.start));
+        }
+    }
+
+    // critical paths, within the frame
+    std::vector<uint64_t> path_stack_exec(num_stacks, 0);
+    for (uint32_t f = 0; f < num_frames; ++f)
+    {
+        frame_t& frame = frames[f];
+        uint32_t t = frame.last_task;
+        uint32_t first = t;
+        bool counts = true; // the last task's execution is on the path
+        while (t != NO_TASK && tasks[t].iteration == first_iteration + f)
+        {
+            if (counts)
+            {
+                frame.path_exec += tasks[t].end - tasks[t].start;
+                path_stack_exec[tasks[t].stack] += tasks[t].end - tasks[t].start;
+            }
+            ++frame.path_tasks;
+            first = t;
+            counts = tasks[t].by_checkpoint;
+            t = tasks[t].predecessor;
+        }
+        if (frame.last_task != NO_TASK)
+        {
+            frame.path = frame.last - tasks[first].pick_start;
+        }
+    }
+
+    // report
+    uint32_t num_threads = trace.num_threads;
+    std::vector<uint64_t> windows, utilization, overhead, paths;
+    uint64_t total_exec = 0;
+    uint64_t total_sched = 0;
+    uint64_t total_path_exec = 0;
+    uint64_t total_contention[MTrace::NUM_CONTENTION] = {};
+    for (const frame_t& frame : frames)
+    {
+        if (!frame.tasks)
+            continue;
+        uint64_t window = frame.last - frame.first;
+        windows.push_back(window);
+        utilization.push_back(1000 * frame.exec / std::max(window * num_threads, (uint64_t) 1)); // permille
+        overhead.push_back(1000 * frame.sched / std::max(frame.exec, (uint64_t) 1));
+        paths.push_back(frame.path);
+        total_exec += frame.exec;
+        total_sched += frame.sched;
+        total_path_exec += frame.path_exec;
+        for (uint32_t k = 0; k < MTrace::NUM_CONTENTION; ++k)
+        {
+            total_contention[k] += frame.contention[k];
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "tasks: " << tasks.size() << ", frames: " << windows.size() << ", threads: " << num_threads << "\n"
+              << "                      p50      p99      max\n"
+              << "frame window us  " << std::setw(8) << percentile(&windows, 0.5) * us_per_tick << " "
+              << std::setw(8) << percentile(&windows, 0.99) * us_per_tick << " " << std::setw(8) << percentile(&windows, 1.0) * us_per_tick << "\n"
+              << "utilization %    " << std::setw(8) << percentile(&utilization, 0.5) / 10 << " "
+              << std::setw(8) << percentile(&utilization, 0.99) / 10 << " " << std::setw(8) << percentile(&utilization, 1.0) / 10 << "\n"
+              << "sched overhead % " << std::setw(8) << percentile(&overhead, 0.5) / 10 << " "
+              << std::setw(8) << percentile(&overhead, 0.99) / 10 << " " << std::setw(8) << percentile(&overhead, 1.0) / 10 << "\n"
+              << "critical path us " << std::setw(8) << percentile(&paths, 0.5) * us_per_tick << " "
+              << std::setw(8) << percentile(&paths, 0.99) * us_per_tick << " " << std::setw(8) << percentile(&paths, 1.0) * us_per_tick << "\n"
+              << "scheduling overhead overall: " << 100.0 * total_sched / std::max(total_exec, (uint64_t) 1) << " %\n"
+              << "per frame: " << (double) total_contention[0] / windows.size() << " CAS retries, "
+              << (double) total_contention[1] / windows.size() << " main stack retries, "
+              << (double) total_contention[2] / windows.size() << " blocked picks, "
+              << (double) total_contention[3] / windows.size() << " mask reloads\n";
+
+    char buffer[32];
+    std::cout << "\nstack            blocked us/frame   critical path share %   CAS retries/frame   blocked picks/frame\n";
+    for (uint32_t s = 0; s < num_stacks; ++s)
+    {
+        std::cout << std::left << std::setw(16) << stack_name(trace, s, buffer) << std::right
+                  << std::setw(17) << stack_blocked[s] * us_per_tick / windows.size()
+                  << std::setw(24) << 100.0 * path_stack_exec[s] / std::max(total_path_exec, (uint64_t) 1)
+                  << std::setw(20) << (double) stack_contention[(size_t) s * MTrace::NUM_CONTENTION + 0] / windows.size()
+                  << std::setw(22) << (double) stack_contention[(size_t) s * MTrace::NUM_CONTENTION + 2] / windows.size() << "\n";
+    }
+
+    std::cout << "\ncheckpoint wait, from the last checkpoint of a blocked top to its pick\n"
+              << "checkpoint                       waits   mean us    p99 us    max us\n";
+    for (uint32_t c = 0; c < MTrace::MAX_CHECKPOINT_IDS; ++c)
+    {
+        std::vector<uint64_t>& w = waits[c];
+        if (w.empty())
+            continue;
+        uint64_t sum = 0;
+        for (uint64_t v : w)
+        {
+            sum += v;
+        }
+        std::cout << std::left << std::setw(30) << checkpoint_name(trace, c, buffer) << std::right
+                  << std::setw(8) << w.size()
+                  << std::setw(10) << (double) sum / w.size() * us_per_tick
+                  << std::setw(10) << percentile(&w, 0.99) * us_per_tick
+                  << std::setw(10) << percentile(&w, 1.0) * us_per_tick << "\n";
+    }
+
+    // every frame or the longest ones
+    std::vector<uint32_t> shown;
+    for (uint32_t f = 0; f < num_frames; ++f)
+    {
+        if (frames[f].tasks)
+            shown.push_back(f);
+    }
+    if (!all_frames && shown.size() > 10)
+    {
+        std::partial_sort(shown.begin(), shown.begin() + 10, shown.end(), [&](uint32_t a, uint32_t b)
+        {
+            return frames[a].last - frames[a].first > frames[b].last - frames[b].first;
+        });
+        shown.resize(10);
+        std::sort(shown.begin(), shown.end());
+    }
+
+    std::cout << "\n" << (all_frames ? "frames" : "longest frames") << "\n"
+              << "frame     window us  tasks  util %  sched %  path us  path exec us  path tasks  retries  blocked picks  blocked us by stack\n";
+    for (uint32_t f : shown)
+    {
+        const frame_t& frame = frames[f];
+        uint64_t window = frame.last - frame.first;
+        std::cout << std::setw(5) << first_iteration + f
+                  << std::setw(14) << window * us_per_tick
+                  << std::setw(7) << frame.tasks
+                  << std::setw(8) << 100.0 * frame.exec / std::max(window * num_threads, (uint64_t) 1)
+                  << std::setw(9) << 100.0 * frame.sched / std::max(frame.exec, (uint64_t) 1)
+                  << std::setw(9) << frame.path * us_per_tick
+                  << std::setw(14) << frame.path_exec * us_per_tick
+                  << std::setw(12) << frame.path_tasks
+                  << std::setw(9) << frame.contention[0] + frame.contention[1]
+                  << std::setw(15) << frame.contention[2] << " ";
+        for (uint32_t s = 0; s < num_stacks; ++s)
+        {
+            std::cout << " " << blocked[(size_t) f * num_stacks + s] * us_per_tick;
+        }
+        std::cout << "\n";
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        usage();
+        return 1;
+    }
+
+    const char* command = argv[1];
+    MTrace::trace_file_t trace;
+    if (!MTrace::open_trace(argv[2], &trace))
+    {
+        std::cout << "could not read " << argv[2] << " as a version " << MTrace::TRACE_VERSION << " trace\n";
+        return 1;
+    }
+
+    int result = 1;
+    if (!strcmp(command, "info"))
+    {
+        result = info(trace);
+    }
+    else if (!strcmp(command, "analyze") && (argc == 3 || (argc == 4 && !strcmp(argv[3], "--frames"))))
+    {
+        result = analyze(trace, argc == 4);
+    }
+    else if (!strcmp(command, "json") && argc == 4)
+    {
+        FILE* out = fopen(argv[3], "w");
+        if (out)
+        {
+            result = MTrace::write_chrome_trace(&trace, out) ? 0 : 1;
+            result |= fclose(out) != 0;
+        }
+        if (result)
+            std::cout << "could not write " << argv[3] << "\n";
+    }
+    else
+    {
+        usage();
+    }
+
+    MTrace::close_trace(&trace);
+
+    return result;
+}
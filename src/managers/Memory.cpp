@@ -14,13 +14,13 @@ void* operator new(size_t size, MMemory::LinearAllocator32kb& alloc, size_t coun
 namespace MMemory
 {
     void* _mem512x32kb;
-    ALIGN(64) std::atomic<uint64_t> _mem512x32kb_allocmask[8];
+    ALIGN(64) std::atomic<uint64_t> _mem512x32kb_allocmask[NUM_BLOCK_MASK_WORDS];
 
     void init_memory()
     {
-        _mem512x32kb = std::malloc(512*32*1024);
+        _mem512x32kb = std::malloc(NUM_BLOCKS*32*1024);
         assert(_mem512x32kb);
-        for (int i = 0; i < 8; ++i)
+        for (uint32_t i = 0; i < NUM_BLOCK_MASK_WORDS; ++i)
         {
             _mem512x32kb_allocmask[i].store(0xFFFFFFFFFFFFFFFF, std::memory_order_relaxed);
         }
@@ -29,6 +29,20 @@ namespace MMemory
     void clear_memory()
     {
         std::free(_mem512x32kb);
+        _mem512x32kb = nullptr;
+    }
+
+    uint32_t blocks_in_use()
+    {
+        if (!_mem512x32kb)
+            return 0;
+
+        uint32_t free_blocks = 0;
+        for (uint32_t i = 0; i < NUM_BLOCK_MASK_WORDS; ++i)
+        {
+            free_blocks += __builtin_popcountll(_mem512x32kb_allocmask[i].load(std::memory_order_relaxed));
+        }
+        return NUM_BLOCKS - free_blocks;
     }
 
     void LinearAllocator32kb::Init()
@@ -7,11 +7,15 @@
 
 namespace MMemory
 {
+    const uint32_t NUM_BLOCKS           = 512; // 32 KB blocks
+    const uint32_t NUM_BLOCK_MASK_WORDS = NUM_BLOCKS / 64;
+
     extern void* _mem512x32kb;
-    extern ALIGN(64) std::atomic<uint64_t> _mem512x32kb_allocmask[8];
+    extern ALIGN(64) std::atomic<uint64_t> _mem512x32kb_allocmask[NUM_BLOCK_MASK_WORDS];
 
     void init_memory();
     void clear_memory();
+    uint32_t blocks_in_use(); // of the NUM_BLOCKS, 0 before init_memory
 
     struct LinearAllocator32kb
     {
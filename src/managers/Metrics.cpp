@@ -0,0 +1,105 @@
+#include "managers/Metrics.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <emmintrin.h> // _mm_pause
+
+namespace MMetrics
+{
+    metrics_block_t* create_metrics(const char* name)
+    {
+        // a block left by a process that died is replaced
+        shm_unlink(name);
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0)
+            return nullptr;
+
+        if (ftruncate(fd, sizeof(metrics_block_t)) != 0)
+        {
+            close(fd);
+            shm_unlink(name);
+            return nullptr;
+        }
+
+        void* data = mmap(nullptr, sizeof(metrics_block_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd); // the mapping keeps the block
+        if (data == MAP_FAILED)
+        {
+            shm_unlink(name);
+            return nullptr;
+        }
+
+        // zero filled by ftruncate
+        metrics_block_t* block = (metrics_block_t*) data;
+        block->size = sizeof(metrics_block_t);
+        block->pid = getpid();
+        block->sequence.store(0, std::memory_order_relaxed);
+        block->version = METRICS_VERSION;
+        std::atomic_thread_fence(std::memory_order_release);
+        block->magic = METRICS_MAGIC; // last, readers check it first
+
+        return block;
+    }
+
+    void destroy_metrics(metrics_block_t* block, const char* name)
+    {
+        munmap(block, sizeof(metrics_block_t));
+        shm_unlink(name);
+    }
+
+    const metrics_block_t* open_metrics(const char* name)
+    {
+        int fd = shm_open(name, O_RDONLY, 0);
+        if (fd < 0)
+            return nullptr;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(metrics_block_t))
+        {
+            close(fd);
+            return nullptr;
+        }
+
+        void* data = mmap(nullptr, sizeof(metrics_block_t), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+            return nullptr;
+
+        const metrics_block_t* block = (const metrics_block_t*) data;
+        if (block->magic != METRICS_MAGIC || block->version != METRICS_VERSION || block->size != sizeof(metrics_block_t))
+        {
+            close_metrics(block);
+            return nullptr;
+        }
+
+        return block;
+    }
+
+    void close_metrics(const metrics_block_t* block)
+    {
+        munmap((void*) block, sizeof(metrics_block_t));
+    }
+
+    bool read_metrics(const metrics_block_t* block, metrics_t* metrics, uint32_t tries)
+    {
+        for (uint32_t i = 0; i < tries; ++i)
+        {
+            uint64_t sequence = block->sequence.load(std::memory_order_acquire);
+            if (sequence & 1)
+            {
+                _mm_pause();
+                continue;
+            }
+
+            memcpy(metrics, (const void*) &block->metrics, sizeof(metrics_t));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (block->sequence.load(std::memory_order_relaxed) == sequence)
+                return true;
+        }
+
+        return false;
+    }
+}
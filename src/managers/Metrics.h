@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// live counters of a running process in POSIX shared memory, published by
+// MTaskScheduling::start_metrics and tailed by gemini_metrics. one thread
+// writes the block under a sequence lock: the sequence is odd while the
+// metrics are written, readers copy them and try again when the sequence
+// changed meanwhile. the writer never waits for readers
+namespace MMetrics
+{
+    const uint32_t METRICS_MAGIC      = 0x5254454D; // "METR"
+    const uint32_t METRICS_VERSION    = 2;
+    const uint32_t MAX_STACKS         = 256;
+    const uint32_t STACK_NAME_SIZE    = 24;
+    const uint32_t FRAME_TIME_BUCKETS = 96; // four per octave of us, up to 2^24 us
+
+    typedef struct
+    {
+        int64_t published_ns;       // CLOCK_MONOTONIC
+        uint64_t sequence;          // of the publish, for readers that copied it
+        uint64_t frames;            // since start
+        uint64_t tasks;
+        double tasks_per_s;         // since the previous publish
+        uint64_t cas_retries;       // MTaskScheduling::contention_counter_t, since start
+        uint64_t main_stack_retries;
+        uint64_t blocked_picks;
+        uint64_t mask_reloads;
+        uint32_t arena_blocks_used; // MMemory 32 KB blocks
+        uint32_t arena_blocks;
+        uint32_t num_workers;
+        uint32_t num_stacks;        // active, the entries after them are 0
+        uint64_t frame_times[FRAME_TIME_BUCKETS]; // frames per frame_time_bucket since start
+        uint32_t queue_depth[MAX_STACKS];         // tasks left in the stack's current iteration
+        uint32_t iterations[MAX_STACKS];
+        char stack_names[MAX_STACKS][STACK_NAME_SIZE]; // empty for unnamed stacks
+    } metrics_t;
+
+    typedef struct
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t size;              // of metrics_block_t
+        int32_t pid;                // of the writer
+        std::atomic<uint64_t> sequence;
+        metrics_t metrics;
+    } metrics_block_t;
+
+    inline uint32_t frame_time_bucket(uint64_t us)
+    {
+        if (us < 4)
+            return (uint32_t) us;
+        uint32_t b = 63 - __builtin_clzll(us);
+        uint32_t bucket = 4 * (b - 1) + (uint32_t) ((us >> (b - 2)) & 3);
+        return bucket < FRAME_TIME_BUCKETS ? bucket : FRAME_TIME_BUCKETS - 1;
+    }
+
+    // smallest us in the bucket
+    inline uint64_t frame_time_bucket_us(uint32_t bucket)
+    {
+        if (bucket < 4)
+            return bucket;
+        return (uint64_t) (4 + bucket % 4) << (bucket / 4 - 1);
+    }
+
+    // the writer. creates or replaces the block name, e.g. "/gemini".
+    // nullptr when it can not be created
+    metrics_block_t* create_metrics(const char* name);
+    void destroy_metrics(metrics_block_t*, const char* name); // unmaps and removes the name
+
+    inline void begin_write(metrics_block_t* block)
+    {
+        block->sequence.store(block->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    inline void end_write(metrics_block_t* block)
+    {
+        block->metrics.sequence = block->sequence.load(std::memory_order_relaxed) + 1;
+        block->sequence.store(block->metrics.sequence, std::memory_order_release);
+    }
+
+    // readers. nullptr without a block of this version
+    const metrics_block_t* open_metrics(const char* name);
+    void close_metrics(const metrics_block_t*);
+    // false when every try overlapped a write
+    bool read_metrics(const metrics_block_t*, metrics_t*, uint32_t tries = 100);
+}
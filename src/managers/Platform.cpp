@@ -0,0 +1,554 @@
+#include "Platform.h"
+
+#include <linux/futex.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <cerrno>
+#include <cpuid.h>
+#include <cmath>
+#include <cstdint>
+
+namespace MPlatform
+{
+    cpu_topology_t g_topology;
+    uint32_t pin_order[2][MAX_CPUS]; // logical cpus in PIN_SPREAD and PIN_COMPACT order
+    tsc_clock_t g_clock = { false, 0, (uint64_t) 1 << 32, 1.0 }; // CLOCK_MONOTONIC until calibrated
+
+    bool futex_wait(std::atomic<uint32_t>* address, uint32_t expected)
+    {
+        long r = syscall(SYS_futex, (uint32_t*) address, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+        return r == 0 || errno == EINTR; // EAGAIN when *address had already changed
+    }
+
+    void futex_wake(std::atomic<uint32_t>* address, uint32_t count)
+    {
+        syscall(SYS_futex, (uint32_t*) address, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+    }
+
+    uint32_t open_perf_counters(perf_counters_t* counters)
+    {
+        const uint64_t configs[NUM_PERF_COUNTERS] = {
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_CACHE_MISSES, // last level cache on most CPUs
+            PERF_COUNT_HW_BRANCH_MISSES,
+        };
+
+        counters->available = 0;
+        for (uint32_t i = 0; i < NUM_PERF_COUNTERS; ++i)
+        {
+            counters->fds[i] = -1;
+            counters->pages[i] = nullptr;
+        }
+
+        // one group led by the instructions counter, the kernel schedules its counters together
+        for (uint32_t i = 0; i < NUM_PERF_COUNTERS; ++i)
+        {
+            if (i != PC_INSTRUCTIONS && !(counters->available & (1 << PC_INSTRUCTIONS)))
+                break; // no group without its leader
+
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = configs[i];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+
+            // this thread, any cpu
+            int group = i == PC_INSTRUCTIONS ? -1 : counters->fds[PC_INSTRUCTIONS];
+            int fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+            if (fd < 0)
+                continue;
+
+            void* page = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+            if (page == MAP_FAILED || !((perf_event_mmap_page*) page)->cap_user_rdpmc)
+            {
+                if (page != MAP_FAILED)
+                    munmap(page, sysconf(_SC_PAGESIZE));
+                close(fd);
+                continue;
+            }
+
+            counters->fds[i] = fd;
+            counters->pages[i] = (const volatile perf_event_mmap_page*) page;
+            counters->available |= 1 << i;
+        }
+
+        return counters->available;
+    }
+
+    void close_perf_counters(perf_counters_t* counters)
+    {
+        // the members before their leader
+        for (uint32_t i = NUM_PERF_COUNTERS; i-- > 0; )
+        {
+            if (counters->available & (1 << i))
+            {
+                munmap((void*) counters->pages[i], sysconf(_SC_PAGESIZE));
+                close(counters->fds[i]);
+            }
+        }
+        counters->available = 0;
+    }
+
+    // cpuid 0x80000007, edx bit 8: the TSC ticks at a constant rate in all power states
+    static bool invariant_tsc()
+    {
+        uint32_t eax, ebx, ecx, edx;
+        return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1 << 8));
+    }
+
+    // a TSC read paired with the middle of the tightest of a few monotonic brackets
+    static void sample_clocks(uint64_t* ticks, int64_t* ns)
+    {
+        int64_t best = INT64_MAX;
+        for (uint32_t i = 0; i < 8; ++i)
+        {
+            int64_t before = monotonic_ns();
+            uint64_t tsc = asm_rdtscp();
+            int64_t after = monotonic_ns();
+            if (after - before < best)
+            {
+                best = after - before;
+                *ticks = tsc;
+                *ns = before + (after - before) / 2;
+            }
+        }
+    }
+
+    void calibrate_clock()
+    {
+        static bool calibrated = false;
+        if (calibrated)
+            return;
+        calibrated = true;
+
+        // CLOCK_MONOTONIC until the TSC is trusted, counted from here as well
+        g_clock.start_ticks = (uint64_t) monotonic_ns();
+        if (!invariant_tsc())
+            return;
+
+        // two back to back intervals have to agree, or the TSC is not trusted
+        uint64_t ticks[3];
+        int64_t ns[3];
+        sample_clocks(&ticks[0], &ns[0]);
+        for (uint32_t i = 1; i < 3; ++i)
+        {
+            usleep(10000);
+            sample_clocks(&ticks[i], &ns[i]);
+        }
+        double rate1 = (double) (ticks[1] - ticks[0]) / (ns[1] - ns[0]);
+        double rate2 = (double) (ticks[2] - ticks[1]) / (ns[2] - ns[1]);
+        if (rate1 < 0.1 || rate1 > 10.0 || std::abs(rate2 - rate1) > 0.001 * rate1)
+            return;
+
+        double ticks_per_ns = (double) (ticks[2] - ticks[0]) / (ns[2] - ns[0]);
+        g_clock.ticks_per_ns = ticks_per_ns;
+        g_clock.ns_per_tick = (uint64_t) (4294967296.0 / ticks_per_ns);
+        g_clock.start_ticks = ticks[2];
+        g_clock.tsc = true;
+    }
+
+    // reads a list like 0-3,8,10-11 into cpus, returns the lowest cpu or MAX_CPUS
+    static uint32_t read_cpu_list(const std::string& path, bool* cpus)
+    {
+        std::ifstream f(path.c_str());
+        std::string list;
+        if (!(f >> list))
+            return MAX_CPUS;
+
+        uint32_t first = MAX_CPUS;
+        for (const char* c = list.c_str(); *c; )
+        {
+            char* end;
+            uint32_t lo = strtoul(c, &end, 10);
+            if (end == c)
+                break; // not a list
+            uint32_t hi = *end == '-' ? strtoul(end + 1, &end, 10) : lo;
+            for (uint32_t cpu = lo; cpu <= hi && cpu < MAX_CPUS; ++cpu)
+            {
+                cpus[cpu] = true;
+                first = std::min(first, cpu);
+            }
+            c = *end == ',' ? end + 1 : end;
+        }
+
+        return first;
+    }
+
+    static uint32_t read_number(const std::string& path, uint32_t fallback)
+    {
+        std::ifstream f(path.c_str());
+        uint32_t n;
+        return f >> n ? n : fallback;
+    }
+
+    // index of key in keys, appended if new
+    static uint32_t dense_index(uint32_t* keys, uint32_t* num_keys, uint32_t key)
+    {
+        uint32_t i = std::find(keys, keys + *num_keys, key) - keys;
+        if (i == *num_keys)
+            keys[(*num_keys)++] = key;
+
+        return i;
+    }
+
+    void discover_topology()
+    {
+        const std::string root = "/sys/devices/system/cpu/";
+        bool online[MAX_CPUS] = {};
+        if (read_cpu_list(root + "online", online) == MAX_CPUS)
+        {
+            for (uint32_t cpu = 0; cpu < std::min(std::max(NUM_HARDWARE_THREADS, 1u), MAX_CPUS); ++cpu)
+            {
+                online[cpu] = true;
+            }
+        }
+
+        uint32_t core_keys[MAX_CPUS], package_keys[MAX_CPUS], node_keys[MAX_CPUS], l3_keys[MAX_CPUS];
+        cpu_topology_t* t = &g_topology;
+        t->num_cpus = t->num_cores = t->num_packages = t->num_numa_nodes = t->num_l3 = 0;
+        for (uint32_t cpu = 0; cpu < MAX_CPUS; ++cpu)
+        {
+            if (!online[cpu])
+                continue;
+
+            std::string dir = root + "cpu" + std::to_string(cpu) + "/";
+
+            // cores and l3 domains are keyed by their lowest cpu, which is unique across packages
+            bool siblings[MAX_CPUS] = {};
+            uint32_t core_key = read_cpu_list(dir + "topology/thread_siblings_list", siblings);
+            if (core_key == MAX_CPUS)
+                core_key = cpu;
+            uint32_t smt = 0;
+            for (uint32_t i = 0; i < cpu; ++i)
+            {
+                smt += siblings[i];
+            }
+
+            uint32_t l3_key = MAX_CPUS;
+            for (uint32_t index = 0; l3_key == MAX_CPUS; ++index)
+            {
+                std::string cache = dir + "cache/index" + std::to_string(index) + "/";
+                uint32_t level = read_number(cache + "level", 0);
+                if (level == 0)
+                    break;
+                if (level == 3)
+                {
+                    bool shared[MAX_CPUS] = {};
+                    l3_key = read_cpu_list(cache + "shared_cpu_list", shared);
+                }
+            }
+
+            uint32_t package = read_number(dir + "topology/physical_package_id", 0);
+            if (l3_key == MAX_CPUS)
+                l3_key = MAX_CPUS + package; // no l3, one domain per package
+
+            uint32_t node = 0;
+            if (DIR* d = opendir(dir.c_str()))
+            {
+                while (dirent* e = readdir(d))
+                {
+                    if (!strncmp(e->d_name, "node", 4) && e->d_name[4] >= '0' && e->d_name[4] <= '9')
+                        node = strtoul(e->d_name + 4, nullptr, 10);
+                }
+                closedir(d);
+            }
+
+            cpu_t* c = &t->cpus[t->num_cpus++];
+            c->cpu = cpu;
+            c->core = dense_index(core_keys, &t->num_cores, core_key);
+            c->smt = smt;
+            c->package = dense_index(package_keys, &t->num_packages, package);
+            c->numa_node = dense_index(node_keys, &t->num_numa_nodes, node);
+            c->l3 = dense_index(l3_keys, &t->num_l3, l3_key);
+        }
+
+        // spread: first threads of all cores before any sibling. both keep l3 domains together
+        uint32_t order[MAX_CPUS];
+        for (uint32_t i = 0; i < t->num_cpus; ++i)
+        {
+            order[i] = i;
+        }
+        std::sort(order, order + t->num_cpus, [t](uint32_t a, uint32_t b) {
+            const cpu_t* x = &t->cpus[a];
+            const cpu_t* y = &t->cpus[b];
+            return x->smt != y->smt ? x->smt < y->smt : x->l3 != y->l3 ? x->l3 < y->l3 : x->core < y->core;
+        });
+        std::copy(order, order + t->num_cpus, pin_order[0]);
+        std::sort(order, order + t->num_cpus, [t](uint32_t a, uint32_t b) {
+            const cpu_t* x = &t->cpus[a];
+            const cpu_t* y = &t->cpus[b];
+            return x->l3 != y->l3 ? x->l3 < y->l3 : x->core != y->core ? x->core < y->core : x->smt < y->smt;
+        });
+        std::copy(order, order + t->num_cpus, pin_order[1]);
+    }
+
+    const cpu_t* pinned_cpu(uint32_t n, pinning_t pinning)
+    {
+        uint32_t i = pinning == PIN_COMPACT ? pin_order[1][n % g_topology.num_cpus]
+                                            : pin_order[0][n % g_topology.num_cpus];
+        return &g_topology.cpus[i];
+    }
+
+    bool pin_current_thread(uint32_t cpu)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+
+    // async io. io_uring is driven with raw syscalls, the rings are shared with the kernel
+    struct
+    {
+        io_backend_t backend;
+        uint32_t queue_depth;
+        uint32_t in_flight;  // submitted and not yet reaped
+        uint32_t unflushed;  // in the submission ring and not yet entered
+
+        int fd;
+        uint32_t* sq_head;
+        uint32_t* sq_tail;
+        uint32_t* sq_mask;
+        uint32_t* sq_array;
+        uint32_t sq_entries;
+        io_uring_sqe* sqes;
+        uint32_t* cq_head;
+        uint32_t* cq_tail;
+        uint32_t* cq_mask;
+        io_uring_cqe* cqes;
+        void* sq_ring;
+        size_t sq_ring_size;
+        void* cq_ring;
+        size_t cq_ring_size;
+        size_t sqes_size;
+    } io;
+
+    // thread pool fallback
+    typedef struct
+    {
+        int fd;
+        void* buffer;
+        uint32_t size;
+        uint64_t offset;
+        uint64_t user_data;
+    } io_request_t;
+
+    std::mutex io_mutex;
+    std::condition_variable io_cv;
+    bool io_quit;
+    io_request_t* io_requests;      // ring of queue_depth requests
+    uint32_t io_request_head;
+    uint32_t io_request_tail;
+    io_completion_t* io_completions; // ring of queue_depth completions
+    uint32_t io_completion_head;
+    uint32_t io_completion_tail;
+    std::thread io_threads[IO_POOL_THREADS];
+
+    static bool init_io_uring(uint32_t queue_depth)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = (int) syscall(__NR_io_uring_setup, queue_depth, &params);
+        if (fd < 0)
+            return false;
+
+        io.fd = fd;
+        io.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        io.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            io.sq_ring_size = io.cq_ring_size = std::max(io.sq_ring_size, io.cq_ring_size);
+        io.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+        io.sq_ring = mmap(nullptr, io.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        io.cq_ring = params.features & IORING_FEAT_SINGLE_MMAP ? io.sq_ring
+                   : mmap(nullptr, io.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        io.sqes = (io_uring_sqe*) mmap(nullptr, io.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (io.sq_ring == MAP_FAILED || io.cq_ring == MAP_FAILED || io.sqes == MAP_FAILED)
+        {
+            // the rings that did map would leak past the thread pool fallback
+            if (io.sqes != MAP_FAILED)
+                munmap(io.sqes, io.sqes_size);
+            if (io.cq_ring != MAP_FAILED && io.cq_ring != io.sq_ring)
+                munmap(io.cq_ring, io.cq_ring_size);
+            if (io.sq_ring != MAP_FAILED)
+                munmap(io.sq_ring, io.sq_ring_size);
+            close(fd);
+            return false;
+        }
+
+        uint8_t* sq = (uint8_t*) io.sq_ring;
+        io.sq_head = (uint32_t*) (sq + params.sq_off.head);
+        io.sq_tail = (uint32_t*) (sq + params.sq_off.tail);
+        io.sq_mask = (uint32_t*) (sq + params.sq_off.ring_mask);
+        io.sq_array = (uint32_t*) (sq + params.sq_off.array);
+        io.sq_entries = params.sq_entries;
+        uint8_t* cq = (uint8_t*) io.cq_ring;
+        io.cq_head = (uint32_t*) (cq + params.cq_off.head);
+        io.cq_tail = (uint32_t*) (cq + params.cq_off.tail);
+        io.cq_mask = (uint32_t*) (cq + params.cq_off.ring_mask);
+        io.cqes = (io_uring_cqe*) (cq + params.cq_off.cqes);
+
+        // completions must fit the completion ring
+        io.queue_depth = std::min(queue_depth, params.cq_entries);
+
+        return true;
+    }
+
+    static void io_thread()
+    {
+        std::unique_lock<std::mutex> l(io_mutex);
+        while (true)
+        {
+            io_cv.wait(l, []{ return io_quit || io_request_head != io_request_tail; });
+            if (io_quit)
+                return;
+
+            io_request_t r = io_requests[io_request_tail++ % io.queue_depth];
+            l.unlock();
+
+            ssize_t result = pread(r.fd, r.buffer, r.size, r.offset);
+
+            l.lock();
+            io_completions[io_completion_head++ % io.queue_depth] = { r.user_data, result < 0 ? -errno : (int32_t) result };
+        }
+    }
+
+    io_backend_t init_async_io(io_backend_t preferred, uint32_t queue_depth)
+    {
+        io.queue_depth = queue_depth;
+        io.in_flight = 0;
+        io.unflushed = 0;
+        io.backend = preferred == IO_URING && init_io_uring(queue_depth) ? IO_URING : IO_THREAD_POOL;
+
+        if (io.backend == IO_THREAD_POOL)
+        {
+            io_quit = false;
+            io_requests = new io_request_t[queue_depth];
+            io_completions = new io_completion_t[queue_depth];
+            io_request_head = io_request_tail = 0;
+            io_completion_head = io_completion_tail = 0;
+            for (uint32_t i = 0; i < IO_POOL_THREADS; ++i)
+            {
+                io_threads[i] = std::thread(io_thread);
+            }
+        }
+
+        return io.backend;
+    }
+
+    void clear_async_io()
+    {
+        if (io.backend == IO_URING)
+        {
+            munmap(io.sqes, io.sqes_size);
+            if (io.cq_ring != io.sq_ring)
+                munmap(io.cq_ring, io.cq_ring_size);
+            munmap(io.sq_ring, io.sq_ring_size);
+            close(io.fd);
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> l(io_mutex);
+            io_quit = true;
+        }
+        io_cv.notify_all();
+        for (uint32_t i = 0; i < IO_POOL_THREADS; ++i)
+        {
+            io_threads[i].join();
+        }
+        delete[] io_requests;
+        delete[] io_completions;
+    }
+
+    bool submit_read(int fd, void* buffer, uint32_t size, uint64_t offset, uint64_t user_data)
+    {
+        if (io.in_flight == io.queue_depth)
+            return false;
+
+        if (io.backend == IO_URING)
+        {
+            uint32_t tail = *io.sq_tail;
+            if (tail - __atomic_load_n(io.sq_head, __ATOMIC_ACQUIRE) == io.sq_entries)
+                return false;
+
+            uint32_t index = tail & *io.sq_mask;
+            io_uring_sqe* sqe = &io.sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t) buffer;
+            sqe->len = size;
+            sqe->off = offset;
+            sqe->user_data = user_data;
+            io.sq_array[index] = index;
+            __atomic_store_n(io.sq_tail, tail + 1, __ATOMIC_RELEASE);
+            ++io.unflushed;
+        }
+        else
+        {
+            {
+                std::unique_lock<std::mutex> l(io_mutex);
+                io_requests[io_request_head++ % io.queue_depth] = { fd, buffer, size, offset, user_data };
+            }
+            io_cv.notify_one();
+        }
+
+        ++io.in_flight;
+        return true;
+    }
+
+    void flush_reads()
+    {
+        while (io.backend == IO_URING && io.unflushed)
+        {
+            int submitted = (int) syscall(__NR_io_uring_enter, io.fd, io.unflushed, 0, 0, nullptr, 0);
+            if (submitted <= 0)
+                break; // busy, try again on the next flush
+            io.unflushed -= submitted;
+        }
+    }
+
+    uint32_t reap_reads(io_completion_t* completions, uint32_t max_completions)
+    {
+        uint32_t n = 0;
+        if (io.backend == IO_URING)
+        {
+            uint32_t head = *io.cq_head;
+            uint32_t tail = __atomic_load_n(io.cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != tail && n < max_completions; ++head, ++n)
+            {
+                const io_uring_cqe* cqe = &io.cqes[head & *io.cq_mask];
+                completions[n] = { cqe->user_data, cqe->res };
+            }
+            __atomic_store_n(io.cq_head, head, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            std::unique_lock<std::mutex> l(io_mutex);
+            for (; io_completion_tail != io_completion_head && n < max_completions; ++n)
+            {
+                completions[n] = io_completions[io_completion_tail++ % io.queue_depth];
+            }
+        }
+
+        io.in_flight -= n;
+        return n;
+    }
+}
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <thread>
+#include <atomic>
+#include <time.h>
+#include <linux/perf_event.h>
 
 #define ALIGN(x) __attribute__((aligned(x)))
 
@@ -11,6 +14,114 @@
 namespace MPlatform
 {
     const uint32_t NUM_HARDWARE_THREADS = std::thread::hardware_concurrency();
+    const uint32_t MAX_CPUS = 256;
+
+    typedef struct
+    {
+        uint32_t cpu;       // logical cpu, as used for affinity
+        uint32_t core;      // physical core, unique across packages
+        uint32_t smt;       // index among the hardware threads of the core
+        uint32_t package;
+        uint32_t numa_node;
+        uint32_t l3;        // cpus sharing a last level cache, unique across packages
+    } cpu_t;
+
+    typedef struct
+    {
+        uint32_t num_cpus;
+        uint32_t num_cores;
+        uint32_t num_packages;
+        uint32_t num_numa_nodes;
+        uint32_t num_l3;
+        cpu_t cpus[MAX_CPUS]; // online cpus by logical cpu
+    } cpu_topology_t;
+
+    enum pinning_t : uint32_t
+    {
+        PIN_NONE,    // leave placement to the OS
+        PIN_SPREAD,  // one thread per core, l3 domain by l3 domain, then the SMT siblings
+        PIN_COMPACT, // fill the SMT siblings of a core before the next core
+    };
+
+    extern cpu_topology_t g_topology;
+
+    // reads the online cpus from /sys/devices/system/cpu. without sysfs every
+    // hardware thread counts as its own core in a single domain
+    void discover_topology();
+    // cpu for the n-th pinned thread, wrapping around when there are more threads than cpus
+    const cpu_t* pinned_cpu(uint32_t n, pinning_t pinning);
+    bool pin_current_thread(uint32_t cpu);
+
+    const uint32_t IO_POOL_THREADS = 2; // reader threads when io_uring is not available
+
+    enum io_backend_t : uint32_t
+    {
+        IO_URING,
+        IO_THREAD_POOL, // blocking preads on IO_POOL_THREADS threads
+    };
+
+    typedef struct
+    {
+        uint64_t user_data;
+        int32_t result;     // bytes read or -errno
+    } io_completion_t;
+
+    // asynchronous file reads. one thread at a time may submit and one thread
+    // at a time may reap, e.g. from tasks ordered by checkpoints. init falls
+    // back to the thread pool if io_uring can not be set up
+    io_backend_t init_async_io(io_backend_t preferred, uint32_t queue_depth);
+    void clear_async_io();
+    // false if queue_depth reads are in flight
+    bool submit_read(int fd, void* buffer, uint32_t size, uint64_t offset, uint64_t user_data);
+    // starts the reads submitted since the last flush
+    void flush_reads();
+    // completed reads, never blocks
+    uint32_t reap_reads(io_completion_t* completions, uint32_t max_completions);
+
+    // clock ticks are TSC cycles when the CPU has an invariant TSC that agrees
+    // with CLOCK_MONOTONIC, and nanoseconds from CLOCK_MONOTONIC otherwise.
+    // converting ticks to nanoseconds is a multiply and a shift either way
+    typedef struct
+    {
+        bool tsc;              // clock_ticks reads the TSC
+        uint64_t start_ticks;  // ticks_to_ns(start_ticks) == 0
+        uint64_t ns_per_tick;  // 32.32 fixed point
+        double ticks_per_ns;
+    } tsc_clock_t;
+
+    extern tsc_clock_t g_clock;
+
+    // once at startup, before other threads read the clock. takes about 20 ms
+    void calibrate_clock();
+
+    enum perf_counter_t : uint32_t
+    {
+        PC_INSTRUCTIONS,
+        PC_CYCLES,        // core cycles, unlike the TSC they follow the core clock
+        PC_LLC_MISSES,
+        PC_BRANCH_MISSES,
+        NUM_PERF_COUNTERS,
+    };
+
+    // hardware counters of the calling thread, read in user space with rdpmc.
+    // opened as one group led by PC_INSTRUCTIONS, so they are on the PMU together
+    // and cover the same time. counters the kernel or the CPU does not provide,
+    // or that can not be read with rdpmc, are left out and read as 0
+    typedef struct
+    {
+        int fds[NUM_PERF_COUNTERS];
+        const volatile perf_event_mmap_page* pages[NUM_PERF_COUNTERS];
+        uint32_t available; // bit per perf_counter_t
+    } perf_counters_t;
+
+    uint32_t open_perf_counters(perf_counters_t*); // returns the available counters
+    void close_perf_counters(perf_counters_t*);
+
+    // sleeps while *address == expected. spurious returns are possible.
+    // false when it returned without sleeping
+    bool futex_wait(std::atomic<uint32_t>* address, uint32_t expected);
+    // wakes up to count threads sleeping on address
+    void futex_wake(std::atomic<uint32_t>* address, uint32_t count);
 
     inline uint32_t asm_bsf32(uint32_t m)
     {
@@ -64,4 +175,78 @@ namespace MPlatform
             : "%rcx", "%rdx");
         return tsc;
     }
+
+    inline uint64_t asm_rdpmc(uint32_t counter)
+    {
+        uint32_t lo, hi;
+        __asm__ __volatile__(
+            "rdpmc"
+            : "=a"(lo), "=d"(hi)
+            : "c"(counter));
+        return (uint64_t) hi << 32 | lo;
+    }
+
+    const uint64_t PERF_NOT_COUNTING = ~(uint64_t) 0;
+
+    // the kernel updates the page when it moves the counter, retry until a read sees no update.
+    // not_counted: time the counter was enabled but off the PMU, e.g. multiplexed with other
+    // events, or PERF_NOT_COUNTING while it is off
+    inline uint64_t read_perf_counter(const volatile perf_event_mmap_page* page, uint64_t* not_counted = nullptr)
+    {
+        uint32_t sequence;
+        uint64_t count;
+        do
+        {
+            sequence = page->lock;
+            std::atomic_signal_fence(std::memory_order_acquire);
+            count = page->offset;
+            uint32_t index = page->index; // 0 while the counter is not on the cpu
+            if (index)
+            {
+                uint32_t shift = 64 - page->pmc_width;
+                count += (int64_t) (asm_rdpmc(index - 1) << shift) >> shift;
+            }
+            if (not_counted)
+                *not_counted = index ? page->time_enabled - page->time_running : PERF_NOT_COUNTING;
+            std::atomic_signal_fence(std::memory_order_acquire);
+        } while (page->lock != sequence);
+
+        return count;
+    }
+
+    // returns the group's not counted time. the deltas between two reads cover the
+    // whole interval only if both returned the same time other than PERF_NOT_COUNTING
+    inline uint64_t read_perf_counters(const perf_counters_t* counters, uint64_t* values)
+    {
+        uint64_t not_counted = PERF_NOT_COUNTING;
+        for (uint32_t i = 0; i < NUM_PERF_COUNTERS; ++i)
+        {
+            values[i] = counters->available & (1 << i) ? read_perf_counter(counters->pages[i], i == PC_INSTRUCTIONS ? &not_counted : nullptr) : 0;
+        }
+
+        return not_counted;
+    }
+
+    inline int64_t monotonic_ns()
+    {
+        timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (int64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+    }
+
+    inline uint64_t clock_ticks()
+    {
+        return g_clock.tsc ? asm_rdtscp() : (uint64_t) monotonic_ns();
+    }
+
+    inline int64_t ticks_to_ns(uint64_t ticks)
+    {
+        return (int64_t) (((unsigned __int128) (ticks - g_clock.start_ticks) * g_clock.ns_per_tick) >> 32);
+    }
+
+    // since calibration
+    inline int64_t clock_ns()
+    {
+        return ticks_to_ns(clock_ticks());
+    }
 }
@@ -1,18 +1,22 @@
 #include "gemini.h"
 #include "managers/TaskScheduling.h"
 #include "managers/Platform.h"
+#include "managers/Memory.h"
+#include "managers/Metrics.h"
 
 #include <atomic>
+#include <algorithm>
 #include <cassert>
 #include <unistd.h>    // usleep
 #include <emmintrin.h> // SSE2
 #include <tmmintrin.h> // SSSE3: _mm_shuffle_epi8
-#include <smmintrin.h> // SSE4.1: _mm_blendv_epi8
-#if PROFILING
-#include <fstream>
-#include <iomanip>
+#include <smmintrin.h> // SSE4.1: _mm_min_epi32
+#include <immintrin.h> // AVX2, AVX-512F
+#include <cstring>
+#include <unordered_map>
 #include <chrono>
-#endif
+#include <thread>
+#include <cstdio>
 
 #include <iostream>
 
@@ -20,329 +24,2208 @@ using namespace MPlatform;
 
 namespace MTaskScheduling
 {
+#if defined(__AVX512F__)
+    const uint32_t SIMD_WIDTH = 16;
+#elif defined(__AVX2__)
+    const uint32_t SIMD_WIDTH = 8;
+#else
+    const uint32_t SIMD_WIDTH = 4;
+#endif
+
+    uint32_t NUM_ACTIVE_STACKS = 7;
     uint32_t NUM_WORKER_THREADS;
+    uint32_t MAX_EXECUTED_TASKS = 10000000;
+    scheduling_policy_t SCHEDULING_POLICY = SP_STACK_TOP;
+    uint32_t FRAMES_IN_FLIGHT = 2;
+    uint32_t OUT_OF_ORDER_WINDOW = 8;
+    bool CRITICAL_PATH_PRIORITY = true;
+    MPlatform::pinning_t WORKER_PINNING = MPlatform::PIN_NONE;
+    bool PERF_COUNTERS = false;
+
+    // a task group as a node of the frame graph, told apart by its dependencies,
+    // its stack and the checkpoint its last task reaches. groups recorded with
+    // the same dependencies, e.g. no_dependencies, stay separate nodes
+    typedef struct
+    {
+        std::atomic<uint64_t> stack_checkpoint; // stack << 32 | checkpoint, 0 while the slot is free
+        std::atomic<const task_dependencies_t*> dependencies; // stored right after the slot is claimed
+        uint32_t range; // learned from range tasks, whose chunks all know the checkpoint
+    } path_node_t;
+
+    const uint32_t TF_LANES = TF_MAIN_THREAD | TF_BLOCKING;
 
     ALIGN(64) task_stack_t*         s_stacks;
     ALIGN(64) std::atomic<uint32_t> s_iterations[NUM_STACKS];
-    std::atomic<uint64_t>           s_pri_mask_main_stack;
-    std::atomic<uint64_t>           s_checkpoints[2];
+    std::atomic<uint64_t>           s_main_stack_iteration;
+    ALIGN(64) std::atomic<uint64_t> s_pri_mask[NUM_PRI_MASK_WORDS];
+    ALIGN(64) std::atomic<uint64_t> s_checkpoints[MAX_FRAMES_IN_FLIGHT][NUM_CHECKPOINT_WORDS];
+    std::atomic<uint32_t>           s_num_checkpoints;
+    ALIGN(64) task_deque_t          s_deques[MAX_NUM_WORKER_THREADS];
+    ALIGN(64) worker_state_t        s_worker_states[MAX_NUM_THREADS];
+    ALIGN(64) task_lane_t           s_lanes[NUM_LANES];
     std::atomic<uint32_t>           g_quit_request;
     std::atomic<uint32_t>           g_total_executed;
+    ALIGN(64) std::atomic<uint32_t> s_wake_epoch;
+    std::atomic<uint64_t>           s_wake_ticks; // of the last wake_parked_workers
+    ALIGN(64) std::atomic<uint32_t> s_num_parked;
+    std::atomic<uint64_t>           g_total_parks;
+    std::atomic<uint64_t>           g_total_wakes;
+    std::atomic<uint64_t>           g_total_wake_latency_ticks;
+    std::atomic<uint64_t>           g_total_woken_picks;
+    std::atomic<uint64_t>           g_total_out_of_order;
+    std::atomic<uint64_t>           g_total_suspended;
+    std::atomic<uint64_t>           g_trace_events;
+    std::atomic<uint64_t>           g_trace_dropped;
+    std::atomic<uint64_t>           g_trace_bytes;
+    ALIGN(64) std::atomic<uint32_t> s_num_suspended;
+    ALIGN(64) std::atomic<uint64_t> s_suspended_waiting[MAX_SUSPENDED_TASKS / 64]; // set while nobody checks the slot's wait
+    ALIGN(64) std::atomic<uint64_t> s_suspended_free[MAX_SUSPENDED_TASKS / 64];
+    suspended_task_t                s_suspended[MAX_SUSPENDED_TASKS];
+    ALIGN(64) std::atomic<uint64_t> s_critical_mask[NUM_PRI_MASK_WORDS];
+    ALIGN(64) path_node_t           s_path_nodes[PATH_TABLE_SIZE];
+    ALIGN(64) std::atomic<uint64_t> s_path_cycles[MAX_NUM_THREADS][PATH_TABLE_SIZE]; // only written by the owning thread
+    ALIGN(64) std::atomic<uint64_t> s_path_tasks[MAX_NUM_THREADS][PATH_TABLE_SIZE];
+    ALIGN(64) std::atomic<uint32_t> s_critical_path_lock;
+    std::atomic<uint64_t>           g_critical_path_cycles;
+    uint32_t                        s_num_domains;
+    uint32_t                        s_worker_cpus[MAX_NUM_THREADS];
+    uint32_t                        s_worker_domains[MAX_NUM_THREADS];
+    ALIGN(64) std::atomic<uint32_t> s_stack_domains[NUM_STACKS];
+    ALIGN(64) std::atomic<uint64_t> s_domain_stacks[MAX_DOMAINS][NUM_PRI_MASK_WORDS]; // stacks homed in each domain
+    // only touched by update_critical_path while holding the lock
+    uint64_t                        s_path_seen_cycles[PATH_TABLE_SIZE];
+    uint64_t                        s_path_seen_tasks[PATH_TABLE_SIZE];
+    uint64_t                        s_path_span[PATH_TABLE_SIZE];
+    ALIGN(64) const task_dependencies_t no_dependencies = {};
 
-#if PROFILING
-    // temp storage
-    struct {
-        double sched_start;
-        double sched_end;
-        double exec_end;
-        uint64_t rdtscp_ss;
-        uint64_t rdtscp_se;
-        uint64_t rdtscp_ee;
+    // temp storage, a cache line or more per thread
+    struct ALIGN(64) {
+        uint32_t level;       // profiling_level_t, read once per task
+        uint64_t sched_start; // clock ticks
+        uint64_t sched_end;
+        uint64_t exec_end;
         uint32_t stack;
-        uint64_t checkpoints_previous_frame;
-        uint64_t checkpoints_current_frame;
-        uint64_t reached_checkpoints;
+        const task_dependencies_t* dependencies;
+        uint64_t reached_checkpoint;
+        MPlatform::perf_counters_t perf;
+        uint64_t perf_start[NUM_PERF_COUNTERS];
+        uint64_t perf_not_counted;               // at perf_start
+        uint64_t perf_counts[NUM_PERF_COUNTERS]; // during the task, 0 unless the counters ran throughout
+        uint32_t perf_valid;
+        uint64_t contention_start[NUM_CONTENTION_COUNTERS];
+        uint32_t contention[NUM_CONTENTION_COUNTERS]; // while picking the task
     } prof[PROFILING_THREADS];
 
     // profiling log
-    uint32_t profiling_i[4][PROFILING_THREADS];
-    profiling_item_t profiling_log[4][PROFILING_THREADS][PROFILING_SIZE];
-#endif
+    uint32_t profiling_i[PROFILING_ITERATIONS][PROFILING_THREADS];
+    profiling_item_t profiling_log[PROFILING_ITERATIONS][PROFILING_THREADS][PROFILING_SIZE];
+
+    // continuous trace
+    trace_ring_t*     s_trace_rings;        // one per thread id, allocated by the first start_tracing
+    uint8_t*          s_trace_buffer;       // a ring encoded, allocated along with them
+    std::atomic<bool> s_tracing;
+    std::atomic<bool> s_trace_quit;
+    std::thread       s_trace_thread;
+    FILE*             s_trace_file;
+    uint64_t          s_trace_dropped_base; // dropped before this trace started
+    bool              s_trace_stack_named[NUM_STACKS]; // written to the current trace
+    bool              s_trace_checkpoint_named[MAX_CHECKPOINTS];
+    std::unordered_map<const task_dependencies_t*, uint32_t> s_trace_dependency_ids; // written to the current trace
+
+    // live metrics
+    ALIGN(64) std::atomic<uint64_t> s_frame_start; // clock ticks, the current frame began
+    std::atomic<uint64_t>           s_frame_times[MMetrics::FRAME_TIME_BUCKETS];
+    MMetrics::metrics_block_t*      s_metrics_block;
+    char                            s_metrics_name[64];
+    std::atomic<bool>               s_metrics_quit;
+    std::thread                     s_metrics_thread;
+    uint32_t                        s_metrics_executed; // g_total_executed at the previous publish
+    int64_t                         s_metrics_ns;
+    static_assert(NUM_STACKS <= MMetrics::MAX_STACKS, "stacks have to fit the metrics block");
+
+    // names of stacks and checkpoints, for traces
+    static_assert(NUM_STACKS <= MTrace::MAX_STACK_IDS && MAX_CHECKPOINTS <= MTrace::MAX_CHECKPOINT_IDS &&
+                  MAX_FRAMES_IN_FLIGHT <= MTrace::MAX_FRAMES_BACK && NUM_CONTENTION_COUNTERS == MTrace::NUM_CONTENTION,
+                  "ids have to fit the trace format");
+    std::atomic<const char*> s_stack_names[NUM_STACKS];
+    std::atomic<const char*> s_checkpoint_names[MAX_CHECKPOINTS];
+    const char* const s_named_checkpoints[NUM_NAMED_CHECKPOINTS] = {
+        nullptr,
+        "input1",
+        "physics1", "physics2", "physics3", "physics4",
+        "animation1", "animation2", "animation3",
+        "ai1", "ai2",
+        "streaming1", "streaming2", "streaming3", "streaming4",
+        "sound1",
+        "rendering1", "rendering2", "rendering3",
+        "rendering write perf overlay",
+        "rendering present",
+    };
+
+    // per stack sums, [thread][iteration % PROFILING_ITERATIONS][stack]
+    stack_slot_t*          s_stack_slots;
+    std::atomic<uint32_t>  s_perf_available;
+    ALIGN(64) std::atomic<uint32_t> s_profiling_level; // only written by set_profiling_level
 
     void init_scheduler()
     {
+        assert(FRAMES_IN_FLIGHT >= 2 && FRAMES_IN_FLIGHT <= MAX_FRAMES_IN_FLIGHT);
+        assert(NUM_WORKER_THREADS <= MAX_NUM_WORKER_THREADS); // lanes use the thread ids after the workers
+
+        MPlatform::calibrate_clock();
+
         s_stacks = new task_stack_t[NUM_STACKS];
 
         for (uint32_t i = 0; i < NUM_STACKS; ++i)
         {
             s_stacks[i].index = i;
-            s_stacks[i].tasks[0]  = { dont_do_it, (void*)(uint64_t) i, ECP_NONE, ECP_NONE };
+            s_stacks[i].tasks[0]  = { dont_do_it, (void*)(uint64_t) i, &no_dependencies };
+            s_stacks[i].capacity = STACK_SIZE;
+            s_stacks[i].reordered = 0;
+            s_stacks[i].segments[0] = s_stacks[i].tasks;
+            for (uint32_t k = 1; k < NUM_STACK_SEGMENTS; ++k)
+            {
+                s_stacks[i].segments[k] = nullptr;
+            }
+        }
+
+        for (uint32_t i = 0; i < NUM_STACKS; ++i)
+        {
+            uint32_t iteration = i < NUM_ACTIVE_STACKS ? 0 : 0x7FFFFFFF; // max int32 because SSE
+            s_iterations[i].store(iteration, std::memory_order_relaxed);
+            s_stacks[i].iterations_size.store((uint64_t) iteration << 32, std::memory_order_relaxed);
+        }
+
+        s_main_stack_iteration.store(0, std::memory_order_relaxed); // main_stack 0 in iteration 0
+        publish_pri_mask(0); // all stacks allowed
+        for (uint32_t f = 0; f < MAX_FRAMES_IN_FLIGHT; ++f)
+        {
+            for (uint32_t i = 0; i < NUM_CHECKPOINT_WORDS; ++i)
+            {
+                // none passed in frames [0, FRAMES_IN_FLIGHT), all passed in the frames before
+                s_checkpoints[f][i].store(0, std::memory_order_relaxed);
+            }
+        }
+        s_num_checkpoints.store(NUM_NAMED_CHECKPOINTS, std::memory_order_relaxed);
+        g_quit_request.store(0, std::memory_order_relaxed);
+        g_total_executed.store(0, std::memory_order_relaxed);
+        s_wake_epoch.store(0, std::memory_order_relaxed);
+        s_num_parked.store(0, std::memory_order_relaxed);
+        g_total_parks.store(0, std::memory_order_relaxed);
+        g_total_wakes.store(0, std::memory_order_relaxed);
+        g_total_wake_latency_ticks.store(0, std::memory_order_relaxed);
+        g_total_woken_picks.store(0, std::memory_order_relaxed);
+        g_total_out_of_order.store(0, std::memory_order_relaxed);
+        g_total_suspended.store(0, std::memory_order_relaxed);
+        g_trace_events.store(0, std::memory_order_relaxed);
+        g_trace_dropped.store(0, std::memory_order_relaxed);
+        g_trace_bytes.store(0, std::memory_order_relaxed);
+        for (uint32_t i = 0; i < NUM_STACKS; ++i)
+        {
+            s_stack_names[i].store(nullptr, std::memory_order_relaxed);
+        }
+        for (uint32_t i = 0; i < MAX_CHECKPOINTS; ++i)
+        {
+            s_checkpoint_names[i].store(i < NUM_NAMED_CHECKPOINTS ? s_named_checkpoints[i] : nullptr, std::memory_order_relaxed);
+        }
+        s_num_suspended.store(0, std::memory_order_relaxed);
+        for (uint32_t i = 0; i < MAX_SUSPENDED_TASKS / 64; ++i)
+        {
+            s_suspended_waiting[i].store(0, std::memory_order_relaxed);
+            s_suspended_free[i].store(~(uint64_t) 0, std::memory_order_relaxed);
+        }
+
+        for (uint32_t i = 0; i < NUM_PRI_MASK_WORDS; ++i)
+        {
+            s_critical_mask[i].store(0, std::memory_order_relaxed);
+        }
+        for (uint32_t i = 0; i < PATH_TABLE_SIZE; ++i)
+        {
+            s_path_nodes[i].stack_checkpoint.store(0, std::memory_order_relaxed);
+            s_path_nodes[i].dependencies.store(nullptr, std::memory_order_relaxed);
+            s_path_nodes[i].range = 0;
+            for (uint32_t thread = 0; thread < MAX_NUM_THREADS; ++thread)
+            {
+                s_path_cycles[thread][i].store(0, std::memory_order_relaxed);
+                s_path_tasks[thread][i].store(0, std::memory_order_relaxed);
+            }
+            s_path_seen_cycles[i] = 0;
+            s_path_seen_tasks[i] = 0;
+            s_path_span[i] = 0;
+        }
+        s_critical_path_lock.store(0, std::memory_order_relaxed);
+        g_critical_path_cycles.store(0, std::memory_order_relaxed);
+
+        s_num_domains = 1;
+        for (uint32_t i = 0; i < MAX_NUM_THREADS; ++i)
+        {
+            s_worker_cpus[i] = 0;
+            s_worker_domains[i] = 0;
+        }
+        if (WORKER_PINNING != MPlatform::PIN_NONE)
+        {
+            MPlatform::discover_topology();
+            for (uint32_t i = 0; i < NUM_WORKER_THREADS; ++i)
+            {
+                const MPlatform::cpu_t* cpu = MPlatform::pinned_cpu(i, WORKER_PINNING);
+                s_worker_cpus[i] = cpu->cpu;
+                s_worker_domains[i] = cpu->l3 % MAX_DOMAINS;
+                s_num_domains = std::max(s_num_domains, s_worker_domains[i] + 1);
+            }
+        }
+        // stacks start out spread over the domains and move to where they are submitted
+        for (uint32_t d = 0; d < MAX_DOMAINS; ++d)
+        {
+            for (uint32_t i = 0; i < NUM_PRI_MASK_WORDS; ++i)
+            {
+                s_domain_stacks[d][i].store(0, std::memory_order_relaxed);
+            }
+        }
+        for (uint32_t i = 0; i < NUM_STACKS; ++i)
+        {
+            s_stack_domains[i].store(i % s_num_domains, std::memory_order_relaxed);
+            s_domain_stacks[i % s_num_domains][i / 64].fetch_or((uint64_t) 1 << (i % 64), std::memory_order_relaxed);
+        }
+
+        for (uint32_t i = 0; i < MAX_NUM_WORKER_THREADS; ++i)
+        {
+            s_deques[i].top.store(0, std::memory_order_relaxed);
+            s_deques[i].bottom.store(0, std::memory_order_relaxed);
+        }
+
+        for (uint32_t i = 0; i < MAX_NUM_THREADS; ++i)
+        {
+            s_worker_states[i].batch_size = 1;
+            s_worker_states[i].avg_task_cycles = BATCH_TARGET_CYCLES;
+            s_worker_states[i].idle_passes = 0;
+            s_worker_states[i].woken_ticks = 0;
+            for (uint32_t k = 0; k < NUM_CONTENTION_COUNTERS; ++k)
+            {
+                s_worker_states[i].contention[k].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        for (uint32_t i = 0; i < NUM_LANES; ++i)
+        {
+            s_lanes[i].head.store(0, std::memory_order_relaxed);
+            s_lanes[i].tail.store(0, std::memory_order_relaxed);
+            s_lanes[i].sleeping.store(0, std::memory_order_relaxed);
+            s_lanes[i].wake_epoch.store(0, std::memory_order_relaxed);
+            for (uint32_t k = 0; k < LANE_SIZE; ++k)
+            {
+                s_lanes[i].entries[k].sequence.store(k, std::memory_order_relaxed);
+            }
         }
 
-        for (uint32_t i = NUM_ACTIVE_STACKS; i < NUM_STACKS; ++i)
+        for (uint32_t i = 0; i < PROFILING_ITERATIONS; ++i)
+        {
+            for (uint32_t thread = 0; thread < PROFILING_THREADS; ++thread)
+            {
+                profiling_i[i][thread] = 0;
+            }
+        }
+        s_trace_rings = nullptr;
+        s_trace_buffer = nullptr;
+        s_tracing.store(false, std::memory_order_relaxed);
+        s_trace_file = nullptr;
+        s_metrics_block = nullptr;
+        s_frame_start.store(clock_ticks(), std::memory_order_relaxed);
+        for (uint32_t i = 0; i < MMetrics::FRAME_TIME_BUCKETS; ++i)
         {
-            s_iterations[i].store(0x7FFFFFFF, std::memory_order_relaxed); // max int32 because SSE
+            s_frame_times[i].store(0, std::memory_order_relaxed);
         }
 
-        s_pri_mask_main_stack.store((1<<NUM_ACTIVE_STACKS)-1, std::memory_order_relaxed); // all stacks allowed, main_stack 0
-        s_checkpoints[0].store(0xFFFFFFFFFFFFFFFF, std::memory_order_relaxed); // none passed in frame 0
-        s_checkpoints[1].store(0xFFFFFFFFFFFFFFFF, std::memory_order_relaxed); // all passed in frame -1
+        // the level may be raised at any time, so the slots always exist
+        uint32_t num_slots = MAX_NUM_THREADS * PROFILING_ITERATIONS * NUM_ACTIVE_STACKS;
+        s_stack_slots = new stack_slot_t[num_slots];
+        for (uint32_t i = 0; i < num_slots; ++i)
+        {
+            s_stack_slots[i].iteration.store(0xFFFFFFFF, std::memory_order_relaxed);
+        }
+        // threads clear the counters they can not open
+        s_perf_available.store(PERF_COUNTERS ? (1 << NUM_PERF_COUNTERS) - 1 : 0, std::memory_order_relaxed);
     }
 
     void clear_scheduler()
     {
+        stop_tracing();
+        stop_metrics();
+        _mm_free(s_trace_rings);
+        delete[] s_trace_buffer;
+        delete[] s_stack_slots;
+
+        for (uint32_t i = 0; i < NUM_STACKS; ++i)
+        {
+            for (uint32_t k = 1; k < NUM_STACK_SEGMENTS; ++k)
+            {
+                delete[] s_stacks[i].segments[k];
+            }
+        }
+
         delete[] s_stacks;
     }
 
-    void worker_thread(uint32_t thread_id)
+    void grow_task_stack(task_stack_t* stack)
     {
-        timestamp();
-        prof_sched_start(thread_id);
+        // the new segment is as large as all previous segments together
+        uint32_t k = asm_bsr32(stack->capacity) - STACK_SIZE_LOG2 + 1;
+        assert(k < NUM_STACK_SEGMENTS);
 
-        uint32_t stack = 0;
-        uint32_t stack_size = 0;
-        uint64_t iterations_size = 0;
-        uint32_t iteration = 0;
+        stack->segments[k] = new task_t[stack->capacity];
 
-        while (!g_quit_request.load(std::memory_order_relaxed))
-        {
-            uint64_t pri_mask_main_stack = s_pri_mask_main_stack.load(std::memory_order_acquire);
-            uint32_t main_stack = (uint32_t) (pri_mask_main_stack>>32);
-            uint32_t pri_mask = (uint32_t) pri_mask_main_stack;
+        stack->capacity *= 2;
+    }
+
+    void save_task_recording(task_stack_t* stack, task_recording_t* recording)
+    {
+        recording->size = stack->unpublished_size;
+        recording->tasks = new task_t[recording->size];
+        recording->num_ranges = 0;
+        recording->ranges = new range_task_t*[recording->size];
+        recording->range_tasks = new uint32_t[recording->size];
+        recording->patched = false;
 
-            task_t task;
+        for (uint32_t i = 1; i < recording->size; ++i)
+        {
+            const task_t* task = stack_task(stack, i);
+            recording->tasks[i] = *task;
+            if (task->execute != execute_range)
+                continue;
 
-            uint64_t c;
-            // previous stack has highest priority. main stack is allways allowed to run
-            uint32_t previous_stack_allowed = (uint32_t) (iteration == s_iterations[stack].load(std::memory_order_relaxed));
-            uint32_t previous_stack_bit = previous_stack_allowed << (stack - main_stack) % 32;
-            uint32_t main_stack_bit = 1;
-            uint32_t main_stack_offset = asm_bsr32( (previous_stack_bit | main_stack_bit) & pri_mask );
-            uint32_t next_pri = (main_stack_offset + main_stack) % 32;
-            pri_mask &= ~(1 << main_stack_offset);
-            do
+            // the tasks of a range are recorded together
+            range_task_t* range = (range_task_t*) task->args;
+            uint32_t r = recording->num_ranges;
+            if (r == 0 || recording->ranges[r - 1] != range)
             {
-                stack = next_pri;
+                recording->ranges[r] = range;
+                recording->range_tasks[r] = 0;
+                ++recording->num_ranges;
+            }
+            ++recording->range_tasks[recording->num_ranges - 1];
+        }
 
-                iterations_size = s_stacks[stack].iterations_size.load(std::memory_order_acquire);
-                iteration = (uint32_t) (iterations_size >> 32);
-                stack_size = (uint32_t) iterations_size;
-                task = s_stacks[stack].tasks[stack_size];
+        // the stack holds the recording as saved
+        stack->reordered = 0;
+    }
 
-                // check if all required checkpoints are reached
-                uint64_t current_frame = iteration;
-                uint64_t previous_frame = current_frame - 1;
-                uint64_t ecp_current_frame = s_checkpoints[current_frame & 1].load(std::memory_order_acquire);
-                uint64_t ecp_previous_frame = s_checkpoints[previous_frame & 1].load(std::memory_order_acquire);
-                c  = task.checkpoints_current_frame - ((ecp_current_frame ^ (((current_frame >> 1) & 1) - 1)) & task.checkpoints_current_frame);
-                c |= task.checkpoints_previous_frame - ((ecp_previous_frame ^ (((previous_frame >> 1) & 1) - 1)) & task.checkpoints_previous_frame);
-                c |= (uint64_t) stack_size == 0; // this should be handled with dont_do_it tasks
+    void clear_task_recording(task_recording_t* recording)
+    {
+        delete[] recording->tasks;
+        delete[] recording->ranges;
+        delete[] recording->range_tasks;
+        recording->tasks = nullptr;
+        recording->ranges = nullptr;
+        recording->range_tasks = nullptr;
+        recording->size = 0;
+        recording->num_ranges = 0;
+    }
 
-                if (c)
-                {
-                    if (!pri_mask)
-                    {
-                        // all top tasks are blocked by dependencies
-                        // reload priority mask and try again (a blocking task might have finished)
-                        pri_mask_main_stack = s_pri_mask_main_stack.load(std::memory_order_acquire);
-                        main_stack = (uint32_t) (pri_mask_main_stack>>32);
-                        pri_mask = (uint32_t) pri_mask_main_stack;
-                    }
-                    // task is blocked. try another stack
-                    main_stack_offset = asm_bsf32(pri_mask);
-                    next_pri = (main_stack_offset + main_stack) % 32;
-                    pri_mask &= ~(1 << main_stack_offset);
-                }
+    inline uint32_t num_pri_mask_words()
+    {
+        return (NUM_ACTIVE_STACKS + 63) / 64;
+    }
+
+    // first stack in mask at or after stack from, wrapping around. NUM_STACKS if the mask is empty
+    inline uint32_t next_stack(const uint64_t* mask, uint32_t num_words, uint32_t from)
+    {
+        uint32_t word = from / 64;
+        uint64_t m = mask[word] & (0xFFFFFFFFFFFFFFFF << (from % 64));
+        for (uint32_t i = 0; i < num_words; ++i)
+        {
+            if (m)
+                return word * 64 + (uint32_t) asm_bsf64(m);
 
-            } while ( c || !s_stacks[stack].iterations_size.compare_exchange_weak(iterations_size, iterations_size - 1, std::memory_order_acq_rel) );
+            word = word + 1 == num_words ? 0 : word + 1;
+            m = mask[word];
+        }
 
-            if (stack_size == 1)
-            {
-                // we picked the last task. update priority mask
-                s_iterations[stack].fetch_add(1, std::memory_order_relaxed);
+        // back at the first word, including the stacks before from
+        return m ? word * 64 + (uint32_t) asm_bsf64(m) : NUM_STACKS;
+    }
 
-                uint64_t old_pri_mask_main_stack = s_pri_mask_main_stack.load(std::memory_order_relaxed);
-                uint64_t new_pri_mask_main_stack = 0;
-                do
-                {
-                    main_stack = (uint32_t) (old_pri_mask_main_stack >> 32);
+    // critical receives the stacks in the priority mask that are on the critical path,
+    // local the ones homed in the worker's domain
+    inline uint64_t load_pri_mask(uint64_t* pri_mask, uint64_t* critical, uint64_t* local, uint32_t domain, uint32_t num_words)
+    {
+        uint64_t main_stack_iteration = s_main_stack_iteration.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < num_words; ++i)
+        {
+            pri_mask[i] = s_pri_mask[i].load(std::memory_order_relaxed);
+            critical[i] = s_critical_mask[i].load(std::memory_order_relaxed) & pri_mask[i];
+            local[i] = s_num_domains > 1 ? s_domain_stacks[domain][i].load(std::memory_order_relaxed) & pri_mask[i] : 0;
+        }
 
-                    __m128i ms = _mm_set1_epi32(main_stack);
+        return main_stack_iteration;
+    }
 
-                    __m128i i0 = _mm_load_si128((__m128i*) &s_iterations[0]);
-                    __m128i i1 = _mm_load_si128((__m128i*) &s_iterations[4]);
-                    __m128i i2 = _mm_load_si128((__m128i*) &s_iterations[8]);
-                    __m128i i3 = _mm_load_si128((__m128i*) &s_iterations[12]);
+    // first critical stack, else first local stack, else the main stack
+    inline uint32_t first_pri_stack(const uint64_t* critical, const uint64_t* local, uint32_t num_words, uint32_t main_stack)
+    {
+        uint32_t stack = next_stack(critical, num_words, main_stack);
+        stack = stack != NUM_STACKS ? stack : next_stack(local, num_words, main_stack);
+        return stack != NUM_STACKS ? stack : main_stack;
+    }
 
-                    ALIGN(64) static const uint32_t range_16[16] =
-                        {
-                            0,  1,  2,  3,
-                            4,  5,  6,  7,
-                            8,  9, 10, 11,
-                            12, 13, 14, 15
-                        };
+    // critical stacks first, then local stacks, then the others, each in round robin order from the main stack
+    inline uint32_t next_pri_stack(const uint64_t* pri_mask, const uint64_t* critical, const uint64_t* local, uint32_t num_words, uint32_t main_stack)
+    {
+        uint32_t stack = next_stack(critical, num_words, main_stack);
+        stack = stack != NUM_STACKS ? stack : next_stack(local, num_words, main_stack);
+        return stack != NUM_STACKS ? stack : next_stack(pri_mask, num_words, main_stack);
+    }
 
-                            i0 = _mm_add_epi32(i0, _mm_cmpgt_epi32(ms, _mm_load_si128((__m128i*) &range_16[0])));
-                            i1 = _mm_add_epi32(i1, _mm_cmpgt_epi32(ms, _mm_load_si128((__m128i*) &range_16[4])));
-                            i2 = _mm_add_epi32(i2, _mm_cmpgt_epi32(ms, _mm_load_si128((__m128i*) &range_16[8])));
-                            i3 = _mm_add_epi32(i3, _mm_cmpgt_epi32(ms, _mm_load_si128((__m128i*) &range_16[12])));
+    inline void remove_stack(uint64_t* pri_mask, uint64_t* critical, uint64_t* local, uint32_t stack)
+    {
+        pri_mask[stack / 64] &= ~((uint64_t) 1 << (stack % 64));
+        critical[stack / 64] &= ~((uint64_t) 1 << (stack % 64));
+        local[stack / 64] &= ~((uint64_t) 1 << (stack % 64));
+    }
 
-                    __m128i l0 = _mm_min_epi32(i0, i1);
-                            l0 = _mm_min_epi32(l0, i2);
-                            l0 = _mm_min_epi32(l0, i3);
-                    __m128i l1 = _mm_shuffle_epi32(l0, 0x1B);
-                            l0 = _mm_min_epi32(l0, l1);
-                            l1 = _mm_shuffle_epi32(l0, 0x01);
-                            l0 = _mm_min_epi32(l0, l1);
-                            l0 = _mm_shuffle_epi32(l0, 0x00);
+    // the worker that finishes a round runs the submit task, which records the
+    // stack's next tasks and their arguments in its caches and NUMA node
+    inline void rehome_stack(uint32_t stack, uint32_t domain)
+    {
+        uint32_t old_domain = s_stack_domains[stack].load(std::memory_order_relaxed);
+        if (old_domain == domain)
+            return;
 
-                    __m128i c0 = _mm_cmpeq_epi32(i0, l0);
-                    __m128i c1 = _mm_cmpeq_epi32(i1, l0);
-                    __m128i c2 = _mm_cmpeq_epi32(i2, l0);
-                    __m128i c3 = _mm_cmpeq_epi32(i3, l0);
+        s_domain_stacks[old_domain][stack / 64].fetch_and(~((uint64_t) 1 << (stack % 64)), std::memory_order_relaxed);
+        s_domain_stacks[domain][stack / 64].fetch_or((uint64_t) 1 << (stack % 64), std::memory_order_relaxed);
+        s_stack_domains[stack].store(domain, std::memory_order_relaxed);
+    }
 
-                    ALIGN(64) static const uint32_t iteration_mask[16] =
-                        {
-                            0x00800000, 0x00800000, 0x00800000, 0x00800000,
-                            0x00008000, 0x00008000, 0x00008000, 0x00008000,
-                            0x00000080, 0x00000080, 0x00000080, 0x00000080,
-                            0x0F0B0703, 0x0E0A0602, 0x0D090501, 0x0C080400
-                        };
+    inline void pin_worker(uint32_t thread_id)
+    {
+        if (WORKER_PINNING != MPlatform::PIN_NONE)
+        {
+            MPlatform::pin_current_thread(s_worker_cpus[thread_id]);
+        }
+    }
 
-                    __m128i  c = _mm_blendv_epi8(c0, c1, _mm_load_si128((__m128i*) &iteration_mask[0]));
-                             c = _mm_blendv_epi8(c , c2, _mm_load_si128((__m128i*) &iteration_mask[4]));
-                             c = _mm_blendv_epi8(c , c3, _mm_load_si128((__m128i*) &iteration_mask[8]));
-                             c = _mm_shuffle_epi8(c, _mm_load_si128((__m128i*) &iteration_mask[12]));
+    // lowest iteration of the active stacks, where stacks before the main stack
+    // count one iteration less since they have started the next round
+    uint32_t min_iteration(uint32_t main_stack)
+    {
+        uint32_t num_blocks = (NUM_ACTIVE_STACKS + SIMD_WIDTH - 1) / SIMD_WIDTH;
+#if defined(__AVX512F__)
+        __m512i ms = _mm512_set1_epi32(main_stack);
+        __m512i index = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        __m512i l = _mm512_set1_epi32(0x7FFFFFFF);
+        for (uint32_t b = 0; b < num_blocks; ++b)
+        {
+            __m512i i0 = _mm512_load_si512((__m512i*) &s_iterations[b * 16]);
+                    i0 = _mm512_mask_sub_epi32(i0, _mm512_cmpgt_epi32_mask(ms, index), i0, _mm512_set1_epi32(1));
+                    l  = _mm512_mask_min_epi32(l, 0xFFFF, l, i0); // masked forms avoid _mm512_undefined
+                 index = _mm512_add_epi32(index, _mm512_set1_epi32(16));
+        }
 
-                    // mask of stacks allowed to run
-                    uint32_t m = _mm_movemask_epi8(c);
-                    // rotate mask so that main stack is in bit 0
-                             m = (m >> main_stack) | (m << (32 - main_stack));
-                    // offset to new main stack (0 if old main stack is still allowed)
-                    uint32_t k = asm_bsf32(m);
-                    uint32_t old_main_stack = main_stack;
-                    // new main stack
-                    main_stack = (k + main_stack) % 32;
-                    // rotate mask so that new main stack is in bit 0
-                             m = (m >> k) | (m << (32 - k));
-                    // stacks in range [old_main_stack, main_stack) are
-                    // guaranteed to be allowed to run (starting their next frame)
-                             m = m | ~( (uint32_t) ((uint64_t) 1 << (32 - (main_stack - old_main_stack) % 32)) - 1 );
-                    uint32_t active_stack_mask = (1 << NUM_ACTIVE_STACKS) - 1;
-                    // but make sure to zero all bits belonging to inactive stacks (32b bit-field)
-                             m = m & ( (active_stack_mask >> main_stack) | (active_stack_mask << (32 - main_stack)) );
+        // narrowing intrinsics trip gcc's _mm512_undefined warnings, reduce the lanes in memory
+        ALIGN(64) int32_t lanes[16];
+        _mm512_store_si512((__m512i*) lanes, l);
+        int32_t l0 = lanes[0];
+        for (uint32_t i = 1; i < 16; ++i)
+        {
+            l0 = std::min(l0, lanes[i]);
+        }
 
-                    // pack to guarantee conformity between priority mask and main stack
-                    new_pri_mask_main_stack = (uint64_t) main_stack << 32 | m;
-                } while (!s_pri_mask_main_stack.compare_exchange_weak(old_pri_mask_main_stack, new_pri_mask_main_stack, std::memory_order_acq_rel));
-            }
+        return (uint32_t) l0;
+#elif defined(__AVX2__)
+        __m256i ms = _mm256_set1_epi32(main_stack);
+        __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i l = _mm256_set1_epi32(0x7FFFFFFF);
+        for (uint32_t b = 0; b < num_blocks; ++b)
+        {
+            __m256i i0 = _mm256_load_si256((__m256i*) &s_iterations[b * 8]);
+                    i0 = _mm256_add_epi32(i0, _mm256_cmpgt_epi32(ms, index));
+                    l  = _mm256_min_epi32(l, i0);
+                 index = _mm256_add_epi32(index, _mm256_set1_epi32(8));
+        }
 
-            prof_sched_end_exec_start(thread_id, stack, &task);
+        __m128i l0 = _mm_min_epi32(_mm256_castsi256_si128(l), _mm256_extracti128_si256(l, 1));
+        __m128i l1 = _mm_shuffle_epi32(l0, 0x4E);
+                l0 = _mm_min_epi32(l0, l1);
+                l1 = _mm_shuffle_epi32(l0, 0xB1);
+                l0 = _mm_min_epi32(l0, l1);
 
-            uint64_t reached_checkpoints = task.execute(task.args, thread_id);
+        return (uint32_t) _mm_cvtsi128_si32(l0);
+#else
+        __m128i ms = _mm_set1_epi32(main_stack);
+        __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+        __m128i l0 = _mm_set1_epi32(0x7FFFFFFF);
+        for (uint32_t b = 0; b < num_blocks; ++b)
+        {
+            __m128i i0 = _mm_load_si128((__m128i*) &s_iterations[b * 4]);
+                    i0 = _mm_add_epi32(i0, _mm_cmpgt_epi32(ms, index));
+                    l0 = _mm_min_epi32(l0, i0);
+                 index = _mm_add_epi32(index, _mm_set1_epi32(4));
+        }
 
-            prof_exec_end(thread_id, reached_checkpoints);
-            prof_log(thread_id, iteration);
+        __m128i l1 = _mm_shuffle_epi32(l0, 0x4E);
+                l0 = _mm_min_epi32(l0, l1);
+                l1 = _mm_shuffle_epi32(l0, 0xB1);
+                l0 = _mm_min_epi32(l0, l1);
 
-            if (g_total_executed.fetch_add(1, std::memory_order_relaxed) == 10000000)
-            {
-                signal_shutdown();
-            }
+        return (uint32_t) _mm_cvtsi128_si32(l0);
+#endif
+    }
 
-            prof_sched_start(thread_id);
+    // mask of active stacks less than window rounds ahead of the main stack
+    void stack_mask(uint32_t main_stack, uint32_t iteration, uint32_t window, uint64_t* mask)
+    {
+        uint32_t num_blocks = (NUM_ACTIVE_STACKS + SIMD_WIDTH - 1) / SIMD_WIDTH;
+        for (uint32_t i = 0; i < NUM_PRI_MASK_WORDS; ++i)
+        {
+            mask[i] = 0;
+        }
 
-            if (reached_checkpoints) // branch to avoid unnecessary lock instruction
-            {
-                s_checkpoints[iteration & 1].fetch_xor(reached_checkpoints, std::memory_order_release);
-            }
+#if defined(__AVX512F__)
+        __m512i ms = _mm512_set1_epi32(main_stack);
+        __m512i it = _mm512_set1_epi32(iteration);
+        __m512i w  = _mm512_set1_epi32(window);
+        __m512i index = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        for (uint32_t b = 0; b < num_blocks; ++b)
+        {
+            __m512i i0 = _mm512_load_si512((__m512i*) &s_iterations[b * 16]);
+                    i0 = _mm512_mask_sub_epi32(i0, _mm512_cmpgt_epi32_mask(ms, index), i0, _mm512_set1_epi32(1));
+                    i0 = _mm512_mask_sub_epi32(i0, 0xFFFF, i0, it);
+            uint64_t m = _mm512_cmplt_epu32_mask(i0, w);
+            mask[b / 4] |= m << (b % 4) * 16;
+                 index = _mm512_add_epi32(index, _mm512_set1_epi32(16));
+        }
+#elif defined(__AVX2__)
+        __m256i ms = _mm256_set1_epi32(main_stack);
+        __m256i it = _mm256_set1_epi32(iteration);
+        __m256i w  = _mm256_set1_epi32(window);
+        __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        for (uint32_t b = 0; b < num_blocks; ++b)
+        {
+            __m256i i0 = _mm256_load_si256((__m256i*) &s_iterations[b * 8]);
+                    i0 = _mm256_add_epi32(i0, _mm256_cmpgt_epi32(ms, index));
+                    i0 = _mm256_sub_epi32(i0, it); // rounds ahead, never negative
+            uint64_t m = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(w, i0)));
+            mask[b / 8] |= m << (b % 8) * 8;
+                 index = _mm256_add_epi32(index, _mm256_set1_epi32(8));
         }
+#else
+        __m128i ms = _mm_set1_epi32(main_stack);
+        __m128i it = _mm_set1_epi32(iteration);
+        __m128i w  = _mm_set1_epi32(window);
+        __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+        for (uint32_t b = 0; b < num_blocks; ++b)
+        {
+            __m128i i0 = _mm_load_si128((__m128i*) &s_iterations[b * 4]);
+                    i0 = _mm_add_epi32(i0, _mm_cmpgt_epi32(ms, index));
+                    i0 = _mm_sub_epi32(i0, it); // rounds ahead, never negative
+            uint64_t m = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(w, i0)));
+            mask[b / 16] |= m << (b % 16) * 4;
+                 index = _mm_add_epi32(index, _mm_set1_epi32(4));
+        }
+#endif
     }
 
-    uint64_t dont_do_it(void* args, uint32_t thread_id)
+    // only the owning thread writes its counters, no read-modify-write needed
+    inline void count(std::atomic<uint64_t>* counter)
     {
-        std::cout << "DONT DO IT !!!!" << std::endl;
-        uint32_t s = (uint64_t)args;
-        std::cout << s << " " << s_iterations[s] << std::endl;
-        return ECP_NONE;
+        counter->store(counter->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
     }
 
-    uint64_t simulate_work(uint32_t amount)
+    inline bool counted_cas(std::atomic<uint64_t>* value, uint64_t* expected, uint64_t desired, std::atomic<uint64_t>* failures)
     {
-        uint64_t ret = 0;
+        if (value->compare_exchange_weak(*expected, desired, std::memory_order_acq_rel))
+            return true;
 
-        for (uint32_t i = 0; i < amount; ++i)
+        count(failures);
+        return false;
+    }
+
+    // once per round, by the worker that started the next one
+    inline void record_frame()
+    {
+        uint64_t now = clock_ticks();
+        uint64_t start = s_frame_start.exchange(now, std::memory_order_relaxed);
+        uint64_t us = (uint64_t) ((now - start) / g_clock.ticks_per_ns) / 1000;
+        s_frame_times[MMetrics::frame_time_bucket(us)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void update_pri_mask(uint32_t thread_id)
+    {
+        uint32_t num_words = num_pri_mask_words();
+        uint64_t mask[NUM_PRI_MASK_WORDS];
+
+        uint64_t old_main_stack_iteration = s_main_stack_iteration.load(std::memory_order_relaxed);
+        uint64_t new_main_stack_iteration = 0;
+        do
         {
-            ret += asm_rdtscp();
-        }
+            uint32_t main_stack = (uint32_t) (old_main_stack_iteration >> 32);
+            uint32_t iteration = min_iteration(main_stack);
+            stack_mask(main_stack, iteration, 1, mask);
 
-        return ret;
+            // new main stack is the first stack in the lowest round, starting
+            // from the old main stack (which stays if it is still allowed)
+            uint32_t new_main_stack = next_stack(mask, num_words, main_stack);
+            // passing the last stack starts the next round
+            iteration += (uint32_t) (new_main_stack < main_stack);
+
+            // pack to guarantee conformity between main stack and its iteration
+            new_main_stack_iteration = (uint64_t) new_main_stack << 32 | iteration;
+        } while (!counted_cas(&s_main_stack_iteration, &old_main_stack_iteration, new_main_stack_iteration,
+                              &s_worker_states[thread_id].contention[CC_MAIN_STACK_RETRIES]));
+
+        publish_pri_mask(new_main_stack_iteration);
+
+        // once per round, by the worker that started it
+        if ((uint32_t) new_main_stack_iteration != (uint32_t) old_main_stack_iteration)
+        {
+            record_frame();
+            if (CRITICAL_PATH_PRIORITY)
+                update_critical_path();
+        }
     }
 
+    inline uint32_t path_hash(const task_dependencies_t* dependencies, uint32_t stack)
+    {
+        return (uint32_t) ((uintptr_t) dependencies >> 6) * 0x9E3779B1 + stack * 0x85EBCA77;
+    }
 
-    // profiling functions
-    inline void prof_sched_start(uint32_t thread_id)
+    // the claim of a slot is published before its dependencies
+    inline const task_dependencies_t* path_dependencies(path_node_t* node)
     {
-#if PROFILING
-        prof[thread_id].sched_start = timestamp();
-        prof[thread_id].rdtscp_ss = asm_rdtscp();
-#endif
+        const task_dependencies_t* dependencies;
+        while (!(dependencies = node->dependencies.load(std::memory_order_acquire)))
+        {
+            _mm_pause();
+        }
+
+        return dependencies;
     }
 
-    inline void prof_sched_end_exec_start(uint32_t thread_id, uint32_t stack, task_t* task)
+    // slot of the group's node, claimed the first time the group reaches its checkpoint.
+    // the groups of one dependencies struct and stack are probed from the same slot on.
+    // PATH_TABLE_SIZE if the table is full
+    inline uint32_t path_slot(const task_dependencies_t* dependencies, uint32_t stack, uint32_t checkpoint, uint32_t range)
     {
-#if PROFILING
-        prof[thread_id].rdtscp_se = asm_rdtscp();
-        prof[thread_id].sched_end = timestamp();
-        prof[thread_id].checkpoints_previous_frame = task->checkpoints_previous_frame;
-        prof[thread_id].checkpoints_current_frame = task->checkpoints_current_frame;
-        prof[thread_id].stack = stack;
-#endif
+        uint64_t stack_checkpoint = (uint64_t) stack << 32 | checkpoint;
+        uint32_t slot = path_hash(dependencies, stack);
+        for (uint32_t i = 0; i < PATH_TABLE_SIZE; ++i, ++slot)
+        {
+            path_node_t* node = &s_path_nodes[slot & (PATH_TABLE_SIZE - 1)];
+            uint64_t learned = node->stack_checkpoint.load(std::memory_order_acquire);
+            if (!learned && node->stack_checkpoint.compare_exchange_strong(learned, stack_checkpoint, std::memory_order_acq_rel))
+            {
+                node->range = range;
+                node->dependencies.store(dependencies, std::memory_order_release);
+                return slot & (PATH_TABLE_SIZE - 1);
+            }
+            if (learned == stack_checkpoint && path_dependencies(node) == dependencies)
+                return slot & (PATH_TABLE_SIZE - 1);
+        }
+
+        return PATH_TABLE_SIZE;
     }
 
-    inline void prof_exec_end(uint32_t thread_id, uint64_t reached_checkpoints)
+    // slot of the only plain group recorded with dependencies on stack, for its tasks
+    // that reach no checkpoint. PATH_TABLE_SIZE when there is none yet or several
+    inline uint32_t plain_path_slot(const task_dependencies_t* dependencies, uint32_t stack)
     {
-#if PROFILING
-        prof[thread_id].exec_end = timestamp();
-        prof[thread_id].rdtscp_ee = asm_rdtscp();
-        prof[thread_id].reached_checkpoints = reached_checkpoints;
-#endif
+        uint32_t found = PATH_TABLE_SIZE;
+        uint32_t slot = path_hash(dependencies, stack);
+        for (uint32_t i = 0; i < PATH_TABLE_SIZE; ++i, ++slot)
+        {
+            path_node_t* node = &s_path_nodes[slot & (PATH_TABLE_SIZE - 1)];
+            uint64_t learned = node->stack_checkpoint.load(std::memory_order_acquire);
+            if (!learned)
+                break;
+            if ((uint32_t) (learned >> 32) == stack && path_dependencies(node) == dependencies && !node->range)
+            {
+                if (found != PATH_TABLE_SIZE)
+                    return PATH_TABLE_SIZE;
+                found = slot & (PATH_TABLE_SIZE - 1);
+            }
+        }
+
+        return found;
     }
 
-    inline void prof_log(uint32_t thread_id, uint32_t iteration)
+    // adds the task's cycles to the node of its group
+    inline void record_path(uint32_t thread_id, uint32_t stack, const task_t* task, uint64_t reached_checkpoint, uint64_t cycles)
     {
-#if PROFILING
-        uint32_t it = iteration & 0x03;
-        uint32_t i = profiling_i[it][thread_id];
-        profiling_log[it][thread_id][i].sched_start = prof[thread_id].sched_start;
-        profiling_log[it][thread_id][i].sched_end = prof[thread_id].sched_end;
-        profiling_log[it][thread_id][i].exec_end = prof[thread_id].exec_end;
-        profiling_log[it][thread_id][i].rdtscp_sched = prof[thread_id].rdtscp_se - prof[thread_id].rdtscp_ss;
-        profiling_log[it][thread_id][i].rdtscp_exec = prof[thread_id].rdtscp_ee - prof[thread_id].rdtscp_se;
-        profiling_log[it][thread_id][i].stack = prof[thread_id].stack;
-        profiling_log[it][thread_id][i].checkpoints_previous_frame = prof[thread_id].checkpoints_previous_frame;
-        profiling_log[it][thread_id][i].checkpoints_current_frame = prof[thread_id].checkpoints_current_frame;
-        profiling_log[it][thread_id][i].reached_checkpoints = prof[thread_id].reached_checkpoints;
+        uint32_t range = task->execute == execute_range;
+        uint32_t checkpoint = range ? ((const range_task_t*) task->args)->completion_checkpoint : (uint32_t) reached_checkpoint;
+        uint32_t slot = checkpoint ? path_slot(task->dependencies, stack, checkpoint, range)
+                      : range  ? PATH_TABLE_SIZE
+                               : plain_path_slot(task->dependencies, stack);
+        if (slot == PATH_TABLE_SIZE)
+            return;
 
-        ++profiling_i[it][thread_id];
-#endif
+        s_path_cycles[thread_id][slot].store(s_path_cycles[thread_id][slot].load(std::memory_order_relaxed) + cycles, std::memory_order_relaxed);
+        s_path_tasks[thread_id][slot].store(s_path_tasks[thread_id][slot].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
     }
 
-    void write_profiling()
+    // estimates the span of every learned node from the cycles its tasks took since
+    // the last round, spread over as many workers as it had tasks. the longest chain
+    // of nodes through the current frame checkpoints they wait for is the critical
+    // path, and the stacks it runs through are tried first by the pickers
+    void update_critical_path()
     {
-#if PROFILING
-        std::ofstream o;
-        o.open("debug/debug.txt");
+        if (s_critical_path_lock.exchange(1, std::memory_order_acquire))
+            return; // a round is still being processed
 
-        for (uint32_t thread = 0; thread < NUM_WORKER_THREADS; ++thread)
+        uint32_t nodes[PATH_TABLE_SIZE];
+        uint32_t num_nodes = 0;
+        for (uint32_t i = 0; i < PATH_TABLE_SIZE; ++i)
         {
-            o << "THREAD " << thread << ":\n";
+            uint64_t cycles = 0;
+            uint64_t tasks = 0;
+            for (uint32_t thread = 0; thread < NUM_WORKER_THREADS + NUM_LANES; ++thread)
+            {
+                cycles += s_path_cycles[thread][i].load(std::memory_order_relaxed);
+                tasks += s_path_tasks[thread][i].load(std::memory_order_relaxed);
+            }
+
+            uint64_t round_tasks = tasks - s_path_seen_tasks[i];
+            if (round_tasks)
+            {
+                uint64_t span = (cycles - s_path_seen_cycles[i]) / std::min(round_tasks, (uint64_t) NUM_WORKER_THREADS);
+                s_path_span[i] += ((int64_t) span - (int64_t) s_path_span[i]) / 8;
+            }
+            s_path_seen_cycles[i] = cycles;
+            s_path_seen_tasks[i] = tasks;
 
-            for (uint32_t i = 0; i < PROFILING_SIZE; ++i)
+            // nodes are only listed once their dependencies are stored
+            if (s_path_nodes[i].dependencies.load(std::memory_order_acquire))
             {
-                o << std::setprecision(9)
-                  << profiling_log[0][thread][i].sched_start << " | "
-                  << profiling_log[0][thread][i].sched_end << " | "
-                  << profiling_log[0][thread][i].exec_end << " | "
-                  << profiling_log[0][thread][i].rdtscp_sched << " | "
-                  << profiling_log[0][thread][i].rdtscp_exec << " | "
-                  << profiling_log[0][thread][i].stack << " | "
-                  << profiling_log[0][thread][i].checkpoints_previous_frame << " | "
-                  << profiling_log[0][thread][i].checkpoints_current_frame << " | "
-                  << profiling_log[0][thread][i].reached_checkpoints << "\n"
-                  << "\t--------------------\n";
+                nodes[num_nodes++] = i;
             }
         }
 
-        o.close();
-#endif
+        // longest chain ending in each node. relax until stable, a frame has no cycles
+        uint64_t finish[PATH_TABLE_SIZE];
+        uint32_t before[PATH_TABLE_SIZE];
+        for (uint32_t n = 0; n < num_nodes; ++n)
+        {
+            finish[nodes[n]] = s_path_span[nodes[n]];
+            before[nodes[n]] = PATH_TABLE_SIZE;
+        }
+
+        bool changed = true;
+        for (uint32_t pass = 0; changed && pass < num_nodes; ++pass)
+        {
+            changed = false;
+            for (uint32_t n = 0; n < num_nodes; ++n)
+            {
+                const checkpoint_set_t* waits_for = &s_path_nodes[nodes[n]].dependencies.load(std::memory_order_relaxed)->frames[0];
+                for (uint32_t m = 0; m < num_nodes; ++m)
+                {
+                    uint32_t checkpoint = (uint32_t) s_path_nodes[nodes[m]].stack_checkpoint.load(std::memory_order_relaxed);
+                    bool edge = m != n && (waits_for->words[checkpoint / 64] >> (checkpoint % 64)) & 1;
+                    if (edge && finish[nodes[m]] + s_path_span[nodes[n]] > finish[nodes[n]])
+                    {
+                        finish[nodes[n]] = finish[nodes[m]] + s_path_span[nodes[n]];
+                        before[nodes[n]] = nodes[m];
+                        changed = true;
+                    }
+                }
+            }
+        }
+
+        uint64_t mask[NUM_PRI_MASK_WORDS] = {};
+        uint64_t length = 0;
+        uint32_t last = PATH_TABLE_SIZE;
+        for (uint32_t n = 0; n < num_nodes; ++n)
+        {
+            if (finish[nodes[n]] > length)
+            {
+                length = finish[nodes[n]];
+                last = nodes[n];
+            }
+        }
+        for (uint32_t i = last, steps = 0; i != PATH_TABLE_SIZE && steps < num_nodes; i = before[i], ++steps)
+        {
+            uint32_t stack = (uint32_t) (s_path_nodes[i].stack_checkpoint.load(std::memory_order_relaxed) >> 32);
+            mask[stack / 64] |= (uint64_t) 1 << (stack % 64);
+        }
+
+        for (uint32_t i = 0; i < NUM_PRI_MASK_WORDS; ++i)
+        {
+            s_critical_mask[i].store(mask[i], std::memory_order_relaxed);
+        }
+        g_critical_path_cycles.store(length, std::memory_order_relaxed);
+
+        s_critical_path_lock.store(0, std::memory_order_release);
+    }
+
+    // stacks may run up to FRAMES_IN_FLIGHT - 2 rounds ahead of the main stack, so that
+    // FRAMES_IN_FLIGHT frames are in flight with the stacks before the main stack
+    inline bool stack_allowed(uint32_t stack, uint32_t iteration, uint32_t main_stack, uint32_t main_iteration)
+    {
+        return iteration - (uint32_t) (stack < main_stack) - main_iteration < FRAMES_IN_FLIGHT - 1;
+    }
+
+    // the priority mask words are a hint for which stacks to try. pickers
+    // validate every stack against the main stack and its iteration, so a
+    // mask that is torn or lags behind only costs a wasted pick attempt.
+    // rewrite the mask until it was computed for the latest main stack
+    void publish_pri_mask(uint64_t main_stack_iteration)
+    {
+        uint32_t num_words = num_pri_mask_words();
+        uint64_t mask[NUM_PRI_MASK_WORDS];
+        uint64_t published;
+        do
+        {
+            stack_mask((uint32_t) (main_stack_iteration >> 32), (uint32_t) main_stack_iteration, FRAMES_IN_FLIGHT - 1, mask);
+            for (uint32_t i = 0; i < num_words; ++i)
+            {
+                s_pri_mask[i].store(mask[i], std::memory_order_relaxed);
+            }
+
+            published = main_stack_iteration;
+            main_stack_iteration = s_main_stack_iteration.load(std::memory_order_acquire);
+        } while (main_stack_iteration != published);
+    }
+
+    // frames are biased by FRAMES_IN_FLIGHT to keep the frames before frame 0 positive
+    inline uint32_t checkpoint_slot(uint32_t frame)
+    {
+        return (frame + FRAMES_IN_FLIGHT) % FRAMES_IN_FLIGHT;
     }
 
-    inline double timestamp()
+    // non-zero if any checkpoint in required is not yet reached in frame.
+    // reached checkpoints toggle their bit, so the meaning of a set bit
+    // alternates every other frame sharing the same slot
+    inline uint64_t checkpoints_pending(const checkpoint_set_t* required, uint32_t frame)
     {
-        static auto start = std::chrono::high_resolution_clock::now();
-        auto now = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double, std::micro> diff = now - start;
+        uint32_t biased_frame = frame + FRAMES_IN_FLIGHT;
+        const std::atomic<uint64_t>* reached = s_checkpoints[biased_frame % FRAMES_IN_FLIGHT];
+        uint64_t flip = (uint64_t) ((biased_frame / FRAMES_IN_FLIGHT) & 1) - 1;
+#if defined(__AVX512F__)
+        static_assert(NUM_CHECKPOINT_WORDS == 8, "one 512 bit load per checkpoint set");
+        // not reached, flipped the other way round
+        __m512i r0 = _mm512_loadu_si512((const __m512i*) &required->words[0]);
+        __m512i n0 = _mm512_xor_si512(_mm512_load_si512((const __m512i*) reached), _mm512_set1_epi64(~flip));
+
+        return _mm512_test_epi64_mask(r0, n0);
+#elif defined(__AVX2__)
+        static_assert(NUM_CHECKPOINT_WORDS == 8, "two 256 bit loads per checkpoint set");
+        __m256i f  = _mm256_set1_epi64x(flip);
+        __m256i r0 = _mm256_loadu_si256((const __m256i*) &required->words[0]);
+        __m256i r1 = _mm256_loadu_si256((const __m256i*) &required->words[4]);
+        __m256i e0 = _mm256_xor_si256(_mm256_load_si256((const __m256i*) &reached[0]), f);
+        __m256i e1 = _mm256_xor_si256(_mm256_load_si256((const __m256i*) &reached[4]), f);
+        __m256i p  = _mm256_or_si256(_mm256_andnot_si256(e0, r0), _mm256_andnot_si256(e1, r1));
+
+        return !_mm256_testz_si256(p, p);
+#else
+        __m128i f  = _mm_set1_epi64x(flip);
+        __m128i p  = _mm_setzero_si128();
+        for (uint32_t i = 0; i < NUM_CHECKPOINT_WORDS; i += 2)
+        {
+            __m128i r0 = _mm_loadu_si128((const __m128i*) &required->words[i]);
+            __m128i e0 = _mm_xor_si128(_mm_load_si128((const __m128i*) &reached[i]), f);
+                    p  = _mm_or_si128(p, _mm_andnot_si128(e0, r0));
+        }
+
+        return !_mm_testz_si128(p, p);
+#endif
+    }
 
-        return diff.count();
+    // non-zero if the task can not run in iteration yet
+    inline uint64_t task_pending(const task_t* task, uint32_t iteration)
+    {
+        const task_dependencies_t* dependencies = task->dependencies;
+        uint64_t c = checkpoints_pending(&dependencies->frames[0], iteration);
+        // a frame FRAMES_IN_FLIGHT back is finished before this one starts, and its
+        // slot is this frame's. dependencies recorded before FRAMES_IN_FLIGHT was set can reach that far
+        uint32_t frames_back = std::min(dependencies->frames_back, FRAMES_IN_FLIGHT - 1);
+        for (uint32_t k = 1; k <= frames_back; ++k)
+        {
+            c |= checkpoints_pending(&dependencies->frames[k], iteration - k);
+        }
+
+        return c;
+    }
+
+    inline void finish_stack_iteration(uint32_t stack, uint32_t thread_id)
+    {
+        // we picked the last task. update priority mask
+        if (s_num_domains > 1)
+        {
+            rehome_stack(stack, s_worker_domains[thread_id]);
+        }
+        s_iterations[stack].fetch_add(1, std::memory_order_relaxed);
+        update_pri_mask(thread_id);
+        // stacks waiting for the main stack's round might be allowed now
+        wake_workers();
+    }
+
+    // returns the clock ticks the task took, cycles with an invariant TSC.
+    // the profiling reuses the two clock reads
+    inline uint64_t execute_task(uint32_t thread_id, uint32_t stack, uint32_t iteration, task_t* task)
+    {
+        s_worker_states[thread_id].running_stack = stack;
+        s_worker_states[thread_id].running_iteration = iteration;
+
+        uint64_t start = clock_ticks();
+        prof_sched_end_exec_start(thread_id, stack, task, start);
+
+        uint64_t reached_checkpoint = task->execute(task->args, thread_id);
+
+        uint64_t end = clock_ticks();
+        uint64_t cycles = end - start;
+        prof_exec_end(thread_id, reached_checkpoint, end);
+        prof_log(thread_id, iteration);
+
+        if (CRITICAL_PATH_PRIORITY)
+        {
+            record_path(thread_id, stack, task, reached_checkpoint, cycles);
+        }
+
+        if (g_total_executed.fetch_add(1, std::memory_order_relaxed) == MAX_EXECUTED_TASKS)
+        {
+            signal_shutdown();
+        }
+
+        prof_sched_start(thread_id);
+
+        if (reached_checkpoint) // branch to avoid unnecessary lock instruction
+        {
+            s_checkpoints[checkpoint_slot(iteration)][reached_checkpoint / 64].fetch_xor((uint64_t) 1 << (reached_checkpoint % 64), std::memory_order_release);
+            wake_workers();
+        }
+
+        return cycles;
+    }
+
+    inline uint32_t task_lane(const task_t* task)
+    {
+        return task->dependencies->flags & TF_MAIN_THREAD ? LANE_MAIN : LANE_BLOCKING;
+    }
+
+    // bounded queue with a sequence number per entry. producers claim a position
+    // with a CAS on head and publish the entry through its sequence number
+    void lane_push(task_lane_t* lane, const deque_entry_t* entry)
+    {
+        uint32_t position = lane->head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            lane_entry_t* e = &lane->entries[position & (LANE_SIZE - 1)];
+            int32_t diff = (int32_t) (e->sequence.load(std::memory_order_acquire) - position);
+            if (diff == 0 && lane->head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                e->entry = *entry;
+                e->sequence.store(position + 1, std::memory_order_release);
+                break;
+            }
+            if (diff < 0)
+            {
+                _mm_pause(); // full. the lane is LANE_SIZE tasks behind
+            }
+            if (diff != 0)
+            {
+                position = lane->head.load(std::memory_order_relaxed);
+            }
+        }
+
+        // order the push before reading sleeping, run_lane orders them the other way round
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (lane->sleeping.load(std::memory_order_relaxed))
+        {
+            lane->wake_epoch.fetch_add(1, std::memory_order_relaxed);
+            MPlatform::futex_wake(&lane->wake_epoch, 1);
+        }
+    }
+
+    inline bool lane_pop(task_lane_t* lane, deque_entry_t* entry)
+    {
+        uint32_t position = lane->tail.load(std::memory_order_relaxed);
+        lane_entry_t* e = &lane->entries[position & (LANE_SIZE - 1)];
+        if (e->sequence.load(std::memory_order_acquire) != position + 1)
+            return false;
+
+        *entry = e->entry;
+        e->sequence.store(position + LANE_SIZE, std::memory_order_release);
+        lane->tail.store(position + 1, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    // runs the task, or hands it to its lane. returns the cycles it ran for
+    inline uint64_t run_task(uint32_t thread_id, uint32_t stack, uint32_t iteration, task_t* task)
+    {
+        if (task->dependencies->flags & TF_LANES)
+        {
+            deque_entry_t e = { *task, stack, iteration };
+            lane_push(&s_lanes[task_lane(task)], &e);
+            return 0;
+        }
+
+        return execute_task(thread_id, stack, iteration, task);
+    }
+
+    void run_lane(uint32_t lane_index)
+    {
+        task_lane_t* lane = &s_lanes[lane_index];
+        uint32_t thread_id = NUM_WORKER_THREADS + lane_index;
+
+        open_thread_counters(thread_id);
+        prof_sched_start(thread_id);
+
+        while (!g_quit_request.load(std::memory_order_relaxed))
+        {
+            deque_entry_t entry;
+            if (lane_pop(lane, &entry))
+            {
+                execute_task(thread_id, entry.stack, entry.iteration, &entry.task);
+                continue;
+            }
+
+            // announce sleeping before the last look, lane_push looks the other way round
+            uint32_t epoch = lane->wake_epoch.load(std::memory_order_seq_cst);
+            lane->sleeping.store(1, std::memory_order_seq_cst);
+            uint32_t position = lane->tail.load(std::memory_order_relaxed);
+            if (lane->entries[position & (LANE_SIZE - 1)].sequence.load(std::memory_order_acquire) != position + 1 &&
+                !g_quit_request.load(std::memory_order_relaxed))
+            {
+                MPlatform::futex_wait(&lane->wake_epoch, epoch);
+            }
+            lane->sleeping.store(0, std::memory_order_relaxed);
+        }
+
+        close_thread_counters(thread_id);
+    }
+
+    void wake_lanes()
+    {
+        for (uint32_t i = 0; i < NUM_LANES; ++i)
+        {
+            s_lanes[i].wake_epoch.fetch_add(1, std::memory_order_seq_cst);
+            MPlatform::futex_wake(&s_lanes[i].wake_epoch, 1);
+        }
+    }
+
+    inline bool suspended_ready(const suspended_task_t* suspended)
+    {
+        return !task_pending(&suspended->task, suspended->iteration) &&
+               (!suspended->event || suspended->event->signaled.load(std::memory_order_acquire));
+    }
+
+    bool suspend_task(uint32_t thread_id, task_t continuation, task_event_t* event)
+    {
+        worker_state_t* state = &s_worker_states[thread_id];
+        suspended_task_t suspended = { continuation, state->running_stack, state->running_iteration, event };
+
+        for (uint32_t w = 0; w < MAX_SUSPENDED_TASKS / 64; ++w)
+        {
+            uint64_t free = s_suspended_free[w].load(std::memory_order_relaxed);
+            while (free)
+            {
+                uint64_t bit = (uint64_t) 1 << asm_bsf64(free);
+                free &= ~bit;
+                if (s_suspended_free[w].fetch_and(~bit, std::memory_order_acquire) & bit)
+                {
+                    s_suspended[w * 64 + asm_bsf64(bit)] = suspended;
+                    s_num_suspended.fetch_add(1, std::memory_order_relaxed);
+                    g_total_suspended.fetch_add(1, std::memory_order_relaxed);
+                    s_suspended_waiting[w].fetch_or(bit, std::memory_order_release);
+                    wake_workers(); // the wait might already be over
+                    return true;
+                }
+            }
+        }
+
+        // every slot is taken. running the continuation here would nest it in
+        // this task's execution, so the caller has to wait outside the scheduler
+        return false;
+    }
+
+    // a slot is taken out of the waiting set while it is checked, so only one worker resumes it
+    bool resume_suspended(uint32_t thread_id)
+    {
+        if (!s_num_suspended.load(std::memory_order_relaxed))
+            return false;
+
+        for (uint32_t w = 0; w < MAX_SUSPENDED_TASKS / 64; ++w)
+        {
+            uint64_t waiting = s_suspended_waiting[w].load(std::memory_order_acquire);
+            while (waiting)
+            {
+                uint64_t bit = (uint64_t) 1 << asm_bsf64(waiting);
+                waiting &= ~bit;
+                if (!(s_suspended_waiting[w].fetch_and(~bit, std::memory_order_acquire) & bit))
+                    continue;
+
+                suspended_task_t* suspended = &s_suspended[w * 64 + asm_bsf64(bit)];
+                if (!suspended_ready(suspended))
+                {
+                    s_suspended_waiting[w].fetch_or(bit, std::memory_order_release);
+                    continue;
+                }
+
+                suspended_task_t resumed = *suspended;
+                s_suspended_free[w].fetch_or(bit, std::memory_order_release);
+                s_num_suspended.fetch_sub(1, std::memory_order_relaxed);
+                run_task(thread_id, resumed.stack, resumed.iteration, &resumed.task);
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void signal_event(task_event_t* event)
+    {
+        event->signaled.store(1, std::memory_order_release);
+        wake_workers();
+    }
+
+    void wake_parked_workers()
+    {
+        s_wake_ticks.store(clock_ticks(), std::memory_order_relaxed);
+        s_wake_epoch.fetch_add(1, std::memory_order_seq_cst);
+        MPlatform::futex_wake(&s_wake_epoch, MAX_NUM_WORKER_THREADS);
+        g_total_wakes.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // called each time a worker found nothing to run. spins for a while, then
+    // announces itself as parked, makes one more pass and only then sleeps
+    inline void idle(worker_state_t* state)
+    {
+        uint32_t passes = ++state->idle_passes;
+        if (passes < PARK_SPIN_COUNT)
+        {
+            _mm_pause();
+        }
+        else if (passes == PARK_SPIN_COUNT)
+        {
+            s_num_parked.fetch_add(1, std::memory_order_seq_cst);
+            state->wake_epoch = s_wake_epoch.load(std::memory_order_seq_cst);
+            state->woken_ticks = 0; // no pick since the last wake
+        }
+        else
+        {
+            // only parks that slept count. the epoch moving on shows a wake rather than a spurious return
+            if (!g_quit_request.load(std::memory_order_relaxed) && MPlatform::futex_wait(&s_wake_epoch, state->wake_epoch))
+            {
+                g_total_parks.fetch_add(1, std::memory_order_relaxed);
+                if (s_wake_epoch.load(std::memory_order_acquire) != state->wake_epoch)
+                    state->woken_ticks = s_wake_ticks.load(std::memory_order_relaxed);
+            }
+            s_num_parked.fetch_sub(1, std::memory_order_relaxed);
+            state->idle_passes = 0;
+        }
+    }
+
+    inline void busy(worker_state_t* state)
+    {
+        if (state->idle_passes >= PARK_SPIN_COUNT)
+        {
+            // found work during the last pass before parking
+            s_num_parked.fetch_sub(1, std::memory_order_relaxed);
+        }
+        state->idle_passes = 0;
+
+        if (state->woken_ticks)
+        {
+            g_total_wake_latency_ticks.fetch_add(clock_ticks() - state->woken_ticks, std::memory_order_relaxed);
+            g_total_woken_picks.fetch_add(1, std::memory_order_relaxed);
+            state->woken_ticks = 0;
+        }
+    }
+
+    // takes the highest ready task within OUT_OF_ORDER_WINDOW tasks below the
+    // blocked top. the stack is locked with STACK_BUSY while the tasks above
+    // the picked one move down, which keeps their order. the submit task at
+    // index 1 and tasks below a barrier are never picked out of order
+    bool pick_out_of_order(task_stack_t* stack, uint64_t iterations_size, task_t* task)
+    {
+        uint32_t iteration = (uint32_t) (iterations_size >> 32);
+        uint32_t stack_size = (uint32_t) iterations_size;
+        if (stack_task(stack, stack_size)->dependencies->flags & TF_BARRIER)
+            return false;
+
+        uint32_t last = stack_size > OUT_OF_ORDER_WINDOW + 2 ? stack_size - OUT_OF_ORDER_WINDOW : 2;
+        uint32_t j = stack_size - 1;
+        for (; j >= last; --j)
+        {
+            const task_t* t = stack_task(stack, j);
+            if (!task_pending(t, iteration))
+                break;
+            if (t->dependencies->flags & TF_BARRIER)
+                return false;
+        }
+
+        if (j < last || !stack->iterations_size.compare_exchange_strong(iterations_size, iterations_size | STACK_BUSY, std::memory_order_acquire))
+            return false;
+
+        // nothing was popped since the tasks were read, or the CAS would have failed
+        *task = *stack_task(stack, j);
+        for (uint32_t i = j; i < stack_size; ++i)
+        {
+            *stack_task(stack, i) = *stack_task(stack, i + 1);
+        }
+        stack->reordered = 1;
+        stack->iterations_size.store(iterations_size - 1, std::memory_order_release);
+
+        g_total_out_of_order.fetch_add(1, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    // batch short tasks so they share a CAS, keep long tasks alone so they balance
+    inline void update_batch_size(worker_state_t* state, uint64_t task_cycles)
+    {
+        state->avg_task_cycles += ((int64_t) task_cycles - (int64_t) state->avg_task_cycles) / 8;
+        uint64_t batch_size = BATCH_TARGET_CYCLES / (state->avg_task_cycles | 1);
+        state->batch_size = (uint32_t) std::max((uint64_t) 1, std::min((uint64_t) MAX_BATCH_SIZE, batch_size));
+    }
+
+    // claims the batch_size tasks on top of the stack unless it changed since iterations_size was read
+    inline bool pop_tasks(task_stack_t* stack, uint64_t iterations_size, uint32_t batch_size, worker_state_t* state)
+    {
+        return counted_cas(&stack->iterations_size, &iterations_size, iterations_size - batch_size, &state->contention[CC_CAS_RETRIES]);
+    }
+
+    void worker_thread(uint32_t thread_id)
+    {
+        pin_worker(thread_id);
+        open_thread_counters(thread_id);
+
+        if (SCHEDULING_POLICY == SP_WORK_STEALING)
+        {
+            worker_thread_stealing(thread_id);
+            close_thread_counters(thread_id);
+            return;
+        }
+
+        prof_sched_start(thread_id);
+
+        uint32_t stack = 0;
+        uint32_t stack_size = 0;
+        uint64_t iterations_size = 0;
+        uint32_t iteration = 0;
+
+        uint32_t num_words = num_pri_mask_words();
+        uint64_t pri_mask[NUM_PRI_MASK_WORDS];
+        uint64_t critical[NUM_PRI_MASK_WORDS] = {}; // quiets -Wmaybe-uninitialized, load_pri_mask fills it
+        uint64_t local[NUM_PRI_MASK_WORDS] = {};
+        uint32_t domain = s_worker_domains[thread_id];
+
+        worker_state_t* state = &s_worker_states[thread_id];
+
+        while (!g_quit_request.load(std::memory_order_relaxed))
+        {
+            // continuations first, the rest of their stack usually waits for them
+            if (resume_suspended(thread_id))
+            {
+                busy(state);
+                continue;
+            }
+
+            uint64_t main_stack_iteration = load_pri_mask(pri_mask, critical, local, domain, num_words);
+            uint32_t main_stack = (uint32_t) (main_stack_iteration >> 32);
+            uint32_t main_iteration = (uint32_t) main_stack_iteration;
+
+            task_t batch[MAX_BATCH_SIZE];
+            uint32_t batch_size = 1;
+
+            uint64_t c;
+            // previous stack has highest priority, unless it is off the critical path while a
+            // critical stack is allowed. then the critical stacks, the local stacks and the main stack come next
+            uint32_t first_pri = first_pri_stack(critical, local, num_words, main_stack);
+            uint32_t previous_stack_allowed = (uint32_t) (iteration == s_iterations[stack].load(std::memory_order_relaxed));
+            previous_stack_allowed &= (uint32_t) (pri_mask[stack / 64] >> (stack % 64));
+            if (next_stack(critical, num_words, main_stack) != NUM_STACKS)
+                previous_stack_allowed &= (uint32_t) (critical[stack / 64] >> (stack % 64));
+            uint32_t next_pri = previous_stack_allowed ? stack : first_pri;
+            remove_stack(pri_mask, critical, local, next_pri);
+            do
+            {
+                stack = next_pri;
+
+                iterations_size = s_stacks[stack].iterations_size.load(std::memory_order_acquire);
+                iteration = (uint32_t) (iterations_size >> 32);
+                stack_size = (uint32_t) iterations_size & ~STACK_BUSY;
+                batch[0] = *stack_task(&s_stacks[stack], stack_size);
+
+                // the priority mask is only a hint. stacks ahead of the main stack's round wait for the others
+                uint64_t stack_blocked = (uint64_t) !stack_allowed(stack, iteration, main_stack, main_iteration);
+                stack_blocked |= (uint64_t) stack_size == 0; // this should be handled with dont_do_it tasks
+                stack_blocked |= iterations_size & STACK_BUSY;
+                // check if all required checkpoints are reached
+                c  = task_pending(&batch[0], iteration);
+                c |= stack_blocked;
+
+                if (c && !stack_blocked && OUT_OF_ORDER_WINDOW && pick_out_of_order(&s_stacks[stack], iterations_size, &batch[0]))
+                {
+                    c = 0;
+                    batch_size = 1;
+                    break;
+                }
+
+                if (c)
+                {
+                    count(&state->contention[CC_BLOCKED_PICKS]);
+                    next_pri = next_pri_stack(pri_mask, critical, local, num_words, main_stack);
+                    if (next_pri == NUM_STACKS)
+                    {
+                        // all top tasks are blocked by dependencies. resume a continuation whose wait is over, or
+                        // reload priority mask and try again (a blocking task might have finished)
+                        if (resume_suspended(thread_id))
+                            busy(state);
+                        else
+                            idle(state);
+                        if (g_quit_request.load(std::memory_order_relaxed))
+                            break;
+                        count(&state->contention[CC_MASK_RELOADS]);
+                        main_stack_iteration = load_pri_mask(pri_mask, critical, local, domain, num_words);
+                        main_stack = (uint32_t) (main_stack_iteration >> 32);
+                        main_iteration = (uint32_t) main_stack_iteration;
+                        next_pri = first_pri_stack(critical, local, num_words, main_stack);
+                    }
+                    // task is blocked. try another stack
+                    remove_stack(pri_mask, critical, local, next_pri);
+                    continue;
+                }
+
+                // tasks below with the same requirements are ready as well. claim them with the same CAS
+                // range tasks split themselves across workers, wherever they sit. batching them would serialize the range
+                uint32_t max_batch_size = batch[0].execute == execute_range ? 1 : std::min(state->batch_size, stack_size);
+                for (batch_size = 1; batch_size < max_batch_size; ++batch_size)
+                {
+                    batch[batch_size] = *stack_task(&s_stacks[stack], stack_size - batch_size);
+                    if (batch[batch_size].dependencies != batch[0].dependencies || batch[batch_size].execute == execute_range)
+                        break;
+                }
+
+            } while ( c || !pop_tasks(&s_stacks[stack], iterations_size, batch_size, state) );
+
+            if (c)
+                break; // shutting down while idle
+
+            busy(state);
+
+            if (stack_size == batch_size)
+            {
+                finish_stack_iteration(stack, thread_id);
+            }
+
+            uint64_t batch_cycles = 0;
+            for (uint32_t i = 0; i < batch_size; ++i)
+            {
+                batch_cycles += run_task(thread_id, stack, iteration, &batch[i]);
+            }
+            update_batch_size(state, batch_cycles / batch_size);
+        }
+
+        close_thread_counters(thread_id);
+    }
+
+    // Chase-Lev deque, only pushed to while empty so it never wraps onto unstolen entries
+    inline void deque_push(task_deque_t* deque, const deque_entry_t* entry)
+    {
+        int64_t b = deque->bottom.load(std::memory_order_relaxed);
+        deque->entries[b & (DEQUE_SIZE - 1)] = *entry;
+        std::atomic_thread_fence(std::memory_order_release);
+        deque->bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    inline bool deque_take(task_deque_t* deque, deque_entry_t* entry)
+    {
+        int64_t b = deque->bottom.load(std::memory_order_relaxed) - 1;
+        deque->bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = deque->top.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            // empty
+            deque->bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        *entry = deque->entries[b & (DEQUE_SIZE - 1)];
+        if (t == b)
+        {
+            // last entry. race thieves for it
+            bool won = deque->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            deque->bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+
+        return true;
+    }
+
+    inline bool deque_steal(task_deque_t* deque, deque_entry_t* entry)
+    {
+        int64_t t = deque->top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = deque->bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+            return false;
+
+        *entry = deque->entries[t & (DEQUE_SIZE - 1)];
+        return deque->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    // claims the run of ready tasks at the top of the highest priority stack
+    // with a single CAS. the top task is returned in entry, the rest goes to
+    // the worker's deque where idle workers can steal it. false if every
+    // allowed stack top is blocked
+    bool claim_tasks(uint32_t thread_id, uint32_t* stack, deque_entry_t* entry)
+    {
+        uint32_t num_words = num_pri_mask_words();
+        uint64_t pri_mask[NUM_PRI_MASK_WORDS];
+        uint64_t critical[NUM_PRI_MASK_WORDS] = {}; // quiets -Wmaybe-uninitialized, load_pri_mask fills it
+        uint64_t local[NUM_PRI_MASK_WORDS] = {};
+        uint64_t main_stack_iteration = load_pri_mask(pri_mask, critical, local, s_worker_domains[thread_id], num_words);
+        uint32_t main_stack = (uint32_t) (main_stack_iteration >> 32);
+        uint32_t main_iteration = (uint32_t) main_stack_iteration;
+
+        // previous stack has highest priority, unless it is off the critical path while a
+        // critical stack is allowed. then the critical stacks, the local stacks and the main stack come next
+        uint32_t previous_stack_allowed = (uint32_t) (pri_mask[*stack / 64] >> (*stack % 64)) & 1;
+        if (next_stack(critical, num_words, main_stack) != NUM_STACKS)
+            previous_stack_allowed &= (uint32_t) (critical[*stack / 64] >> (*stack % 64));
+        uint32_t next_pri = previous_stack_allowed ? *stack : first_pri_stack(critical, local, num_words, main_stack);
+        while (next_pri != NUM_STACKS)
+        {
+            remove_stack(pri_mask, critical, local, next_pri);
+            task_stack_t* s = &s_stacks[next_pri];
+
+            uint64_t iterations_size = s->iterations_size.load(std::memory_order_acquire);
+            uint32_t iteration = (uint32_t) (iterations_size >> 32);
+            uint32_t stack_size = (uint32_t) iterations_size & ~STACK_BUSY;
+
+            // the priority mask is only a hint. stacks ahead of the main stack's round wait for the others
+            bool allowed = stack_allowed(next_pri, iteration, main_stack, main_iteration);
+            allowed &= !(iterations_size & STACK_BUSY);
+
+            // share the stack with the other workers
+            uint32_t max_run = std::min((stack_size + NUM_WORKER_THREADS - 1) / NUM_WORKER_THREADS, DEQUE_SIZE);
+            uint32_t run = 0;
+            while (allowed && run < max_run && !task_pending(stack_task(s, stack_size - run), iteration))
+            {
+                ++run;
+            }
+
+            if (run && pop_tasks(s, iterations_size, run, &s_worker_states[thread_id]))
+            {
+                if (stack_size == run)
+                {
+                    finish_stack_iteration(next_pri, thread_id);
+                }
+
+                // deepest task first so the owner continues in stack order
+                task_deque_t* deque = &s_deques[thread_id];
+                deque_entry_t e = { {}, next_pri, iteration };
+                for (uint32_t i = stack_size - run + 1; i < stack_size; ++i)
+                {
+                    e.task = *stack_task(s, i);
+                    deque_push(deque, &e);
+                }
+                if (run > 1)
+                {
+                    // the rest can be stolen
+                    wake_workers();
+                }
+
+                entry->task = *stack_task(s, stack_size);
+                entry->stack = next_pri;
+                entry->iteration = iteration;
+                *stack = next_pri;
+                return true;
+            }
+
+            if (run)
+                continue; // lost the race for this stack, look again
+
+            if (allowed && stack_size && OUT_OF_ORDER_WINDOW && pick_out_of_order(s, iterations_size, &entry->task))
+            {
+                entry->stack = next_pri;
+                entry->iteration = iteration;
+                *stack = next_pri;
+                return true;
+            }
+
+            count(&s_worker_states[thread_id].contention[CC_BLOCKED_PICKS]);
+            next_pri = next_pri_stack(pri_mask, critical, local, num_words, main_stack);
+        }
+
+        // the next call loads the mask again
+        count(&s_worker_states[thread_id].contention[CC_MASK_RELOADS]);
+        return false;
+    }
+
+    // victims in the thief's domain first, their tasks' data is in a shared cache
+    bool steal_task(uint32_t thread_id, deque_entry_t* entry)
+    {
+        uint32_t domain = s_worker_domains[thread_id];
+        for (uint32_t pass = 0; pass < (s_num_domains > 1 ? 2u : 1u); ++pass)
+        {
+            for (uint32_t i = 1; i < NUM_WORKER_THREADS; ++i)
+            {
+                uint32_t victim = (thread_id + i) % NUM_WORKER_THREADS;
+                bool local = s_worker_domains[victim] == domain;
+                if (s_num_domains > 1 && local != (pass == 0))
+                    continue;
+                if (deque_steal(&s_deques[victim], entry))
+                    return true;
+            }
+        }
+
+        return false;
+    }
+
+    void worker_thread_stealing(uint32_t thread_id)
+    {
+        prof_sched_start(thread_id);
+
+        uint32_t stack = 0;
+        task_deque_t* deque = &s_deques[thread_id];
+        worker_state_t* state = &s_worker_states[thread_id];
+
+        while (!g_quit_request.load(std::memory_order_relaxed))
+        {
+            deque_entry_t entry;
+            if (resume_suspended(thread_id))
+            {
+                busy(state);
+            }
+            else if (deque_take(deque, &entry) || claim_tasks(thread_id, &stack, &entry) || steal_task(thread_id, &entry))
+            {
+                busy(state);
+                run_task(thread_id, entry.stack, entry.iteration, &entry.task);
+            }
+            else
+            {
+                idle(state);
+            }
+        }
+
+        if (state->idle_passes >= PARK_SPIN_COUNT)
+        {
+            s_num_parked.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t dont_do_it(void* args, uint32_t thread_id)
+    {
+        std::cout << "DONT DO IT !!!!" << std::endl;
+        uint32_t s = (uint64_t)args;
+        std::cout << s << " " << s_iterations[s] << std::endl;
+        return ECP_NONE;
+    }
+
+    uint64_t execute_range(void* args, uint32_t thread_id)
+    {
+        range_task_t* range = (range_task_t*) args;
+
+        uint32_t chunk;
+        while ((chunk = range->next_chunk.fetch_add(1, std::memory_order_relaxed)) < range->num_chunks)
+        {
+            uint32_t begin = range->begin + chunk * range->grain;
+            uint32_t end = std::min(begin + range->grain, range->end);
+            range->function(range->args, begin, end, thread_id);
+        }
+
+        uint64_t reached_checkpoint = ECP_NONE;
+        if (range->num_unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            reached_checkpoint = range->completion_checkpoint;
+
+        return reached_checkpoint;
+    }
+
+    uint64_t simulate_work(uint32_t amount)
+    {
+        uint64_t ret = 0;
+
+        for (uint32_t i = 0; i < amount; ++i)
+        {
+            ret += asm_rdtscp();
+        }
+
+        return ret;
+    }
+
+
+    uint32_t allocate_checkpoint(const char* name)
+    {
+        uint32_t checkpoint = s_num_checkpoints.fetch_add(1, std::memory_order_relaxed);
+        if (checkpoint >= MAX_CHECKPOINTS)
+        {
+            // an id past the checkpoint sets would be written out of bounds
+            std::cerr << "allocate_checkpoint: all " << MAX_CHECKPOINTS << " checkpoints are taken, "
+                      << "raise NUM_CHECKPOINT_WORDS for " << (name ? name : "an unnamed checkpoint") << std::endl;
+            abort();
+        }
+        s_checkpoint_names[checkpoint].store(name, std::memory_order_release);
+
+        return checkpoint;
+    }
+
+    void name_stack(uint32_t stack, const char* name)
+    {
+        s_stack_names[stack].store(name, std::memory_order_release);
+    }
+
+    task_dependencies_t dependencies(std::initializer_list<uint32_t> previous_frame,
+                                     std::initializer_list<uint32_t> current_frame)
+    {
+        task_dependencies_t d = {};
+        d = add_dependencies(d, 1, previous_frame);
+        d = add_dependencies(d, 0, current_frame);
+
+        return d;
+    }
+
+    task_dependencies_t with_flags(task_dependencies_t d, uint32_t flags)
+    {
+        d.flags |= flags;
+
+        return d;
+    }
+
+    task_dependencies_t add_dependencies(task_dependencies_t d, uint32_t frames_back,
+                                         std::initializer_list<uint32_t> checkpoints)
+    {
+        assert(frames_back < MAX_FRAMES_IN_FLIGHT);
+        for (uint32_t checkpoint : checkpoints)
+        {
+            if (checkpoint != ECP_NONE)
+            {
+                d.frames[frames_back].words[checkpoint / 64] |= (uint64_t) 1 << (checkpoint % 64);
+                d.frames_back = std::max(d.frames_back, frames_back);
+            }
+        }
+
+        return d;
+    }
+
+    // profiling functions
+    inline void open_thread_counters(uint32_t thread_id)
+    {
+        if (PERF_COUNTERS)
+        {
+            s_perf_available.fetch_and(open_perf_counters(&prof[thread_id].perf), std::memory_order_relaxed);
+        }
+    }
+
+    inline void close_thread_counters(uint32_t thread_id)
+    {
+        if (PERF_COUNTERS)
+        {
+            close_perf_counters(&prof[thread_id].perf);
+        }
+    }
+
+    // the level is read once per task, when picking starts, so a switch never
+    // leaves a task half recorded. below that a single well-predicted branch
+    inline void prof_sched_start(uint32_t thread_id)
+    {
+        uint32_t level = s_profiling_level.load(std::memory_order_relaxed);
+        prof[thread_id].level = level;
+        if (level != PL_OFF)
+        {
+            prof[thread_id].sched_start = clock_ticks();
+            for (uint32_t i = 0; i < NUM_CONTENTION_COUNTERS; ++i)
+            {
+                prof[thread_id].contention_start[i] = s_worker_states[thread_id].contention[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    inline void prof_sched_end_exec_start(uint32_t thread_id, uint32_t stack, task_t* task, uint64_t ticks)
+    {
+        if (prof[thread_id].level == PL_OFF)
+            return;
+
+        prof[thread_id].sched_end = ticks;
+        prof[thread_id].dependencies = task->dependencies;
+        prof[thread_id].stack = stack;
+        for (uint32_t i = 0; i < NUM_CONTENTION_COUNTERS; ++i)
+        {
+            uint64_t contention = s_worker_states[thread_id].contention[i].load(std::memory_order_relaxed);
+            prof[thread_id].contention[i] = (uint32_t) (contention - prof[thread_id].contention_start[i]);
+        }
+        if (PERF_COUNTERS)
+        {
+            prof[thread_id].perf_not_counted = read_perf_counters(&prof[thread_id].perf, prof[thread_id].perf_start);
+        }
+    }
+
+    inline void prof_exec_end(uint32_t thread_id, uint64_t reached_checkpoint, uint64_t ticks)
+    {
+        if (prof[thread_id].level == PL_OFF)
+            return;
+
+        prof[thread_id].exec_end = ticks;
+        if (PERF_COUNTERS)
+        {
+            // a group multiplexed out during the task missed part of it
+            uint64_t perf_end[NUM_PERF_COUNTERS];
+            uint64_t not_counted = read_perf_counters(&prof[thread_id].perf, perf_end);
+            prof[thread_id].perf_valid = not_counted != PERF_NOT_COUNTING && not_counted == prof[thread_id].perf_not_counted;
+            for (uint32_t i = 0; i < NUM_PERF_COUNTERS; ++i)
+            {
+                prof[thread_id].perf_counts[i] = prof[thread_id].perf_valid ? perf_end[i] - prof[thread_id].perf_start[i] : 0;
+            }
+        }
+        prof[thread_id].reached_checkpoint = reached_checkpoint;
+    }
+
+    inline void push_trace_event(uint32_t thread_id, uint32_t iteration)
+    {
+        trace_ring_t* ring = &s_trace_rings[thread_id];
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        if (head - ring->tail.load(std::memory_order_acquire) == TRACE_RING_SIZE)
+        {
+            ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+
+        trace_event_t* event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+        event->sched_start = prof[thread_id].sched_start;
+        event->sched_cycles = (uint32_t) std::min(prof[thread_id].sched_end - prof[thread_id].sched_start, (uint64_t) 0xFFFFFFFF);
+        event->exec_cycles = (uint32_t) std::min(prof[thread_id].exec_end - prof[thread_id].sched_end, (uint64_t) 0xFFFFFFFF);
+        event->dependencies = prof[thread_id].dependencies;
+        event->iteration = iteration;
+        event->stack = (uint16_t) prof[thread_id].stack;
+        event->reached_checkpoint = (uint16_t) prof[thread_id].reached_checkpoint;
+        for (uint32_t i = 0; i < NUM_CONTENTION_COUNTERS; ++i)
+        {
+            event->contention[i] = (uint16_t) std::min(prof[thread_id].contention[i], (uint32_t) 0xFFFF);
+        }
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+
+    inline void count_stack(uint32_t thread_id, uint32_t iteration)
+    {
+        uint32_t stack = prof[thread_id].stack;
+        stack_slot_t* slot = &s_stack_slots[(thread_id * PROFILING_ITERATIONS + iteration % PROFILING_ITERATIONS) * NUM_ACTIVE_STACKS + stack];
+        if (slot->iteration.load(std::memory_order_relaxed) != iteration)
+        {
+            // readers compare the iteration before and after reading the sums
+            slot->iteration.store(0xFFFFFFFF, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot->tasks.store(0, std::memory_order_relaxed);
+            slot->sched_ticks.store(0, std::memory_order_relaxed);
+            slot->exec_ticks.store(0, std::memory_order_relaxed);
+            slot->perf_tasks.store(0, std::memory_order_relaxed);
+            for (uint32_t i = 0; i < NUM_PERF_COUNTERS; ++i)
+            {
+                slot->perf[i].store(0, std::memory_order_relaxed);
+            }
+            for (uint32_t i = 0; i < NUM_CONTENTION_COUNTERS; ++i)
+            {
+                slot->contention[i].store(0, std::memory_order_relaxed);
+            }
+            slot->iteration.store(iteration, std::memory_order_release);
+        }
+
+        // only the owning thread writes, no read-modify-write needed
+        slot->tasks.store(slot->tasks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        slot->sched_ticks.store(slot->sched_ticks.load(std::memory_order_relaxed) + prof[thread_id].sched_end - prof[thread_id].sched_start, std::memory_order_relaxed);
+        slot->exec_ticks.store(slot->exec_ticks.load(std::memory_order_relaxed) + prof[thread_id].exec_end - prof[thread_id].sched_end, std::memory_order_relaxed);
+        if (PERF_COUNTERS)
+            slot->perf_tasks.store(slot->perf_tasks.load(std::memory_order_relaxed) + prof[thread_id].perf_valid, std::memory_order_relaxed);
+        for (uint32_t i = 0; PERF_COUNTERS && i < NUM_PERF_COUNTERS; ++i)
+        {
+            slot->perf[i].store(slot->perf[i].load(std::memory_order_relaxed) + prof[thread_id].perf_counts[i], std::memory_order_relaxed);
+        }
+        for (uint32_t i = 0; i < NUM_CONTENTION_COUNTERS; ++i)
+        {
+            slot->contention[i].store(slot->contention[i].load(std::memory_order_relaxed) + prof[thread_id].contention[i], std::memory_order_relaxed);
+        }
+    }
+
+    inline void prof_log(uint32_t thread_id, uint32_t iteration)
+    {
+        uint32_t level = prof[thread_id].level;
+        if (level == PL_OFF)
+            return;
+
+        count_stack(thread_id, iteration);
+        if (level < PL_TRACE)
+            return;
+
+        if (s_tracing.load(std::memory_order_acquire))
+        {
+            push_trace_event(thread_id, iteration);
+        }
+
+        uint32_t it = iteration % PROFILING_ITERATIONS;
+        uint32_t i = profiling_i[it][thread_id];
+        if (i == PROFILING_SIZE)
+            return; // log is only reset by the performance overlay
+        profiling_log[it][thread_id][i].sched_start = ticks_to_ns(prof[thread_id].sched_start) * 1e-3;
+        profiling_log[it][thread_id][i].sched_end = ticks_to_ns(prof[thread_id].sched_end) * 1e-3;
+        profiling_log[it][thread_id][i].exec_end = ticks_to_ns(prof[thread_id].exec_end) * 1e-3;
+        profiling_log[it][thread_id][i].rdtscp_sched = prof[thread_id].sched_end - prof[thread_id].sched_start;
+        profiling_log[it][thread_id][i].rdtscp_exec = prof[thread_id].exec_end - prof[thread_id].sched_end;
+        profiling_log[it][thread_id][i].stack = prof[thread_id].stack;
+        profiling_log[it][thread_id][i].dependencies = prof[thread_id].dependencies;
+        profiling_log[it][thread_id][i].reached_checkpoint = prof[thread_id].reached_checkpoint;
+        for (uint32_t k = 0; k < NUM_PERF_COUNTERS; ++k)
+        {
+            profiling_log[it][thread_id][i].counters[k] = PERF_COUNTERS ? (uint32_t) std::min(prof[thread_id].perf_counts[k], (uint64_t) 0xFFFFFFFF) : 0;
+        }
+        for (uint32_t k = 0; k < NUM_CONTENTION_COUNTERS; ++k)
+        {
+            profiling_log[it][thread_id][i].contention[k] = prof[thread_id].contention[k];
+        }
+
+        ++profiling_i[it][thread_id];
+    }
+
+    void write_trace_record(uint32_t type, const void* payload, uint32_t size)
+    {
+        static const uint64_t padding = 0;
+        MTrace::trace_record_t record = {type, size};
+        fwrite(&record, sizeof(record), 1, s_trace_file);
+        fwrite(payload, size, 1, s_trace_file);
+        fwrite(&padding, MTrace::record_padding(size), 1, s_trace_file);
+        g_trace_bytes.fetch_add(sizeof(record) + size + MTrace::record_padding(size), std::memory_order_relaxed);
+    }
+
+    void write_trace_name(uint32_t kind, uint32_t id, const char* name)
+    {
+        uint32_t length = strlen(name) + 1;
+        uint8_t payload[sizeof(MTrace::trace_name_t) + 256];
+        length = std::min(length, (uint32_t) sizeof(payload) - (uint32_t) sizeof(MTrace::trace_name_t));
+        MTrace::trace_name_t header = {kind, id};
+        memcpy(payload, &header, sizeof(header));
+        memcpy(payload + sizeof(header), name, length);
+        payload[sizeof(header) + length - 1] = '\0';
+        write_trace_record(MTrace::TR_NAME, payload, sizeof(header) + length);
+    }
+
+    uint32_t trace_dependencies_id(const task_dependencies_t* dependencies)
+    {
+        auto found = s_trace_dependency_ids.find(dependencies);
+        if (found != s_trace_dependency_ids.end())
+            return found->second;
+
+        MTrace::trace_dependencies_t record = {};
+        record.id = s_trace_dependency_ids.size();
+        record.flags = dependencies->flags;
+        record.frames_back = dependencies->frames_back;
+        for (uint32_t k = 0; k <= dependencies->frames_back; ++k)
+        {
+            std::copy(dependencies->frames[k].words, dependencies->frames[k].words + NUM_CHECKPOINT_WORDS, record.frames[k]);
+        }
+        write_trace_record(MTrace::TR_DEPENDENCIES, &record, sizeof(record));
+        s_trace_dependency_ids[dependencies] = record.id;
+
+        return record.id;
+    }
+
+    // names set since the last drain, then what the rings hold as one record
+    // per thread. flushed, so a reader mapping the file sees whole records
+    void drain_trace_rings()
+    {
+        for (uint32_t i = 0; i < NUM_STACKS; ++i)
+        {
+            const char* name = s_stack_names[i].load(std::memory_order_acquire);
+            if (name && !s_trace_stack_named[i])
+            {
+                write_trace_name(MTrace::TN_STACK, i, name);
+                s_trace_stack_named[i] = true;
+            }
+        }
+        for (uint32_t i = 0; i < MAX_CHECKPOINTS; ++i)
+        {
+            const char* name = s_checkpoint_names[i].load(std::memory_order_acquire);
+            if (name && !s_trace_checkpoint_named[i])
+            {
+                write_trace_name(MTrace::TN_CHECKPOINT, i, name);
+                s_trace_checkpoint_named[i] = true;
+            }
+        }
+
+        uint64_t events = 0;
+        uint64_t dropped = 0;
+        for (uint32_t thread = 0; thread < MAX_NUM_THREADS; ++thread)
+        {
+            trace_ring_t* ring = &s_trace_rings[thread];
+            uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            dropped += ring->dropped.load(std::memory_order_relaxed);
+            if (tail == head)
+                continue;
+
+            // dependencies records go ahead of the events record that uses them
+            const trace_event_t* first = &ring->events[tail & (TRACE_RING_SIZE - 1)];
+            MTrace::trace_events_t header = {thread, (uint32_t) (head - tail), first->sched_start, first->iteration, 0};
+            uint8_t* out = s_trace_buffer + sizeof(header);
+            MTrace::trace_event_t previous = {};
+            previous.sched_start = first->sched_start;
+            previous.iteration = first->iteration;
+            for (uint64_t i = tail; i != head; ++i)
+            {
+                const trace_event_t* pushed = &ring->events[i & (TRACE_RING_SIZE - 1)];
+                MTrace::trace_event_t event = {pushed->sched_start, pushed->sched_cycles, pushed->exec_cycles, pushed->stack,
+                                               pushed->iteration, pushed->reached_checkpoint, trace_dependencies_id(pushed->dependencies), {}};
+                for (uint32_t k = 0; k < NUM_CONTENTION_COUNTERS; ++k)
+                {
+                    event.contention[k] = pushed->contention[k];
+                }
+                out = MTrace::encode_event(out, &event, &previous);
+                previous = event;
+            }
+            ring->tail.store(head, std::memory_order_release);
+
+            header.bytes = out - s_trace_buffer - sizeof(header);
+            memcpy(s_trace_buffer, &header, sizeof(header));
+            write_trace_record(MTrace::TR_EVENTS, s_trace_buffer, out - s_trace_buffer);
+            events += header.num_events;
+        }
+        fflush(s_trace_file);
+
+        g_trace_events.fetch_add(events, std::memory_order_relaxed);
+        g_trace_dropped.store(dropped - s_trace_dropped_base, std::memory_order_relaxed);
+    }
+
+    void trace_loop()
+    {
+        while (!s_trace_quit.load(std::memory_order_relaxed))
+        {
+            drain_trace_rings();
+            std::this_thread::sleep_for(std::chrono::microseconds(TRACE_DRAIN_US));
+        }
+        drain_trace_rings();
+    }
+
+    bool start_tracing(const char* path)
+    {
+        if (s_trace_file)
+            return false;
+
+        FILE* file = fopen(path, "wb");
+        if (!file)
+            return false;
+
+        if (!s_trace_rings)
+        {
+            // new does not honour the cache line alignment in c++11
+            s_trace_rings = (trace_ring_t*) _mm_malloc(sizeof(trace_ring_t) * MAX_NUM_THREADS, 64);
+            s_trace_buffer = new uint8_t[sizeof(MTrace::trace_events_t) + TRACE_RING_SIZE * MTrace::MAX_EVENT_BYTES];
+            for (uint32_t i = 0; i < MAX_NUM_THREADS; ++i)
+            {
+                s_trace_rings[i].head.store(0, std::memory_order_relaxed);
+                s_trace_rings[i].dropped.store(0, std::memory_order_relaxed);
+                s_trace_rings[i].tail.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        // skip events pushed after a previous trace stopped
+        s_trace_dropped_base = 0;
+        for (uint32_t i = 0; i < MAX_NUM_THREADS; ++i)
+        {
+            s_trace_rings[i].tail.store(s_trace_rings[i].head.load(std::memory_order_acquire), std::memory_order_relaxed);
+            s_trace_dropped_base += s_trace_rings[i].dropped.load(std::memory_order_relaxed);
+        }
+        g_trace_events.store(0, std::memory_order_relaxed);
+        g_trace_dropped.store(0, std::memory_order_relaxed);
+        std::fill(s_trace_stack_named, s_trace_stack_named + NUM_STACKS, false);
+        std::fill(s_trace_checkpoint_named, s_trace_checkpoint_named + MAX_CHECKPOINTS, false);
+        s_trace_dependency_ids.clear();
+
+        MTrace::trace_header_t header = {MTrace::TRACE_MAGIC, MTrace::TRACE_VERSION, NUM_WORKER_THREADS, FRAMES_IN_FLIGHT,
+                                         clock_ticks(), monotonic_ns(), g_clock.ticks_per_ns};
+        fwrite(&header, sizeof(header), 1, file);
+        g_trace_bytes.store(sizeof(header), std::memory_order_relaxed);
+        s_trace_file = file;
+
+        s_trace_quit.store(false, std::memory_order_relaxed);
+        s_tracing.store(true, std::memory_order_release);
+        s_trace_thread = std::thread(trace_loop);
+
+        return true;
+    }
+
+    void stop_tracing()
+    {
+        if (!s_trace_file)
+            return;
+
+        // tasks finishing meanwhile may still land in the last drain
+        s_tracing.store(false, std::memory_order_relaxed);
+        s_trace_quit.store(true, std::memory_order_relaxed);
+        s_trace_thread.join();
+
+        MTrace::trace_end_t end = {clock_ticks(), monotonic_ns(), g_trace_events.load(std::memory_order_relaxed),
+                                   g_trace_dropped.load(std::memory_order_relaxed)};
+        write_trace_record(MTrace::TR_END, &end, sizeof(end));
+        fclose(s_trace_file);
+        s_trace_file = nullptr;
+    }
+
+    // sums the workers' counters under the sequence lock. the workers only
+    // pay for the counters they keep anyway
+    void publish_metrics()
+    {
+        MMetrics::metrics_block_t* block = s_metrics_block;
+        MMetrics::metrics_t* m = &block->metrics;
+
+        int64_t now = monotonic_ns();
+        uint32_t executed = g_total_executed.load(std::memory_order_relaxed);
+        uint64_t tasks = (uint32_t) (executed - s_metrics_executed); // g_total_executed wraps
+        double tasks_per_s = tasks * 1e9 / std::max(now - s_metrics_ns, (int64_t) 1);
+        s_metrics_executed = executed;
+        s_metrics_ns = now;
+        uint64_t contention[NUM_CONTENTION_COUNTERS];
+
+        MMetrics::begin_write(block);
+        m->published_ns = now;
+        m->tasks += tasks;
+        m->tasks_per_s = tasks_per_s;
+        m->frames = 0;
+        for (uint32_t i = 0; i < MMetrics::FRAME_TIME_BUCKETS; ++i)
+        {
+            m->frame_times[i] = s_frame_times[i].load(std::memory_order_relaxed);
+            m->frames += m->frame_times[i];
+        }
+        contention_counters(contention);
+        m->cas_retries = contention[CC_CAS_RETRIES];
+        m->main_stack_retries = contention[CC_MAIN_STACK_RETRIES];
+        m->blocked_picks = contention[CC_BLOCKED_PICKS];
+        m->mask_reloads = contention[CC_MASK_RELOADS];
+        m->arena_blocks_used = MMemory::blocks_in_use();
+        m->num_stacks = NUM_ACTIVE_STACKS;
+        for (uint32_t i = 0; i < NUM_ACTIVE_STACKS; ++i)
+        {
+            uint64_t iterations_size = s_stacks[i].iterations_size.load(std::memory_order_relaxed);
+            m->queue_depth[i] = (uint32_t) iterations_size & ~STACK_BUSY;
+            m->iterations[i] = (uint32_t) (iterations_size >> 32);
+            const char* name = s_stack_names[i].load(std::memory_order_relaxed);
+            strncpy(m->stack_names[i], name ? name : "", MMetrics::STACK_NAME_SIZE - 1);
+        }
+        MMetrics::end_write(block);
+    }
+
+    void metrics_loop()
+    {
+        while (!s_metrics_quit.load(std::memory_order_relaxed))
+        {
+            publish_metrics();
+            std::this_thread::sleep_for(std::chrono::microseconds(METRICS_PUBLISH_US));
+        }
+        publish_metrics();
+    }
+
+    bool start_metrics(const char* name)
+    {
+        if (s_metrics_block || strlen(name) >= sizeof(s_metrics_name))
+            return false;
+
+        s_metrics_block = MMetrics::create_metrics(name);
+        if (!s_metrics_block)
+            return false;
+        strcpy(s_metrics_name, name);
+
+        s_metrics_block->metrics.num_workers = NUM_WORKER_THREADS;
+        s_metrics_block->metrics.arena_blocks = MMemory::NUM_BLOCKS;
+        s_metrics_executed = g_total_executed.load(std::memory_order_relaxed);
+        s_metrics_ns = monotonic_ns();
+
+        s_metrics_quit.store(false, std::memory_order_relaxed);
+        s_metrics_thread = std::thread(metrics_loop);
+
+        return true;
+    }
+
+    void stop_metrics()
+    {
+        if (!s_metrics_block)
+            return;
+
+        s_metrics_quit.store(true, std::memory_order_relaxed);
+        s_metrics_thread.join();
+
+        MMetrics::destroy_metrics(s_metrics_block, s_metrics_name);
+        s_metrics_block = nullptr;
+    }
+
+    uint32_t perf_counters_available()
+    {
+        return s_perf_available.load(std::memory_order_relaxed);
+    }
+
+    void set_profiling_level(profiling_level_t level)
+    {
+        s_profiling_level.store(level, std::memory_order_relaxed);
+    }
+
+    profiling_level_t profiling_level()
+    {
+        return (profiling_level_t) s_profiling_level.load(std::memory_order_relaxed);
+    }
+
+    void stack_counters(uint32_t stack, uint32_t iteration, stack_counters_t* counters)
+    {
+        *counters = {};
+        for (uint32_t thread = 0; thread < MAX_NUM_THREADS; ++thread)
+        {
+            const stack_slot_t* slot = &s_stack_slots[(thread * PROFILING_ITERATIONS + iteration % PROFILING_ITERATIONS) * NUM_ACTIVE_STACKS + stack];
+            if (slot->iteration.load(std::memory_order_acquire) != iteration)
+                continue;
+
+            stack_counters_t c;
+            c.tasks = slot->tasks.load(std::memory_order_relaxed);
+            c.sched_ticks = slot->sched_ticks.load(std::memory_order_relaxed);
+            c.exec_ticks = slot->exec_ticks.load(std::memory_order_relaxed);
+            c.perf_tasks = slot->perf_tasks.load(std::memory_order_relaxed);
+            for (uint32_t i = 0; i < NUM_PERF_COUNTERS; ++i)
+            {
+                c.perf[i] = slot->perf[i].load(std::memory_order_relaxed);
+            }
+            for (uint32_t i = 0; i < NUM_CONTENTION_COUNTERS; ++i)
+            {
+                c.contention[i] = slot->contention[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->iteration.load(std::memory_order_relaxed) != iteration)
+                continue; // started over meanwhile
+
+            counters->tasks += c.tasks;
+            counters->sched_ticks += c.sched_ticks;
+            counters->exec_ticks += c.exec_ticks;
+            counters->perf_tasks += c.perf_tasks;
+            for (uint32_t i = 0; i < NUM_PERF_COUNTERS; ++i)
+            {
+                counters->perf[i] += c.perf[i];
+            }
+            for (uint32_t i = 0; i < NUM_CONTENTION_COUNTERS; ++i)
+            {
+                counters->contention[i] += c.contention[i];
+            }
+        }
+
+        // extrapolated to the tasks whose counters were multiplexed out
+        if (counters->perf_tasks && counters->perf_tasks < counters->tasks)
+        {
+            for (uint32_t i = 0; i < NUM_PERF_COUNTERS; ++i)
+            {
+                counters->perf[i] = (uint64_t) ((double) counters->perf[i] * counters->tasks / counters->perf_tasks);
+            }
+        }
+    }
+
+    void contention_counters(uint64_t* counters)
+    {
+        for (uint32_t i = 0; i < NUM_CONTENTION_COUNTERS; ++i)
+        {
+            counters[i] = 0;
+            for (uint32_t thread = 0; thread < MAX_NUM_THREADS; ++thread)
+            {
+                counters[i] += s_worker_states[thread].contention[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    double timestamp()
+    {
+        return clock_ns() * 1e-3;
     }
 }
@@ -1,106 +1,445 @@
 #pragma once
 
 #include "managers/Platform.h"
-
-#define PROFILING 1
+#include "managers/Trace.h"
 
 #include <atomic>
-#if PROFILING
+#include <algorithm>
+#include <initializer_list>
 #include <chrono>
-#endif
 
 namespace MTaskScheduling
 {
-    const uint32_t NUM_STACKS             = 16;
-    const uint32_t NUM_ACTIVE_STACKS      = 5;
-    const uint32_t STACK_SIZE             = 128;
+    const uint32_t NUM_STACKS             = 256; // multiple of 64
+    const uint32_t NUM_PRI_MASK_WORDS     = NUM_STACKS / 64;
+    extern uint32_t NUM_ACTIVE_STACKS;//      = 7;
+    const uint32_t STACK_SIZE             = 128; // first segment, power of two
+    const uint32_t STACK_SIZE_LOG2        = 7;
+    const uint32_t NUM_STACK_SEGMENTS     = 32 - STACK_SIZE_LOG2 + 1;
     extern uint32_t NUM_WORKER_THREADS;//     = MPlatform::NUM_HARDWARE_THREADS;
     const uint32_t MAX_NUM_WORKER_THREADS = 32;
-#if PROFILING
-    const uint32_t PROFILING_THREADS      = 8;
+    extern uint32_t MAX_EXECUTED_TASKS;//     = 10000000, shut down after this many tasks
+    const uint32_t DEQUE_SIZE             = 64;  // power of two
+    const uint32_t MAX_BATCH_SIZE         = 16;  // tasks claimed with a single CAS
+    const uint64_t BATCH_TARGET_CYCLES    = 20000; // batches grow until they take about this long
+    const uint32_t PARK_SPIN_COUNT        = 1000;  // failed passes over all stacks before a worker parks
+    const uint32_t RANGE_CHUNKS_PER_WORKER = 4;    // chunks per worker when a range task has no grain size
+    const uint32_t STACK_BUSY             = 0x80000000; // size bit, set while a task is taken out of order
+    extern uint32_t OUT_OF_ORDER_WINDOW;//    = 8, tasks below a blocked top that may be picked instead, 0 disables
+    extern bool CRITICAL_PATH_PRIORITY;//     = true, try stacks on the estimated critical path first
+    const uint32_t PATH_TABLE_SIZE        = 256; // task groups tracked by the critical path estimate, power of two
+    extern MPlatform::pinning_t WORKER_PINNING;// = PIN_NONE, set before init_scheduler
+    extern bool PERF_COUNTERS;//              = false, count hardware events per task (PL_COUNTERS), set before init_scheduler
+    const uint32_t MAX_DOMAINS            = 32;  // l3 domains that stacks are homed in
+    const uint32_t LANE_SIZE              = 64;  // tasks handed to a lane and not yet run, power of two
+    const uint32_t MAX_SUSPENDED_TASKS    = 256; // continuations waiting at once, multiple of 64
+
+    // threads outside the workers that run tasks with lane flags. workers pick
+    // these tasks as usual once their checkpoints are reached and hand them
+    // over. a lane runs its tasks in order with thread id NUM_WORKER_THREADS + lane
+    enum lane_t : uint32_t
+    {
+        LANE_MAIN,
+        LANE_BLOCKING,
+        NUM_LANES,
+    };
+    const uint32_t MAX_NUM_THREADS        = MAX_NUM_WORKER_THREADS + NUM_LANES; // thread ids tasks run with
+
+    enum scheduling_policy_t : uint32_t
+    {
+        SP_STACK_TOP,     // every worker pops stack tops with a CAS
+        SP_WORK_STEALING, // workers claim runs of stack tops into their own deque, idle workers steal
+    };
+    extern scheduling_policy_t SCHEDULING_POLICY;// = SP_STACK_TOP, set before init_scheduler
+    const uint32_t MAX_FRAMES_IN_FLIGHT   = 4;
+    extern uint32_t FRAMES_IN_FLIGHT;//       = 2, in [2, MAX_FRAMES_IN_FLIGHT], set before init_scheduler
+
+    // what the threads record about each task, switched at runtime by
+    // set_profiling_level. every level includes the ones before it
+    enum profiling_level_t : uint32_t
+    {
+        PL_OFF,      // one branch per task
+        PL_COUNTERS, // per stack and iteration sums: tasks, clock ticks, hardware counters
+        PL_TRACE,    // every task in the overlay log and, while tracing, the trace file
+    };
+    // what picking a task cost beyond a single CAS. every thread counts its
+    // own, profiling attributes them to the task the pick ends with
+    enum contention_counter_t : uint32_t
+    {
+        CC_CAS_RETRIES,        // claims of stack tops lost to another thread, the CAS on iterations_size
+        CC_MAIN_STACK_RETRIES, // updates of the main stack lost to another thread, the CAS on s_main_stack_iteration
+        CC_BLOCKED_PICKS,      // stack tops found waiting for checkpoints or another round
+        CC_MASK_RELOADS,       // every top in the priority mask was blocked and the mask was loaded again
+        NUM_CONTENTION_COUNTERS,
+    };
+    const uint32_t PROFILING_THREADS      = MAX_NUM_THREADS;
     const uint32_t PROFILING_SIZE         = 256;
-#endif
-
-    enum execution_checkpoint_t : uint64_t
-    {
-        ECP_NONE                         = 0,
-        ECP_INPUT1                       = ((uint64_t)1<<0),
-        ECP_PHYSICS1                     = ((uint64_t)1<<1),
-        ECP_PHYSICS2                     = ((uint64_t)1<<2),
-        ECP_PHYSICS3                     = ((uint64_t)1<<3),
-        ECP_PHYSICS4                     = ((uint64_t)1<<4),
-        ECP_ANIMATION1                   = ((uint64_t)1<<5),
-        ECP_ANIMATION2                   = ((uint64_t)1<<6),
-        ECP_ANIMATION3                   = ((uint64_t)1<<7),
-        ECP_AI1                          = ((uint64_t)1<<8),
-        ECP_AI2                          = ((uint64_t)1<<9),
-        ECP_STREAMING1                   = ((uint64_t)1<<10),
-        ECP_STREAMING2                   = ((uint64_t)1<<11),
-        ECP_STREAMING3                   = ((uint64_t)1<<12),
-        ECP_STREAMING4                   = ((uint64_t)1<<13),
-        ECP_SOUND1                       = ((uint64_t)1<<14),
-        ECP_RENDERING1                   = ((uint64_t)1<<15),
-        ECP_RENDERING2                   = ((uint64_t)1<<16),
-        ECP_RENDERING3                   = ((uint64_t)1<<17),
-        ECP_RENDERING_WRITE_PERF_OVERLAY = ((uint64_t)1<<18),
-        ECP_RENDERING_PRESENT            = ((uint64_t)1<<19),
+    const uint32_t PROFILING_ITERATIONS   = 2 * MAX_FRAMES_IN_FLIGHT; // logs of the frames in flight and the finished ones
+    const uint32_t TRACE_RING_SIZE        = 8192; // events per thread, power of two
+    const uint32_t TRACE_DRAIN_US         = 1000; // the drain thread empties the rings this often
+    const uint32_t METRICS_PUBLISH_US     = 10000; // start_metrics updates the shared block this often
+
+    const uint32_t NUM_CHECKPOINT_WORDS   = 8;
+    const uint32_t MAX_CHECKPOINTS        = NUM_CHECKPOINT_WORDS * 64;
+
+    // checkpoint ids. the named checkpoints are reserved, the remaining ids
+    // up to MAX_CHECKPOINTS are handed out at runtime by allocate_checkpoint
+    enum execution_checkpoint_t : uint32_t
+    {
+        ECP_NONE = 0,
+        ECP_INPUT1,
+        ECP_PHYSICS1,
+        ECP_PHYSICS2,
+        ECP_PHYSICS3,
+        ECP_PHYSICS4,
+        ECP_ANIMATION1,
+        ECP_ANIMATION2,
+        ECP_ANIMATION3,
+        ECP_AI1,
+        ECP_AI2,
+        ECP_STREAMING1,
+        ECP_STREAMING2,
+        ECP_STREAMING3,
+        ECP_STREAMING4,
+        ECP_SOUND1,
+        ECP_RENDERING1,
+        ECP_RENDERING2,
+        ECP_RENDERING3,
+        ECP_RENDERING_WRITE_PERF_OVERLAY,
+        ECP_RENDERING_PRESENT,
+        NUM_NAMED_CHECKPOINTS,
     };
 
+    // one bit per checkpoint id
+    typedef struct checkpoint_set_t
+    {
+        uint64_t words[NUM_CHECKPOINT_WORDS];
+    } checkpoint_set_t;
+
+    enum task_flags_t : uint32_t
+    {
+        TF_NONE        = 0,
+        TF_BARRIER     = 1, // tasks below are not picked out of order while this task is on the stack
+        TF_MAIN_THREAD = 2, // runs on the thread in run_lane(LANE_MAIN), e.g. for window system calls
+        TF_BLOCKING    = 4, // runs on the thread in run_lane(LANE_BLOCKING), may block without stalling a worker
+    };
+
+    // checkpoints a task waits for. shared by all tasks of a group and kept
+    // alive for as long as the tasks are recorded, typically in static storage.
+    // checkpoints further back than FRAMES_IN_FLIGHT - 1 frames count as reached,
+    // those frames are finished before the task's frame starts
+    typedef struct task_dependencies_t
+    {
+        checkpoint_set_t frames[MAX_FRAMES_IN_FLIGHT]; // frames[k]: checkpoints reached k frames back
+        uint32_t frames_back;                           // highest k with a required checkpoint
+        uint32_t flags;                                 // task_flags_t of the tasks sharing these dependencies
+    } task_dependencies_t;
+
     typedef struct task_t
     {
-        uint64_t (*execute)(void*, uint32_t);
+        uint64_t (*execute)(void*, uint32_t); // returns the reached checkpoint id or ECP_NONE
         void* args;
-        uint64_t checkpoints_previous_frame;
-        uint64_t checkpoints_current_frame;
+        const task_dependencies_t* dependencies;
     } task_t;
 
+    typedef void (*range_function_t)(void* args, uint32_t begin, uint32_t end, uint32_t thread_id);
+
+    // parallel for over [begin, end). recorded as up to NUM_WORKER_THREADS tasks
+    // that claim chunks of grain elements until the range is exhausted. the
+    // task that finishes last reaches completion_checkpoint. like dependencies
+    // it has to stay alive while recorded, typically in static storage
+    typedef struct range_task_t
+    {
+        range_function_t function;
+        void* args;
+        uint32_t begin;
+        uint32_t end;
+        uint32_t grain;
+        uint32_t num_chunks;
+        uint32_t completion_checkpoint;
+        ALIGN(64) std::atomic<uint32_t> next_chunk;
+        ALIGN(64) std::atomic<uint32_t> num_unfinished; // recorded tasks that have not returned
+    } range_task_t;
+
+    // tasks are stored in segments that double in size. segment 0 is the
+    // embedded tasks array, segment k > 0 holds tasks [STACK_SIZE << (k - 1), STACK_SIZE << k).
+    // segments are only added while recording and kept until clear_scheduler,
+    // so popping stays a single CAS on iterations_size however large the stack grows
     typedef struct task_stack_t
     {
         uint32_t index;
         uint32_t unpublished_size;
         std::atomic<uint64_t> iterations_size; // pack to guarantee conformity
+        uint32_t capacity;
+        uint32_t reordered; // tasks were taken out of order since the last replay, set under STACK_BUSY
+        task_t* segments[NUM_STACK_SEGMENTS];
         ALIGN(32) task_t tasks[STACK_SIZE];
     } ALIGN(64) task_stack_t;
 
+    // a recording saved once and replayed every frame instead of recording the
+    // same tasks again. out of order picks shift tasks within the stack, so the
+    // tasks are kept here and copied back only after that happened. args are
+    // patched in place, or swapped with patch_task_args
+    typedef struct task_recording_t
+    {
+        task_t* tasks;           // tasks[i] is stack task i, tasks[0] is unused
+        uint32_t size;           // unpublished_size when saved
+        uint32_t num_ranges;
+        range_task_t** ranges;   // reset on replay
+        uint32_t* range_tasks;   // tasks recorded per range
+        bool patched;            // args were swapped since the last replay
+    } task_recording_t;
+
+    typedef struct
+    {
+        task_t task;
+        uint32_t stack;
+        uint32_t iteration;
+    } deque_entry_t;
+
+    typedef struct
+    {
+        std::atomic<uint32_t> sequence; // position the entry is free for, or position + 1 once written
+        deque_entry_t entry;
+    } lane_entry_t;
+
+    // bounded multi producer queue, only run_lane consumes
+    typedef struct task_lane_t
+    {
+        ALIGN(64) std::atomic<uint32_t> head;     // next position to push
+        ALIGN(64) std::atomic<uint32_t> tail;     // next position to run
+        std::atomic<uint32_t> sleeping;
+        std::atomic<uint32_t> wake_epoch;
+        ALIGN(64) lane_entry_t entries[LANE_SIZE];
+    } task_lane_t;
+
+    // signaled from any thread, e.g. when an I/O request completes, to resume
+    // the continuations suspended on it
+    typedef struct task_event_t
+    {
+        std::atomic<uint32_t> signaled;
+    } task_event_t;
+
+    // continuation of a suspended task. resumed in the suspending task's frame
+    // once its dependencies are reached there and its event, if any, is signaled
+    typedef struct
+    {
+        task_t task;
+        uint32_t stack;
+        uint32_t iteration;
+        task_event_t* event;
+    } suspended_task_t;
+
+    typedef struct task_deque_t
+    {
+        ALIGN(64) std::atomic<int64_t> top;    // stolen from
+        ALIGN(64) std::atomic<int64_t> bottom; // pushed and taken by the owner
+        ALIGN(64) deque_entry_t entries[DEQUE_SIZE];
+    } task_deque_t;
+
+    typedef struct
+    {
+        ALIGN(64) uint64_t avg_task_cycles;
+        uint32_t batch_size;
+        uint32_t idle_passes;
+        uint32_t wake_epoch;
+        uint32_t running_stack;     // of the executing task, for suspend_task
+        uint32_t running_iteration;
+        uint64_t woken_ticks;       // clock_ticks of the wake that ended the last park, 0 once it picked
+        std::atomic<uint64_t> contention[NUM_CONTENTION_COUNTERS]; // only written by the owning thread
+    } worker_state_t;
+
     extern ALIGN(64) task_stack_t*         s_stacks;
     extern ALIGN(64) std::atomic<uint32_t> s_iterations[NUM_STACKS];
     extern std::atomic<uint32_t>           g_quit_request;
     extern std::atomic<uint32_t>           g_total_executed;
+    extern std::atomic<uint32_t>           s_num_parked;
+    extern std::atomic<uint64_t>           g_total_parks;
+    extern std::atomic<uint64_t>           g_total_wakes;
+    extern std::atomic<uint64_t>           g_total_wake_latency_ticks; // from wake_parked_workers to the woken worker's next pick
+    extern std::atomic<uint64_t>           g_total_woken_picks;        // samples in g_total_wake_latency_ticks
+    extern std::atomic<uint64_t>           g_total_out_of_order;
+    extern std::atomic<uint64_t>           g_total_suspended;
+    extern ALIGN(64) std::atomic<uint32_t> s_num_suspended;
+    extern std::atomic<uint64_t>           g_critical_path_cycles;
+    extern std::atomic<uint64_t>           g_trace_events;  // written to the trace file
+    extern std::atomic<uint64_t>           g_trace_dropped; // lost to full trace rings
+    extern std::atomic<uint64_t>           g_trace_bytes;   // size of the trace file
+    extern const task_dependencies_t       no_dependencies;
 
-#if PROFILING
     typedef struct
     {
         double sched_start;
         double sched_end;
         double exec_end;
-        uint64_t rdtscp_sched;
+        uint64_t rdtscp_sched; // MPlatform clock ticks
         uint64_t rdtscp_exec;
         uint32_t stack;
-        uint64_t checkpoints_previous_frame;
-        uint64_t checkpoints_current_frame;
-        uint64_t reached_checkpoints;
+        const task_dependencies_t* dependencies;
+        uint64_t reached_checkpoint;
+        uint32_t counters[MPlatform::NUM_PERF_COUNTERS]; // during the task, 0 without PERF_COUNTERS or when multiplexed out
+        uint32_t contention[NUM_CONTENTION_COUNTERS];    // while picking the task
     } profiling_item_t;
 
-    extern uint32_t profiling_i[4][PROFILING_THREADS];
-    extern profiling_item_t profiling_log[4][PROFILING_THREADS][PROFILING_SIZE];
-#endif
+    // the tasks of one stack in one iteration, summed over the threads
+    typedef struct
+    {
+        uint64_t tasks;
+        uint64_t sched_ticks; // MPlatform clock ticks spent picking the tasks
+        uint64_t exec_ticks;
+        uint64_t perf[MPlatform::NUM_PERF_COUNTERS]; // 0 without PERF_COUNTERS, scaled up from perf_tasks
+        uint64_t perf_tasks;                         // tasks whose counters ran throughout
+        uint64_t contention[NUM_CONTENTION_COUNTERS]; // while picking the tasks
+    } stack_counters_t;
+
+    // a thread's share of a stack_counters_t. the owning thread starts over
+    // when it runs a task of a later iteration
+    typedef struct
+    {
+        std::atomic<uint32_t> iteration;
+        std::atomic<uint64_t> tasks;
+        std::atomic<uint64_t> sched_ticks;
+        std::atomic<uint64_t> exec_ticks;
+        std::atomic<uint64_t> perf[MPlatform::NUM_PERF_COUNTERS];
+        std::atomic<uint64_t> perf_tasks;
+        std::atomic<uint64_t> contention[NUM_CONTENTION_COUNTERS];
+    } stack_slot_t;
+
+    extern uint32_t profiling_i[PROFILING_ITERATIONS][PROFILING_THREADS];
+    extern profiling_item_t profiling_log[PROFILING_ITERATIONS][PROFILING_THREADS][PROFILING_SIZE];
+
+    // continuous tracing. every thread pushes an event per task into its own
+    // ring, a drain thread encodes them and appends them to the trace file, see
+    // MTrace for the format. events of full rings are dropped and counted
+    typedef struct
+    {
+        uint64_t sched_start;   // clock ticks, picking began
+        const task_dependencies_t* dependencies;
+        uint32_t sched_cycles;
+        uint32_t exec_cycles;   // saturated at 2^32 - 1
+        uint32_t iteration;
+        uint16_t stack;
+        uint16_t reached_checkpoint;
+        uint16_t contention[NUM_CONTENTION_COUNTERS]; // saturated at 2^16 - 1
+    } trace_event_t;
+
+    // single producer, the owning thread, and single consumer, the drain thread
+    typedef struct trace_ring_t
+    {
+        ALIGN(64) std::atomic<uint64_t> head;
+        std::atomic<uint64_t> dropped;
+        ALIGN(64) std::atomic<uint64_t> tail;
+        ALIGN(64) trace_event_t events[TRACE_RING_SIZE];
+    } trace_ring_t;
 
 
     void init_scheduler();
     void clear_scheduler();
     void worker_thread(uint32_t);
+    void worker_thread_stealing(uint32_t);
+    void wake_parked_workers();
+    void run_lane(uint32_t lane); // returns on shutdown
+    void wake_lanes();
+    // called from a running task instead of blocking on a wait. the task returns
+    // right after, and continuation runs on a worker once its dependencies are
+    // reached in the task's frame and event (nullptr for none) is signaled. its
+    // reached checkpoint counts for that frame, so the stack's submit task has
+    // to wait for it like for any other task of the stack. false when all
+    // MAX_SUSPENDED_TASKS slots are taken, nothing is queued then and the task
+    // has to block on its wait and do the continuation's work itself
+    bool suspend_task(uint32_t thread_id, task_t continuation, task_event_t* event = nullptr);
+    bool resume_suspended(uint32_t thread_id); // runs one continuation whose wait is over
+    void signal_event(task_event_t*);
+    void update_pri_mask(uint32_t thread_id);
+    void publish_pri_mask(uint64_t);
+    void update_critical_path();
     uint64_t dont_do_it(void*, uint32_t);
+    uint64_t execute_range(void*, uint32_t);
     uint64_t simulate_work(uint32_t amount = 10e3);
+    // names show up in traces and have to stay alive, typically string literals
+    uint32_t allocate_checkpoint(const char* name = nullptr);
+    void name_stack(uint32_t stack, const char* name);
+    task_dependencies_t dependencies(std::initializer_list<uint32_t> previous_frame,
+                                     std::initializer_list<uint32_t> current_frame);
+    task_dependencies_t add_dependencies(task_dependencies_t, uint32_t frames_back,
+                                         std::initializer_list<uint32_t> checkpoints);
+    task_dependencies_t with_flags(task_dependencies_t, uint32_t flags);
+
+    inline task_t* stack_task(task_stack_t* stack, uint32_t i)
+    {
+        uint32_t b = MPlatform::asm_bsr32(i | (STACK_SIZE - 1));
+        uint32_t first = (1 << b) & ~(STACK_SIZE - 1); // first task in segment
+        return &stack->segments[b - STACK_SIZE_LOG2 + 1][i - first];
+    }
 
     inline void begin_task_recording(task_stack_t* stack)
     {
         stack->unpublished_size = 1;
     };
 
-    inline void record_task(task_stack_t* stack, task_t task)
+    void grow_task_stack(task_stack_t*);
+
+    // returns the index of the task, for patch_task_args
+    inline uint32_t record_task(task_stack_t* stack, task_t task)
+    {
+        if (stack->unpublished_size == stack->capacity)
+            grow_task_stack(stack);
+
+        *stack_task(stack, stack->unpublished_size) = task;
+        return stack->unpublished_size++;
+    }
+
+    inline uint32_t range_grain(uint32_t begin, uint32_t end, uint32_t grain)
     {
-        stack->tasks[stack->unpublished_size] = task;
-        ++stack->unpublished_size;
+        uint32_t auto_grain = (end - begin) / (NUM_WORKER_THREADS * RANGE_CHUNKS_PER_WORKER);
+        return grain ? grain : std::max(auto_grain, (uint32_t) 1);
+    }
+
+    // number of tasks record_range_task records
+    inline uint32_t range_task_count(uint32_t begin, uint32_t end, uint32_t grain)
+    {
+        grain = range_grain(begin, end, grain);
+        uint32_t num_chunks = (end - begin + grain - 1) / grain;
+        return std::max(std::min(num_chunks, NUM_WORKER_THREADS), (uint32_t) 1);
+    }
+
+    // grain 0 splits the range into RANGE_CHUNKS_PER_WORKER chunks per worker
+    inline void record_range_task(task_stack_t* stack, range_task_t* range,
+                                  range_function_t function, void* args,
+                                  uint32_t begin, uint32_t end, uint32_t grain,
+                                  uint32_t completion_checkpoint, const task_dependencies_t* dependencies)
+    {
+        range->function = function;
+        range->args = args;
+        range->begin = begin;
+        range->end = end;
+        range->grain = range_grain(begin, end, grain);
+        range->num_chunks = (end - begin + range->grain - 1) / range->grain;
+        range->completion_checkpoint = completion_checkpoint;
+
+        uint32_t num_tasks = range_task_count(begin, end, grain);
+        range->next_chunk.store(0, std::memory_order_relaxed);
+        range->num_unfinished.store(num_tasks, std::memory_order_relaxed);
+        for (uint32_t i = 0; i < num_tasks; ++i)
+        {
+            record_task(stack, {execute_range, range, dependencies});
+        }
+    }
+
+    // call after making work available (new tasks, reached checkpoints, shutdown)
+    inline void wake_workers()
+    {
+        // order the preceding store before reading the number of parked workers
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (s_num_parked.load(std::memory_order_relaxed))
+        {
+            wake_parked_workers();
+        }
+    }
+
+    inline void reset_event(task_event_t* event)
+    {
+        event->signaled.store(0, std::memory_order_relaxed);
     }
 
     inline void submit_task_recording(task_stack_t* stack)
@@ -108,13 +447,71 @@ namespace MTaskScheduling
         // pack to guarantee conformity between num stack iterations and stack size
         uint64_t iterations_size = (uint64_t) s_iterations[stack->index] << 32 | (stack->unpublished_size - 1);
         stack->iterations_size.store(iterations_size, std::memory_order_release);
+        wake_workers();
+    }
+
+    // a system records its tasks once at init and saves them here. from then on
+    // its submit task calls replay_task_recording every frame instead of
+    // recording. call after recording, before submit_task_recording
+    void save_task_recording(task_stack_t*, task_recording_t*);
+    void clear_task_recording(task_recording_t*);
+
+    inline void patch_task_args(task_recording_t* recording, uint32_t index, void* args)
+    {
+        recording->tasks[index].args = args;
+        recording->patched = true;
+    }
+
+    // from the submit task, in place of recording. the stack is empty by then,
+    // so no worker reads the tasks while they are copied back
+    inline void replay_task_recording(task_stack_t* stack, task_recording_t* recording)
+    {
+        for (uint32_t i = 0; i < recording->num_ranges; ++i)
+        {
+            recording->ranges[i]->next_chunk.store(0, std::memory_order_relaxed);
+            recording->ranges[i]->num_unfinished.store(recording->range_tasks[i], std::memory_order_relaxed);
+        }
+
+        if (stack->reordered || recording->patched)
+        {
+            for (uint32_t i = 1; i < recording->size; ++i)
+            {
+                *stack_task(stack, i) = recording->tasks[i];
+            }
+            stack->reordered = 0;
+            recording->patched = false;
+        }
+
+        stack->unpublished_size = recording->size;
+        submit_task_recording(stack);
     }
 
     // profiling functions
+    void open_thread_counters(uint32_t);
+    void close_thread_counters(uint32_t);
     void prof_sched_start(uint32_t);
-    void prof_sched_end_exec_start(uint32_t, uint32_t, task_t*);
-    void prof_exec_end(uint32_t, uint64_t);
+    void prof_sched_end_exec_start(uint32_t, uint32_t, task_t*, uint64_t ticks);
+    void prof_exec_end(uint32_t, uint64_t, uint64_t ticks);
     void prof_log(uint32_t, uint32_t);
-    void write_profiling();
-    double timestamp();
+    // any thread, any time. threads pick the level up with their next task
+    void set_profiling_level(profiling_level_t);
+    profiling_level_t profiling_level();
+    // after init_scheduler, stopped at the latest by clear_scheduler. events
+    // are only pushed at PL_TRACE. false when the file cannot be created
+    bool start_tracing(const char* path);
+    void stop_tracing();
+    // publishes MMetrics to the shared memory block name, e.g. "/gemini", from
+    // a thread of its own. after init_scheduler, stopped at the latest by
+    // clear_scheduler. false when the block cannot be created
+    bool start_metrics(const char* name);
+    void stop_metrics();
+    // bit per MPlatform::perf_counter_t every thread could open, 0 without PERF_COUNTERS
+    uint32_t perf_counters_available();
+    // all tasks of the threads, not only those picked at PL_COUNTERS and up
+    void contention_counters(uint64_t* counters);
+    // sums over the tasks a stack ran in an iteration at PL_COUNTERS and up.
+    // valid once the iteration is finished and for PROFILING_ITERATIONS
+    // iterations after
+    void stack_counters(uint32_t stack, uint32_t iteration, stack_counters_t*);
+    double timestamp(); // us since MPlatform::calibrate_clock
 }
@@ -0,0 +1,184 @@
+#include "managers/Trace.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+namespace MTrace
+{
+    bool open_trace(const char* path, trace_file_t* trace)
+    {
+        *trace = {};
+
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(trace_header_t))
+        {
+            close(fd);
+            return false;
+        }
+
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd); // the mapping keeps the file
+        if (data == MAP_FAILED)
+            return false;
+
+        trace->data = (const uint8_t*) data;
+        trace->size = st.st_size;
+        trace->header = (const trace_header_t*) data;
+        if (trace->header->magic != TRACE_MAGIC || trace->header->version != TRACE_VERSION)
+        {
+            close_trace(trace);
+            return false;
+        }
+
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+        for (const trace_record_t* record = next_record(trace, nullptr); record; record = next_record(trace, record))
+        {
+            if (record->type == TR_DEPENDENCIES && record->size == sizeof(trace_dependencies_t))
+            {
+                const trace_dependencies_t* dependencies = (const trace_dependencies_t*) record_payload(record);
+                trace->num_dependencies = std::max(trace->num_dependencies, dependencies->id + 1);
+            }
+        }
+        trace->dependencies = new const trace_dependencies_t*[trace->num_dependencies]();
+
+        for (const trace_record_t* record = next_record(trace, nullptr); record; record = next_record(trace, record))
+        {
+            if (record->type == TR_NAME && record->size > sizeof(trace_name_t))
+            {
+                const trace_name_t* name = (const trace_name_t*) record_payload(record);
+                const char* string = (const char*) (name + 1);
+                if (string[record->size - sizeof(trace_name_t) - 1] != '\0')
+                    continue;
+                if (name->kind == TN_STACK && name->id < MAX_STACK_IDS)
+                    trace->stack_names[name->id] = string;
+                else if (name->kind == TN_CHECKPOINT && name->id < MAX_CHECKPOINT_IDS)
+                    trace->checkpoint_names[name->id] = string;
+            }
+            else if (record->type == TR_DEPENDENCIES && record->size == sizeof(trace_dependencies_t))
+            {
+                const trace_dependencies_t* dependencies = (const trace_dependencies_t*) record_payload(record);
+                trace->dependencies[dependencies->id] = dependencies;
+            }
+            else if (record->type == TR_EVENTS)
+            {
+                const trace_events_t* events = (const trace_events_t*) record_payload(record);
+                trace->num_events += events->num_events;
+                trace->num_threads = std::max(trace->num_threads, events->thread + 1);
+            }
+            else if (record->type == TR_END && record->size >= sizeof(trace_end_t))
+            {
+                trace->end = (const trace_end_t*) record_payload(record);
+            }
+        }
+
+        return true;
+    }
+
+    void close_trace(trace_file_t* trace)
+    {
+        if (trace->data)
+        {
+            munmap((void*) trace->data, trace->size);
+        }
+        delete[] trace->dependencies;
+        *trace = {};
+    }
+
+    const trace_record_t* next_record(const trace_file_t* trace, const trace_record_t* previous)
+    {
+        size_t offset = sizeof(trace_header_t);
+        if (previous)
+        {
+            offset = (const uint8_t*) previous - trace->data + sizeof(trace_record_t) + previous->size + record_padding(previous->size);
+        }
+
+        if (offset + sizeof(trace_record_t) > trace->size)
+            return nullptr;
+
+        const trace_record_t* record = (const trace_record_t*) (trace->data + offset);
+        if (offset + sizeof(trace_record_t) + record->size > trace->size)
+            return nullptr; // cut off while written
+
+        if (record->type == TR_EVENTS)
+        {
+            const trace_events_t* events = (const trace_events_t*) record_payload(record);
+            if (record->size < sizeof(trace_events_t) || record->size != sizeof(trace_events_t) + events->bytes)
+                return nullptr;
+        }
+
+        return record;
+    }
+
+    // names are written by the program, escape them anyway
+    void write_json_string(FILE* out, const char* s)
+    {
+        fputc('"', out);
+        for (; *s; ++s)
+        {
+            if (*s == '"' || *s == '\\')
+                fputc('\\', out);
+            if ((unsigned char) *s >= 0x20)
+                fputc(*s, out);
+        }
+        fputc('"', out);
+    }
+
+    bool write_chrome_trace(const trace_file_t* trace, FILE* out)
+    {
+        const trace_header_t* header = trace->header;
+        double us_per_tick = 1e-3 / header->ticks_per_ns;
+
+        fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"gemini\"}}");
+        for (uint32_t thread = 0; thread < trace->num_threads; ++thread)
+        {
+            if (thread < header->num_workers)
+                fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"worker %u\"}}", thread, thread);
+            else
+                fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"lane %u\"}}", thread, thread - header->num_workers);
+        }
+
+        for_each_event(trace, [&](uint32_t thread, const trace_event_t& event)
+        {
+            double sched_start = (double) (int64_t) (event.sched_start - header->start_ticks) * us_per_tick;
+            double sched = event.sched_cycles * us_per_tick;
+            double exec = event.exec_cycles * us_per_tick;
+
+            fprintf(out, ",\n{\"name\":\"pick\",\"cat\":\"scheduling\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"args\":{\"cas_retries\":%u,\"main_stack_retries\":%u,\"blocked_picks\":%u,\"mask_reloads\":%u}}",
+                    thread, sched_start, sched, event.contention[0], event.contention[1], event.contention[2], event.contention[3]);
+
+            fprintf(out, ",\n{\"name\":");
+            const char* stack_name = event.stack < MAX_STACK_IDS ? trace->stack_names[event.stack] : nullptr;
+            if (stack_name)
+                write_json_string(out, stack_name);
+            else
+                fprintf(out, "\"stack %u\"", event.stack);
+            const trace_dependencies_t* dependencies = event.dependencies < trace->num_dependencies ? trace->dependencies[event.dependencies] : nullptr;
+            fprintf(out, ",\"cat\":\"task\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"iteration\":%u,\"flags\":%u",
+                    thread, sched_start + sched, exec, event.iteration, dependencies ? dependencies->flags : 0);
+            if (event.reached_checkpoint)
+            {
+                fprintf(out, ",\"checkpoint\":");
+                const char* checkpoint_name = event.reached_checkpoint < MAX_CHECKPOINT_IDS ? trace->checkpoint_names[event.reached_checkpoint] : nullptr;
+                if (checkpoint_name)
+                    write_json_string(out, checkpoint_name);
+                else
+                    fprintf(out, "\"checkpoint %u\"", event.reached_checkpoint);
+            }
+            fprintf(out, "}}");
+        });
+
+        fprintf(out, "\n]}\n");
+
+        return !ferror(out);
+    }
+}
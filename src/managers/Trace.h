@@ -0,0 +1,260 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+
+// the trace file written by MTaskScheduling::start_tracing. a header followed
+// by records that each start with a trace_record_t and are padded to 8 bytes:
+//   TR_NAME          names a stack or a checkpoint
+//   TR_DEPENDENCIES  checkpoints the tasks of a dependencies id wait for
+//   TR_EVENTS        a run of one thread's tasks, delta encoded
+// names and dependencies are written before the first task that uses them
+//   TR_END           written by stop_tracing, missing when the process died
+// a reader maps the file and walks the records by their sizes
+namespace MTrace
+{
+    const uint32_t TRACE_MAGIC        = 0x43525447; // "GTRC"
+    const uint32_t TRACE_VERSION      = 4;
+    const uint32_t MAX_STACK_IDS      = 256;
+    const uint32_t MAX_CHECKPOINT_IDS = 512;
+    const uint32_t CHECKPOINT_WORDS   = MAX_CHECKPOINT_IDS / 64;
+    const uint32_t MAX_FRAMES_BACK    = 4;
+    const uint32_t NUM_CONTENTION     = 4;          // MTaskScheduling::contention_counter_t: CAS retries, main
+                                                    // stack retries, blocked picks, mask reloads
+    const uint32_t MAX_EVENT_BYTES    = (8 + NUM_CONTENTION) * 10; // an encoded event at most, all varints
+
+    // a task as decoded from a trace
+    typedef struct
+    {
+        uint64_t sched_start;   // clock ticks, picking began
+        uint32_t sched_cycles;  // clock ticks, saturated at 2^32 - 1
+        uint32_t exec_cycles;
+        uint32_t stack;
+        uint32_t iteration;
+        uint32_t reached_checkpoint;
+        uint32_t dependencies;  // id of a TR_DEPENDENCIES record
+        uint32_t contention[NUM_CONTENTION]; // while picking the task
+    } trace_event_t;
+
+    typedef struct
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t num_workers;   // threads after them are the lanes
+        uint32_t frames_in_flight;
+        uint64_t start_ticks;   // clock ticks and CLOCK_MONOTONIC when tracing started
+        int64_t start_ns;
+        double ticks_per_ns;
+    } trace_header_t;
+
+    enum record_type_t : uint32_t
+    {
+        TR_NAME,
+        TR_DEPENDENCIES,
+        TR_EVENTS,
+        TR_END,
+    };
+
+    typedef struct
+    {
+        uint32_t type;
+        uint32_t size;          // of the payload that follows, without the padding
+    } trace_record_t;
+
+    enum name_kind_t : uint32_t
+    {
+        TN_STACK,
+        TN_CHECKPOINT,
+    };
+
+    // TR_NAME payload, followed by the zero terminated name
+    typedef struct
+    {
+        uint32_t kind;
+        uint32_t id;
+    } trace_name_t;
+
+    // TR_DEPENDENCIES payload. frames[k] holds the checkpoints reached k
+    // iterations before the task's own
+    typedef struct
+    {
+        uint32_t id;
+        uint32_t flags;         // task_flags_t
+        uint32_t frames_back;   // frames[frames_back + 1 ..] are empty
+        uint32_t padding;
+        uint64_t frames[MAX_FRAMES_BACK][CHECKPOINT_WORDS];
+    } trace_dependencies_t;
+
+    // TR_EVENTS payload, followed by num_events encoded events. each event is
+    // LEB128 varints: sched_start as zigzag delta to the previous event (the
+    // first to first_ticks), sched_cycles, exec_cycles, stack, iteration as
+    // zigzag delta to the previous event (the first to first_iteration),
+    // reached_checkpoint, dependencies, a bit per nonzero contention counter
+    // and those counters
+    typedef struct
+    {
+        uint32_t thread;
+        uint32_t num_events;
+        uint64_t first_ticks;
+        uint32_t first_iteration;
+        uint32_t bytes;         // of the encoded events
+    } trace_events_t;
+
+    // TR_END payload
+    typedef struct
+    {
+        uint64_t end_ticks;
+        int64_t end_ns;
+        uint64_t events;
+        uint64_t dropped;       // lost to full rings while tracing
+    } trace_end_t;
+
+    inline uint32_t record_padding(uint32_t size)
+    {
+        return (8 - (size & 7)) & 7;
+    }
+
+    inline uint8_t* write_varint(uint8_t* out, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            *out++ = (uint8_t) v | 0x80;
+            v >>= 7;
+        }
+        *out++ = (uint8_t) v;
+
+        return out;
+    }
+
+    inline const uint8_t* read_varint(const uint8_t* in, uint64_t* v)
+    {
+        uint64_t r = 0;
+        for (uint32_t shift = 0; ; shift += 7)
+        {
+            uint8_t b = *in++;
+            r |= (uint64_t) (b & 0x7F) << shift;
+            if (!(b & 0x80))
+                break;
+        }
+        *v = r;
+
+        return in;
+    }
+
+    inline uint64_t zigzag(int64_t v)
+    {
+        return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+    }
+
+    inline int64_t unzigzag(uint64_t v)
+    {
+        return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+    }
+
+    inline uint8_t* encode_event(uint8_t* out, const trace_event_t* event, const trace_event_t* previous)
+    {
+        out = write_varint(out, zigzag((int64_t) (event->sched_start - previous->sched_start)));
+        out = write_varint(out, event->sched_cycles);
+        out = write_varint(out, event->exec_cycles);
+        out = write_varint(out, event->stack);
+        out = write_varint(out, zigzag((int64_t) (int32_t) (event->iteration - previous->iteration)));
+        out = write_varint(out, event->reached_checkpoint);
+        out = write_varint(out, event->dependencies);
+
+        // usually none, one byte
+        uint32_t nonzero = 0;
+        for (uint32_t i = 0; i < NUM_CONTENTION; ++i)
+        {
+            nonzero |= (uint32_t) (event->contention[i] != 0) << i;
+        }
+        out = write_varint(out, nonzero);
+        for (uint32_t i = 0; i < NUM_CONTENTION; ++i)
+        {
+            if (event->contention[i])
+                out = write_varint(out, event->contention[i]);
+        }
+
+        return out;
+    }
+
+    // event holds the previous event and is overwritten with the next one
+    inline const uint8_t* decode_event(const uint8_t* in, trace_event_t* event)
+    {
+        uint64_t v;
+        in = read_varint(in, &v); event->sched_start += unzigzag(v);
+        in = read_varint(in, &v); event->sched_cycles = (uint32_t) v;
+        in = read_varint(in, &v); event->exec_cycles = (uint32_t) v;
+        in = read_varint(in, &v); event->stack = (uint32_t) v;
+        in = read_varint(in, &v); event->iteration += (uint32_t) unzigzag(v);
+        in = read_varint(in, &v); event->reached_checkpoint = (uint32_t) v;
+        in = read_varint(in, &v); event->dependencies = (uint32_t) v;
+
+        uint64_t nonzero;
+        in = read_varint(in, &nonzero);
+        for (uint32_t i = 0; i < NUM_CONTENTION; ++i)
+        {
+            event->contention[i] = 0;
+            if (nonzero & (1 << i))
+            {
+                in = read_varint(in, &v);
+                event->contention[i] = (uint32_t) v;
+            }
+        }
+
+        return in;
+    }
+
+    // a mapped trace. records past the end of a truncated file are ignored
+    typedef struct
+    {
+        const uint8_t* data;
+        size_t size;
+        const trace_header_t* header;
+        const trace_end_t* end;       // nullptr without TR_END
+        const char* stack_names[MAX_STACK_IDS];
+        const char* checkpoint_names[MAX_CHECKPOINT_IDS];
+        const trace_dependencies_t** dependencies; // by id, nullptr for ids without a record
+        uint32_t num_dependencies;
+        uint64_t num_events;
+        uint32_t num_threads;         // highest thread id with events + 1
+    } trace_file_t;
+
+    // false when the file can not be mapped or is no trace of this version
+    bool open_trace(const char* path, trace_file_t*);
+    void close_trace(trace_file_t*);
+
+    // nullptr as the previous record gives the first one. nullptr after the last
+    const trace_record_t* next_record(const trace_file_t*, const trace_record_t* previous);
+
+    inline const void* record_payload(const trace_record_t* record)
+    {
+        return record + 1;
+    }
+
+    // calls on_event(thread, event) for every task, in file order. the tasks of
+    // a thread are in order, threads interleave by drain
+    template <typename F>
+    void for_each_event(const trace_file_t* trace, F on_event)
+    {
+        for (const trace_record_t* record = next_record(trace, nullptr); record; record = next_record(trace, record))
+        {
+            if (record->type != TR_EVENTS)
+                continue;
+
+            const trace_events_t* events = (const trace_events_t*) record_payload(record);
+            const uint8_t* in = (const uint8_t*) (events + 1);
+            trace_event_t event = {};
+            event.sched_start = events->first_ticks;
+            event.iteration = events->first_iteration;
+            for (uint32_t i = 0; i < events->num_events; ++i)
+            {
+                in = decode_event(in, &event);
+                on_event(events->thread, event);
+            }
+        }
+    }
+
+    // chrome://tracing and Perfetto JSON, one slice per task and one per pick
+    bool write_chrome_trace(const trace_file_t*, FILE*);
+}
@@ -12,6 +12,7 @@ namespace SAI
 
     void init_ai(MTaskScheduling::task_stack_t*);
 
+    void record_tasks();
     uint64_t submit_tasks(void*, uint32_t);
 
     typedef struct
@@ -20,15 +21,7 @@ namespace SAI
     } independent_task_args_t;
     uint64_t independent_task(void*, uint32_t);
 
-    typedef struct
-    {
-        std::atomic<uint32_t>* counter;
-    } task_group1_args_t;
-    uint64_t task_group1(void*, uint32_t);
+    void task_group1(void*, uint32_t, uint32_t, uint32_t);
 
-    typedef struct
-    {
-        std::atomic<uint32_t>* counter;
-    } task_group2_args_t;
-    uint64_t task_group2(void*, uint32_t);
+    void task_group2(void*, uint32_t, uint32_t, uint32_t);
 }
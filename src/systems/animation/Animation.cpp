@@ -10,36 +10,33 @@ using namespace MTaskScheduling;
 namespace SAnimation
 {
     task_stack_t* task_stack;
+    task_recording_t recording;
     MMemory::LinearAllocator32kb task_args_memory;
 
     void init_animation(task_stack_t* assigned_task_stack)
     {
         task_stack = assigned_task_stack;
+        name_stack(task_stack->index, "animation");
         task_args_memory.Init();
-        submit_tasks(nullptr, 0);
+        record_tasks();
     }
 
-    std::atomic<uint32_t> num_executed_group1;
-    std::atomic<uint32_t> num_executed_group2;
-    std::atomic<uint32_t> num_executed_group3;
+    range_task_t group1_range;
+    range_task_t group2_range;
+    range_task_t group3_range;
 
-    uint64_t submit_tasks(void* args, uint32_t thread_id)
-    {
-        task_args_memory.Clear();
+    ALIGN(64) const task_dependencies_t submit_dependencies = dependencies({}, {ECP_ANIMATION3});
+    ALIGN(64) const task_dependencies_t group3_dependencies = dependencies({}, {ECP_ANIMATION2});
+    ALIGN(64) const task_dependencies_t group2_dependencies = dependencies({}, {ECP_INPUT1, ECP_ANIMATION1});
 
+    void record_tasks()
+    {
         begin_task_recording(task_stack);
 
-        record_task(task_stack, {submit_tasks, nullptr, ECP_NONE, ECP_ANIMATION3});
+        record_task(task_stack, {submit_tasks, nullptr, &submit_dependencies});
 
-        // 10 tasks in task group 3
-        num_executed_group3.store(9, std::memory_order_relaxed);
-        for (uint32_t i = 0; i < 10; ++i)
-        {
-            task_group3_args_t* args = new(task_args_memory) task_group3_args_t;
-            args->counter = &num_executed_group3;
-
-            record_task(task_stack, {task_group3, args, ECP_NONE, ECP_ANIMATION2});
-        }
+        // task group 3, 10 elements
+        record_range_task(task_stack, &group3_range, task_group3, nullptr, 0, 10, 0, ECP_ANIMATION3, &group3_dependencies);
 
         // 4 independent tasks
         for (uint32_t i = 0; i < 4; ++i)
@@ -47,18 +44,11 @@ namespace SAnimation
             independent_task_args_t* args = new(task_args_memory) independent_task_args_t;
             args->some_param = 42 - i;
 
-            record_task(task_stack, {independent_task, args, ECP_NONE, ECP_NONE});
+            record_task(task_stack, {independent_task, args, &no_dependencies});
         }
 
-        // 10 tasks in task group 2
-        num_executed_group2.store(9, std::memory_order_relaxed);
-        for (uint32_t i = 0; i < 10; ++i)
-        {
-            task_group2_args_t* args = new(task_args_memory) task_group2_args_t;
-            args->counter = &num_executed_group2;
-
-            record_task(task_stack, {task_group2, args, ECP_NONE, ECP_INPUT1 | ECP_ANIMATION1});
-        }
+        // task group 2, 10 elements
+        record_range_task(task_stack, &group2_range, task_group2, nullptr, 0, 10, 0, ECP_ANIMATION2, &group2_dependencies);
 
         // 4 independent tasks
         for (uint32_t i = 0; i < 4; ++i)
@@ -66,20 +56,19 @@ namespace SAnimation
             independent_task_args_t* args = new(task_args_memory) independent_task_args_t;
             args->some_param = 42 + i;
 
-            record_task(task_stack, {independent_task, args, ECP_NONE, ECP_NONE});
+            record_task(task_stack, {independent_task, args, &no_dependencies});
         }
 
-        // 10 tasks in task group 1
-        num_executed_group1.store(9, std::memory_order_relaxed);
-        for (uint32_t i = 0; i < 10; ++i)
-        {
-            task_group1_args_t* args = new(task_args_memory) task_group1_args_t;
-            args->counter = &num_executed_group1;
-
-            record_task(task_stack, {task_group1, args, ECP_NONE, ECP_NONE});
-        }
+        // task group 1, 10 elements
+        record_range_task(task_stack, &group1_range, task_group1, nullptr, 0, 10, 0, ECP_ANIMATION1, &no_dependencies);
 
+        save_task_recording(task_stack, &recording);
         submit_task_recording(task_stack);
+    }
+
+    uint64_t submit_tasks(void* args, uint32_t thread_id)
+    {
+        replay_task_recording(task_stack, &recording);
 
         return ECP_NONE;
     }
@@ -91,45 +80,27 @@ namespace SAnimation
         return ECP_NONE;
     }
 
-    uint64_t task_group1(void* args, uint32_t thread_id)
+    void task_group1(void* args, uint32_t begin, uint32_t end, uint32_t thread_id)
     {
-        task_group1_args_t* pargs = (task_group1_args_t*) args;
-
-        simulate_work();
-
-        uint32_t count = pargs->counter->fetch_sub(1, std::memory_order_release);
-        uint64_t reached_checkpoints = ECP_NONE;
-        if (count == 0)
-            reached_checkpoints = ECP_ANIMATION1;
-
-        return reached_checkpoints;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            simulate_work();
+        }
     }
 
-    uint64_t task_group2(void* args, uint32_t thread_id)
+    void task_group2(void* args, uint32_t begin, uint32_t end, uint32_t thread_id)
     {
-        task_group2_args_t* pargs = (task_group2_args_t*) args;
-
-        simulate_work();
-
-        uint32_t count = pargs->counter->fetch_sub(1, std::memory_order_release);
-        uint64_t reached_checkpoints = ECP_NONE;
-        if (count == 0)
-            reached_checkpoints = ECP_ANIMATION2;
-
-        return reached_checkpoints;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            simulate_work();
+        }
     }
 
-    uint64_t task_group3(void* args, uint32_t thread_id)
+    void task_group3(void* args, uint32_t begin, uint32_t end, uint32_t thread_id)
     {
-        task_group3_args_t* pargs = (task_group3_args_t*) args;
-
-        simulate_work();
-
-        uint32_t count = pargs->counter->fetch_sub(1, std::memory_order_release);
-        uint64_t reached_checkpoints = ECP_NONE;
-        if (count == 0)
-            reached_checkpoints = ECP_ANIMATION3;
-
-        return reached_checkpoints;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            simulate_work();
+        }
     }
 }
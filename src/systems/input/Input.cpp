@@ -6,8 +6,6 @@
 #include "data/Input.h"
 
 #include <iostream>
-#include <mutex>
-#include <condition_variable>
 
 #include <GLFW/glfw3.h>
 
@@ -16,57 +14,29 @@ using namespace MTaskScheduling;
 namespace SInput
 {
     task_stack_t* task_stack;
+    task_recording_t recording;
     MMemory::LinearAllocator32kb task_args_memory;
-    input_loop_sync_t input_loop_sync;
+    GLFWwindow* window;
 
     ALIGN(16) uint32_t key_events[NUM_KEY_STATES][8];
     uint32_t num_events[NUM_KEY_STATES];
     const uint32_t max_num_events[NUM_KEY_STATES] = {8, 8, 1, 8};
 
-    void init_input(task_stack_t* assigned_task_stack)
+    void init_input(task_stack_t* assigned_task_stack, GLFWwindow* input_window)
     {
         task_stack = assigned_task_stack;
+        name_stack(task_stack->index, "input");
+        window = input_window;
         task_args_memory.Init();
-        submit_tasks(nullptr, 0);
+        record_tasks();
     }
 
-    void input_loop(GLFWwindow* window)
+    // glfw only polls events on the main thread. it runs the input task in the main lane
+    void input_loop()
     {
         glfwSetKeyCallback(window, key_callback);
 
-        while (!MTaskScheduling::g_quit_request.load(std::memory_order_relaxed))
-        {
-            // wait for notification
-            std::unique_lock<std::mutex> l(input_loop_sync.m);
-            input_loop_sync.cv.wait(l, []{ return input_loop_sync.gather_input; });
-            input_loop_sync.gather_input = false;
-
-            // clear input structures
-            __m128i zero = _mm_setzero_si128(); // perhaps the compiler is better at this
-            _mm_store_si128((__m128i*) &key_events[0][0], zero);
-            _mm_store_si128((__m128i*) &key_events[0][4], zero);
-            _mm_store_si128((__m128i*) &key_events[1][0], zero);
-            _mm_store_si128((__m128i*) &key_events[1][4], zero);
-            _mm_store_si128((__m128i*) &key_events[2][0], zero);
-            _mm_store_si128((__m128i*) &key_events[2][4], zero);
-            num_events[0] = 0;
-            num_events[1] = 0;
-            num_events[2] = 0;
-
-            glfwPollEvents();
-
-            if (glfwWindowShouldClose(window))
-            {
-                l.unlock();
-                signal_shutdown();
-                return;
-            }
-
-            // notify completion
-            input_loop_sync.input_gathered = true;
-            l.unlock();
-            input_loop_sync.cv.notify_one();
-        }
+        run_lane(LANE_MAIN);
     }
 
     void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -75,34 +45,46 @@ namespace SInput
         num_events[action] = (num_events[action] + 1) & (max_num_events[action] - 1);
     }
 
-    uint64_t submit_tasks(void* args, uint32_t thread_id)
-    {
-        task_args_memory.Clear();
+    ALIGN(64) const task_dependencies_t submit_dependencies = dependencies({}, {ECP_INPUT1});
+    ALIGN(64) const task_dependencies_t input_dependencies = with_flags(dependencies({ECP_RENDERING_PRESENT}, {}), TF_MAIN_THREAD);
 
+    void record_tasks()
+    {
         begin_task_recording(task_stack);
 
-        record_task(task_stack, {submit_tasks, nullptr, ECP_NONE, ECP_INPUT1});
-        record_task(task_stack, {input_task, nullptr, ECP_RENDERING_PRESENT, ECP_NONE});
+        record_task(task_stack, {submit_tasks, nullptr, &submit_dependencies});
+        record_task(task_stack, {input_task, nullptr, &input_dependencies});
 
+        save_task_recording(task_stack, &recording);
         submit_task_recording(task_stack);
+    }
+
+    uint64_t submit_tasks(void* args, uint32_t thread_id)
+    {
+        replay_task_recording(task_stack, &recording);
 
         return ECP_NONE;
     }
 
     uint64_t input_task(void* args, uint32_t thread_id)
     {
-        // notify input loop
+        // clear input structures
+        __m128i zero = _mm_setzero_si128(); // perhaps the compiler is better at this
+        _mm_store_si128((__m128i*) &key_events[0][0], zero);
+        _mm_store_si128((__m128i*) &key_events[0][4], zero);
+        _mm_store_si128((__m128i*) &key_events[1][0], zero);
+        _mm_store_si128((__m128i*) &key_events[1][4], zero);
+        _mm_store_si128((__m128i*) &key_events[2][0], zero);
+        _mm_store_si128((__m128i*) &key_events[2][4], zero);
+        num_events[0] = 0;
+        num_events[1] = 0;
+        num_events[2] = 0;
+
+        glfwPollEvents();
+
+        if (glfwWindowShouldClose(window))
         {
-            std::unique_lock<std::mutex> l(input_loop_sync.m);
-            input_loop_sync.gather_input = true;
-            input_loop_sync.input_gathered = false;
-        }
-        input_loop_sync.cv.notify_one();
-
-        // wait for input
-        {
-            std::unique_lock<std::mutex> l(input_loop_sync.m);
-            input_loop_sync.cv.wait(l, []{ return input_loop_sync.input_gathered; });
+            signal_shutdown();
         }
 
         // add pressed keys as down
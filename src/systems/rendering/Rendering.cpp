@@ -16,67 +16,78 @@ struct GLFWwindow;
 namespace SRendering
 {
     task_stack_t* task_stack;
+    task_recording_t recording;
     MMemory::LinearAllocator32kb task_args_memory;
 
     void init_rendering(task_stack_t* assigned_task_stack, GLFWwindow* window)
     {
         task_stack = assigned_task_stack;
+        name_stack(task_stack->index, "rendering");
 
         init_vulkan(window);
 
         task_args_memory.Init();
-        submit_tasks(nullptr, 0);
+        record_tasks();
     }
 
     void clear_rendering()
     {
         clear_vulkan();
+        clear_task_recording(&recording);
     }
 
-    std::atomic<uint32_t> num_executed_group1;
-    std::atomic<uint32_t> num_executed_group2;
-    std::atomic<uint32_t> num_executed_group3;
+    range_task_t group1_range;
+    range_task_t group2_range;
+    range_task_t group3_range;
 
     std::atomic<double> perf_overlay_start_time;
     std::atomic<uint32_t> num_executed_perf_overlay;
     std::atomic<uint32_t> perf_overlay_write_offset;
+    write_perf_overlay_task_args_t* perf_overlay_args[MAX_NUM_WORKER_THREADS];
 
-    uint64_t submit_tasks(void* args, uint32_t thread_id)
+    ALIGN(64) const task_dependencies_t submit_dependencies = dependencies({}, {ECP_RENDERING_PRESENT});
+    // acquiring the next swapchain image may block
+    ALIGN(64) const task_dependencies_t present_dependencies = with_flags(dependencies({}, {ECP_RENDERING_WRITE_PERF_OVERLAY}), TF_BLOCKING);
+    ALIGN(64) const task_dependencies_t perf_overlay_dependencies = dependencies({}, {ECP_RENDERING3});
+    ALIGN(64) const task_dependencies_t group3_dependencies = dependencies({}, {ECP_RENDERING2});
+    ALIGN(64) const task_dependencies_t group2_dependencies = dependencies({}, {ECP_PHYSICS4, ECP_RENDERING1});
+    ALIGN(64) const task_dependencies_t group1_dependencies = dependencies({}, {ECP_INPUT1});
+
+    void patch_perf_overlay_args()
     {
-        task_args_memory.Clear();
+        num_executed_perf_overlay.store(NUM_WORKER_THREADS - 1, std::memory_order_relaxed);
+        perf_overlay_start_time.store(0, std::memory_order_relaxed);
+        perf_overlay_write_offset.store(0, std::memory_order_relaxed);
+        for (uint32_t i = 0; i < NUM_WORKER_THREADS; ++i)
+        {
+            perf_overlay_args[i]->iteration = s_iterations[task_stack->index];
+            perf_overlay_args[i]->buffer_memory = get_mapped_overlay_vertex_buffer();
+        }
+    }
 
+    void record_tasks()
+    {
         begin_task_recording(task_stack);
 
-        record_task(task_stack, {submit_tasks, nullptr, ECP_NONE, ECP_RENDERING_PRESENT});
-        record_task(task_stack, {present_task, nullptr, ECP_NONE, ECP_RENDERING_WRITE_PERF_OVERLAY});
+        record_task(task_stack, {submit_tasks, nullptr, &submit_dependencies});
+        record_task(task_stack, {present_task, nullptr, &present_dependencies});
 
-        // performance overlay task
-        num_executed_perf_overlay.store(NUM_WORKER_THREADS - 1, std::memory_order_relaxed);
-        perf_overlay_start_time.store(0, std::memory_order_relaxed);
-        perf_overlay_write_offset.store(0, std::memory_order_relaxed);
+        // performance overlay task, patched every frame
         for (uint32_t i = 0; i < NUM_WORKER_THREADS; ++i)
         {
             write_perf_overlay_task_args_t* args =  new(task_args_memory) write_perf_overlay_task_args_t;
             args->thread_log = i;
-            args->iteration = s_iterations[task_stack->index];
             args->start_time = &perf_overlay_start_time;
-            args->buffer_memory = get_mapped_overlay_vertex_buffer();
             args->write_offset = &perf_overlay_write_offset;
             args->counter = &num_executed_perf_overlay;
+            perf_overlay_args[i] = args;
 
-            record_task(task_stack, {write_perf_overlay_task, args, ECP_NONE, ECP_RENDERING3});
+            record_task(task_stack, {write_perf_overlay_task, args, &perf_overlay_dependencies});
         }
 
 
-        // 10 tasks in task group 3
-        num_executed_group3.store(9, std::memory_order_relaxed);
-        for (uint32_t i = 0; i < 10; ++i)
-        {
-            task_group3_args_t* args = new(task_args_memory) task_group3_args_t;
-            args->counter = &num_executed_group3;
-
-            record_task(task_stack, {task_group3, args, ECP_NONE, ECP_RENDERING2});
-        }
+        // task group 3, 10 elements
+        record_range_task(task_stack, &group3_range, task_group3, nullptr, 0, 10, 0, ECP_RENDERING3, &group3_dependencies);
 
         // 4 independent tasks
         for (uint32_t i = 0; i < 4; ++i)
@@ -84,18 +95,11 @@ namespace SRendering
             independent_task_args_t* args = new(task_args_memory) independent_task_args_t;
             args->some_param = 42 - i;
 
-            record_task(task_stack, {independent_task, args, ECP_NONE, ECP_NONE});
+            record_task(task_stack, {independent_task, args, &no_dependencies});
         }
 
-        // 10 tasks in task group 2
-        num_executed_group2.store(9, std::memory_order_relaxed);
-        for (uint32_t i = 0; i < 10; ++i)
-        {
-            task_group2_args_t* args = new(task_args_memory) task_group2_args_t;
-            args->counter = &num_executed_group2;
-
-            record_task(task_stack, {task_group2, args, ECP_NONE, ECP_PHYSICS4 | ECP_RENDERING1});
-        }
+        // task group 2, 10 elements
+        record_range_task(task_stack, &group2_range, task_group2, nullptr, 0, 10, 0, ECP_RENDERING2, &group2_dependencies);
 
         // 4 independent tasks
         for (uint32_t i = 0; i < 4; ++i)
@@ -103,18 +107,11 @@ namespace SRendering
             independent_task_args_t* args = new(task_args_memory) independent_task_args_t;
             args->some_param = 42 + i;
 
-            record_task(task_stack, {independent_task, args, ECP_NONE, ECP_NONE});
+            record_task(task_stack, {independent_task, args, &no_dependencies});
         }
 
-        // 10 tasks in task group 1
-        num_executed_group1.store(9, std::memory_order_relaxed);
-        for (uint32_t i = 0; i < 10; ++i)
-        {
-            task_group1_args_t* args = new(task_args_memory) task_group1_args_t;
-            args->counter = &num_executed_group1;
-
-            record_task(task_stack, {task_group1, args, ECP_NONE, ECP_INPUT1});
-        }
+        // task group 1, 10 elements
+        record_range_task(task_stack, &group1_range, task_group1, nullptr, 0, 10, 0, ECP_RENDERING1, &group1_dependencies);
 
         // 4 independent tasks
         for (uint32_t i = 0; i < 4; ++i)
@@ -122,10 +119,18 @@ namespace SRendering
             independent_task_args_t* args = new(task_args_memory) independent_task_args_t;
             args->some_param = 42 + i;
 
-            record_task(task_stack, {independent_task, args, ECP_NONE, ECP_NONE});
+            record_task(task_stack, {independent_task, args, &no_dependencies});
         }
 
+        patch_perf_overlay_args();
+        save_task_recording(task_stack, &recording);
         submit_task_recording(task_stack);
+    }
+
+    uint64_t submit_tasks(void* args, uint32_t thread_id)
+    {
+        patch_perf_overlay_args();
+        replay_task_recording(task_stack, &recording);
 
         return ECP_NONE;
     }
@@ -137,46 +142,28 @@ namespace SRendering
         return ECP_NONE;
     }
 
-    uint64_t task_group1(void* args, uint32_t thread_id)
+    void task_group1(void* args, uint32_t begin, uint32_t end, uint32_t thread_id)
     {
-        task_group1_args_t* pargs = (task_group1_args_t*) args;
-
-        simulate_work();
-
-        uint32_t count = pargs->counter->fetch_sub(1, std::memory_order_release);
-        uint64_t reached_checkpoints = ECP_NONE;
-        if (count == 0)
-            reached_checkpoints = ECP_RENDERING1;
-
-        return reached_checkpoints;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            simulate_work();
+        }
     }
 
-    uint64_t task_group2(void* args, uint32_t thread_id)
+    void task_group2(void* args, uint32_t begin, uint32_t end, uint32_t thread_id)
     {
-        task_group2_args_t* pargs = (task_group2_args_t*) args;
-
-        simulate_work();
-
-        uint32_t count = pargs->counter->fetch_sub(1, std::memory_order_release);
-        uint64_t reached_checkpoints = ECP_NONE;
-        if (count == 0)
-            reached_checkpoints = ECP_RENDERING2;
-
-        return reached_checkpoints;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            simulate_work();
+        }
     }
 
-    uint64_t task_group3(void* args, uint32_t thread_id)
+    void task_group3(void* args, uint32_t begin, uint32_t end, uint32_t thread_id)
     {
-        task_group3_args_t* pargs = (task_group3_args_t*) args;
-
-        simulate_work();
-
-        uint32_t count = pargs->counter->fetch_sub(1, std::memory_order_release);
-        uint64_t reached_checkpoints = ECP_NONE;
-        if (count == 0)
-            reached_checkpoints = ECP_RENDERING3;
-
-        return reached_checkpoints;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            simulate_work();
+        }
     }
 
     uint64_t write_perf_overlay_task(void* args, uint32_t thread_id)
@@ -184,7 +171,7 @@ namespace SRendering
         write_perf_overlay_task_args_t* pargs = (write_perf_overlay_task_args_t*) args;
 
         uint32_t thread_log = pargs->thread_log;
-        uint32_t it = (pargs->iteration - 2) & 0x03; // all task from two iterations ago are finished
+        uint32_t it = (pargs->iteration - FRAMES_IN_FLIGHT) % PROFILING_ITERATIONS; // all tasks from FRAMES_IN_FLIGHT iterations ago are finished
         uint32_t num_logged_items = profiling_i[it][thread_log];
         profiling_i[it][thread_log] = 0; // reset log
 
@@ -221,6 +208,8 @@ namespace SRendering
                 {0.7137f / 2.0f, 0.8431f       , 0.6588f / 2.0f},
                 {1.0000f       , 0.8980f       , 0.6000f / 2.0f},
                 {0.7059f       , 0.6549f / 2.0f, 0.8392f       },
+                {0.6000f / 2.0f, 0.8000f       , 0.8000f       },
+                {0.9000f       , 0.6000f       , 0.8000f       },
             };
 
             double total_sched_time = 0;
@@ -260,6 +249,33 @@ namespace SRendering
             {
                 std::cout << "Scheduling overhead: " << total_sched_time / total_exec_time << "\n";
                 std::cout << "Scheduling clock cycles: " << total_sched_clock_cycles / num_logged_items << "\n";
+
+                // sums of the frame the overlay shows, per system
+                uint64_t contention[NUM_CONTENTION_COUNTERS] = {};
+                for (uint32_t stack = 0; stack < NUM_ACTIVE_STACKS; ++stack)
+                {
+                    stack_counters_t c;
+                    stack_counters(stack, s_iterations[stack].load(std::memory_order_relaxed) - FRAMES_IN_FLIGHT, &c);
+                    std::cout << "Stack " << stack << ": " << c.tasks << " tasks, "
+                              << c.exec_ticks / MPlatform::g_clock.ticks_per_ns / 1e3 << " us, "
+                              << c.contention[CC_CAS_RETRIES] << " CAS retries, "
+                              << c.contention[CC_BLOCKED_PICKS] << " blocked picks";
+                    if (perf_counters_available())
+                    {
+                        std::cout << ", IPC " << (double) c.perf[MPlatform::PC_INSTRUCTIONS] / std::max(c.perf[MPlatform::PC_CYCLES], (uint64_t) 1) << ", "
+                                  << c.perf[MPlatform::PC_LLC_MISSES] << " LLC misses, "
+                                  << c.perf[MPlatform::PC_BRANCH_MISSES] << " branch misses";
+                    }
+                    std::cout << "\n";
+                    for (uint32_t i = 0; i < NUM_CONTENTION_COUNTERS; ++i)
+                    {
+                        contention[i] += c.contention[i];
+                    }
+                }
+                std::cout << "Frame: " << contention[CC_CAS_RETRIES] << " CAS retries, "
+                          << contention[CC_MAIN_STACK_RETRIES] << " main stack retries, "
+                          << contention[CC_BLOCKED_PICKS] << " blocked picks, "
+                          << contention[CC_MASK_RELOADS] << " mask reloads\n";
             }
         }
 
@@ -16,6 +16,7 @@ namespace SRendering
     void init_rendering(MTaskScheduling::task_stack_t*, GLFWwindow*);
     void clear_rendering();
 
+    void record_tasks();
     uint64_t submit_tasks(void*, uint32_t);
 
     typedef struct
@@ -24,23 +25,11 @@ namespace SRendering
     } independent_task_args_t;
     uint64_t independent_task(void*, uint32_t);
 
-    typedef struct
-    {
-        std::atomic<uint32_t>* counter;
-    } task_group1_args_t;
-    uint64_t task_group1(void*, uint32_t);
+    void task_group1(void*, uint32_t, uint32_t, uint32_t);
 
-    typedef struct
-    {
-        std::atomic<uint32_t>* counter;
-    } task_group2_args_t;
-    uint64_t task_group2(void*, uint32_t);
+    void task_group2(void*, uint32_t, uint32_t, uint32_t);
 
-    typedef struct
-    {
-        std::atomic<uint32_t>* counter;
-    } task_group3_args_t;
-    uint64_t task_group3(void*, uint32_t);
+    void task_group3(void*, uint32_t, uint32_t, uint32_t);
 
     typedef struct
     {
@@ -0,0 +1,613 @@
+#include "systems/sound/Sound.h"
+#include "managers/TaskScheduling.h"
+#include "managers/Platform.h"
+
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <unistd.h>      // usleep
+#include <mm_malloc.h>
+#include <emmintrin.h>   // SSE2
+#include <immintrin.h>   // AVX2
+
+using namespace MTaskScheduling;
+
+namespace SSound
+{
+    uint32_t LATENCY_FRAMES = 4096;
+
+    task_stack_t* task_stack;
+    task_recording_t recording;
+    sound_stats_t g_stats;
+
+    const uint32_t MIX_BLOCK_FRAMES = 256; // positions within a block are offsets from its first sample in float
+
+    typedef struct
+    {
+        const sound_t* sound;
+        double position;  // in source samples
+        float step;       // source samples per output frame
+        float gain_l;
+        float gain_r;
+        float target_l;   // reached at the end of the next mix
+        float target_r;
+        bool loop;
+        bool stopping;    // ramps to silence, then finishes
+        bool finished;    // set by the mix, the slot is freed by the next prepare task
+    } voice_t;
+
+    enum command_type_t : uint32_t
+    {
+        CMD_PLAY,
+        CMD_SET,
+        CMD_STOP,
+    };
+
+    typedef struct
+    {
+        command_type_t type;
+        uint32_t voice;
+        const sound_t* sound;
+        float gain_l;
+        float gain_r;
+        float step;
+        bool loop;
+    } command_t;
+
+    // commands and voice ids from any thread. a voice id is its slot in the low
+    // 16 bits and the slot's generation above, so stale ids do not touch new voices
+    std::mutex command_mutex;
+    command_t commands[MAX_COMMANDS];
+    uint32_t num_commands;
+    uint32_t free_slots[MAX_VOICES];
+    uint32_t num_free_slots;
+    uint32_t generations[MAX_VOICES];
+
+    // only touched by the sound tasks
+    voice_t voices[MAX_VOICES];
+    bool playing[MAX_VOICES];
+    uint32_t active[MAX_VOICES]; // slots mixed this frame
+    uint32_t num_active;
+    uint32_t mix_frames;         // this frame, a multiple of 16
+    uint32_t frame;
+    uint32_t lead_frames;        // ring fill the mix tops up to, follows the frame time
+    uint64_t last_read_frame;    // sink position at the previous prepare task
+
+    typedef struct
+    {
+        ALIGN(64) uint32_t mixed_frame; // the thread's buffer holds frame's mix
+        uint64_t voice_frames;
+        uint64_t mix_cycles;
+    } thread_mix_t;
+
+    thread_mix_t thread_mix[MAX_NUM_THREADS];
+    float* thread_buffers; // per thread MAX_MIX_FRAMES left samples, then MAX_MIX_FRAMES right samples
+
+    // single producer (output task), single consumer (sink thread)
+    ALIGN(64) float ring[RING_FRAMES * 2];
+    ALIGN(64) std::atomic<uint64_t> write_frame;
+    ALIGN(64) std::atomic<uint64_t> read_frame;
+
+    std::thread sink_thread;
+    std::atomic<bool> sink_quit;
+    FILE* wav_file;
+    uint64_t wav_frames;
+
+    uint32_t prepared_checkpoint;
+    uint32_t mixed_checkpoint;
+    range_task_t mix_range;
+
+    ALIGN(64) const task_dependencies_t submit_dependencies = dependencies({}, {ECP_SOUND1});
+    ALIGN(64) task_dependencies_t output_dependencies;
+    ALIGN(64) task_dependencies_t mix_dependencies;
+
+    inline float* left_buffer(uint32_t thread_id)
+    {
+        return thread_buffers + thread_id * 2 * MAX_MIX_FRAMES;
+    }
+
+    inline float* right_buffer(uint32_t thread_id)
+    {
+        return left_buffer(thread_id) + MAX_MIX_FRAMES;
+    }
+
+    // constant power
+    inline void pan_gains(float gain, float pan, float* l, float* r)
+    {
+        float angle = (std::min(std::max(pan, -1.0f), 1.0f) + 1.0f) * 0.25f * (float) M_PI;
+        *l = gain * cosf(angle);
+        *r = gain * sinf(angle);
+    }
+
+    void init_sound(task_stack_t* assigned_task_stack)
+    {
+        task_stack = assigned_task_stack;
+        name_stack(task_stack->index, "sound");
+        assert(LATENCY_FRAMES <= MAX_MIX_FRAMES);
+
+        thread_buffers = (float*) _mm_malloc(sizeof(float) * MAX_NUM_THREADS * 2 * MAX_MIX_FRAMES, 64);
+        for (uint32_t i = 0; i < MAX_NUM_THREADS; ++i)
+        {
+            thread_mix[i].mixed_frame = 0xFFFFFFFF;
+            thread_mix[i].voice_frames = 0;
+            thread_mix[i].mix_cycles = 0;
+        }
+
+        num_commands = 0;
+        num_free_slots = 0;
+        for (uint32_t i = MAX_VOICES; i-- > 0; )
+        {
+            free_slots[num_free_slots++] = i;
+            generations[i] = 0;
+            playing[i] = false;
+        }
+        num_active = 0;
+        mix_frames = 0;
+        frame = 0;
+        lead_frames = LATENCY_FRAMES;
+        last_read_frame = 0;
+
+        write_frame.store(0, std::memory_order_relaxed);
+        read_frame.store(0, std::memory_order_relaxed);
+        g_stats.voice_frames.store(0, std::memory_order_relaxed);
+        g_stats.mix_cycles.store(0, std::memory_order_relaxed);
+        g_stats.frames_mixed.store(0, std::memory_order_relaxed);
+        g_stats.frames_played.store(0, std::memory_order_relaxed);
+        g_stats.underruns.store(0, std::memory_order_relaxed);
+        g_stats.underrun_frames.store(0, std::memory_order_relaxed);
+
+        prepared_checkpoint = allocate_checkpoint("sound prepared");
+        mixed_checkpoint = allocate_checkpoint("sound mixed");
+        mix_dependencies = dependencies({}, {prepared_checkpoint});
+        output_dependencies = dependencies({}, {mixed_checkpoint});
+
+        record_tasks();
+    }
+
+    void clear_sound()
+    {
+        stop_sink();
+        _mm_free(thread_buffers);
+        clear_task_recording(&recording);
+    }
+
+    sound_t* create_sound(const float* samples, uint32_t num_samples, uint32_t sample_rate)
+    {
+        if (!num_samples)
+            return nullptr;
+
+        sound_t* sound = (sound_t*) malloc(sizeof(sound_t));
+        sound->samples = (float*) malloc(sizeof(float) * (num_samples + 2));
+        sound->num_samples = num_samples;
+        sound->sample_rate = sample_rate;
+        memcpy(sound->samples, samples, sizeof(float) * num_samples);
+        sound->samples[num_samples] = samples[0];
+        sound->samples[num_samples + 1] = samples[num_samples > 1 ? 1 : 0];
+
+        return sound;
+    }
+
+    void destroy_sound(sound_t* sound)
+    {
+        if (sound)
+            free(sound->samples);
+        free(sound);
+    }
+
+    uint32_t play(const sound_t* sound, float gain, float pan, float pitch, bool loop)
+    {
+        std::unique_lock<std::mutex> l(command_mutex);
+        if (!num_free_slots || num_commands == MAX_COMMANDS)
+            return INVALID_VOICE;
+
+        uint32_t slot = free_slots[--num_free_slots];
+        command_t* command = &commands[num_commands++];
+        command->type = CMD_PLAY;
+        command->voice = slot | generations[slot] << 16;
+        command->sound = sound;
+        command->step = pitch * sound->sample_rate / SAMPLE_RATE;
+        command->loop = loop;
+        pan_gains(gain, pan, &command->gain_l, &command->gain_r);
+
+        return command->voice;
+    }
+
+    void set_voice(uint32_t voice, float gain, float pan)
+    {
+        std::unique_lock<std::mutex> l(command_mutex);
+        if (num_commands == MAX_COMMANDS)
+            return;
+
+        command_t* command = &commands[num_commands++];
+        command->type = CMD_SET;
+        command->voice = voice;
+        pan_gains(gain, pan, &command->gain_l, &command->gain_r);
+    }
+
+    void stop(uint32_t voice)
+    {
+        std::unique_lock<std::mutex> l(command_mutex);
+        if (num_commands == MAX_COMMANDS)
+            return;
+
+        command_t* command = &commands[num_commands++];
+        command->type = CMD_STOP;
+        command->voice = voice;
+    }
+
+    static void write_wav_header(FILE* file, uint64_t num_frames)
+    {
+        uint32_t data_size = (uint32_t) std::min(num_frames * 4, (uint64_t) 0xFFFFFFD0);
+        uint32_t riff_size = 36 + data_size;
+        uint32_t fmt_size = 16;
+        uint16_t format = 1;
+        uint16_t channels = 2;
+        uint32_t rate = SAMPLE_RATE;
+        uint32_t byte_rate = SAMPLE_RATE * 4;
+        uint16_t block_align = 4;
+        uint16_t bits = 16;
+
+        fwrite("RIFF", 1, 4, file);
+        fwrite(&riff_size, 4, 1, file);
+        fwrite("WAVEfmt ", 1, 8, file);
+        fwrite(&fmt_size, 4, 1, file);
+        fwrite(&format, 2, 1, file);
+        fwrite(&channels, 2, 1, file);
+        fwrite(&rate, 4, 1, file);
+        fwrite(&byte_rate, 4, 1, file);
+        fwrite(&block_align, 2, 1, file);
+        fwrite(&bits, 2, 1, file);
+        fwrite("data", 1, 4, file);
+        fwrite(&data_size, 4, 1, file);
+    }
+
+    // stands in for the audio device, takes SINK_PERIOD_FRAMES per period in real time
+    static void sink_loop()
+    {
+        // start the clock with the first mix rather than with an underrun
+        while (!sink_quit.load(std::memory_order_relaxed) &&
+               write_frame.load(std::memory_order_acquire) == read_frame.load(std::memory_order_relaxed))
+        {
+            usleep(1000);
+        }
+
+        int16_t pcm[SINK_PERIOD_FRAMES * 2];
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t period = 1; !sink_quit.load(std::memory_order_relaxed); ++period)
+        {
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds(period * SINK_PERIOD_FRAMES * 1000000000ull / SAMPLE_RATE));
+
+            uint64_t r = read_frame.load(std::memory_order_relaxed);
+            uint32_t available = (uint32_t) std::min(write_frame.load(std::memory_order_acquire) - r, (uint64_t) SINK_PERIOD_FRAMES);
+
+            if (wav_file)
+            {
+                for (uint32_t i = 0; i < SINK_PERIOD_FRAMES * 2; ++i)
+                {
+                    float sample = i < available * 2 ? ring[((r + i / 2) & (RING_FRAMES - 1)) * 2 + (i & 1)] : 0.0f;
+                    pcm[i] = (int16_t) lrintf(sample * 32767.0f);
+                }
+                fwrite(pcm, sizeof(pcm), 1, wav_file);
+                wav_frames += SINK_PERIOD_FRAMES;
+            }
+
+            read_frame.store(r + available, std::memory_order_release);
+
+            g_stats.frames_played.fetch_add(SINK_PERIOD_FRAMES, std::memory_order_relaxed);
+            if (available < SINK_PERIOD_FRAMES)
+            {
+                g_stats.underruns.fetch_add(1, std::memory_order_relaxed);
+                g_stats.underrun_frames.fetch_add(SINK_PERIOD_FRAMES - available, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool start_sink(sink_t sink, const char* wav_path)
+    {
+        wav_file = nullptr;
+        wav_frames = 0;
+        if (sink == SINK_WAV)
+        {
+            wav_file = fopen(wav_path, "wb");
+            if (!wav_file)
+                return false;
+            write_wav_header(wav_file, 0);
+        }
+
+        sink_quit.store(false, std::memory_order_relaxed);
+        sink_thread = std::thread(sink_loop);
+
+        return true;
+    }
+
+    void stop_sink()
+    {
+        if (!sink_thread.joinable())
+            return;
+
+        sink_quit.store(true, std::memory_order_relaxed);
+        sink_thread.join();
+
+        if (wav_file)
+        {
+            fseek(wav_file, 0, SEEK_SET);
+            write_wav_header(wav_file, wav_frames);
+            fclose(wav_file);
+            wav_file = nullptr;
+        }
+    }
+
+    void record_tasks()
+    {
+        begin_task_recording(task_stack);
+
+        record_task(task_stack, {submit_tasks, nullptr, &submit_dependencies});
+        record_task(task_stack, {output_task, nullptr, &output_dependencies});
+        // the prepare task sizes the range to the playing voices before it releases it
+        record_range_task(task_stack, &mix_range, mix_voices, nullptr, 0, MAX_VOICES, VOICES_PER_CHUNK, mixed_checkpoint, &mix_dependencies);
+        record_task(task_stack, {prepare_task, nullptr, &no_dependencies});
+
+        save_task_recording(task_stack, &recording);
+        submit_task_recording(task_stack);
+    }
+
+    uint64_t submit_tasks(void* args, uint32_t thread_id)
+    {
+        replay_task_recording(task_stack, &recording);
+
+        return ECP_NONE;
+    }
+
+    uint64_t prepare_task(void* args, uint32_t thread_id)
+    {
+        {
+            std::unique_lock<std::mutex> l(command_mutex);
+
+            for (uint32_t i = 0; i < num_active; ++i)
+            {
+                uint32_t slot = active[i];
+                if (voices[slot].finished)
+                {
+                    playing[slot] = false;
+                    generations[slot] = (generations[slot] + 1) & 0xFFFF;
+                    free_slots[num_free_slots++] = slot;
+                }
+            }
+
+            for (uint32_t i = 0; i < num_commands; ++i)
+            {
+                const command_t* command = &commands[i];
+                uint32_t slot = command->voice & 0xFFFF;
+                if (command->type == CMD_PLAY)
+                {
+                    voice_t* voice = &voices[slot];
+                    voice->sound = command->sound;
+                    voice->position = 0.0;
+                    voice->step = command->step;
+                    voice->gain_l = voice->target_l = command->gain_l;
+                    voice->gain_r = voice->target_r = command->gain_r;
+                    voice->loop = command->loop;
+                    voice->stopping = false;
+                    voice->finished = false;
+                    playing[slot] = true;
+                }
+                else if (slot < MAX_VOICES && playing[slot] && command->voice >> 16 == generations[slot])
+                {
+                    voice_t* voice = &voices[slot];
+                    voice->stopping |= command->type == CMD_STOP;
+                    voice->target_l = voice->stopping ? 0.0f : command->gain_l;
+                    voice->target_r = voice->stopping ? 0.0f : command->gain_r;
+                }
+            }
+            num_commands = 0;
+        }
+
+        num_active = 0;
+        for (uint32_t slot = 0; slot < MAX_VOICES; ++slot)
+        {
+            if (playing[slot])
+                active[num_active++] = slot;
+        }
+
+        // top the ring up to the lead ahead of the sink. the lead covers twice the
+        // frames the sink took since the last frame, at least LATENCY_FRAMES, and
+        // decays back once frames are short again. voices do not advance while
+        // the ring is full, and it stays full while no sink runs
+        uint64_t r = read_frame.load(std::memory_order_acquire);
+        uint32_t played = (uint32_t) std::min(r - last_read_frame, (uint64_t) MAX_MIX_FRAMES);
+        last_read_frame = r;
+        lead_frames = std::max(std::max(LATENCY_FRAMES, 2 * played), lead_frames - (lead_frames - LATENCY_FRAMES) / 16);
+        lead_frames = std::min(lead_frames, MAX_MIX_FRAMES);
+
+        uint64_t buffered = write_frame.load(std::memory_order_relaxed) - r;
+        mix_frames = buffered < lead_frames ? (lead_frames - (uint32_t) buffered) & ~15u : 0;
+        ++frame;
+
+        uint32_t num_mixed = mix_frames ? num_active : 0;
+        mix_range.end = num_mixed;
+        mix_range.num_chunks = (num_mixed + VOICES_PER_CHUNK - 1) / VOICES_PER_CHUNK;
+
+        return prepared_checkpoint;
+    }
+
+    // adds count frames of a voice, linearly interpolated and gain ramped, to left and right
+    static void mix_block(const float* samples, double position, float step,
+                          float gain_l, float gain_r, float ramp_l, float ramp_r,
+                          float* left, float* right, uint32_t count)
+    {
+        uint32_t first = (uint32_t) position;
+        const float* src = samples + first;
+        float offset = (float) (position - first);
+
+        uint32_t k = 0;
+#if defined(__AVX2__)
+        __m256 kk = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+        __m256 gl = _mm256_add_ps(_mm256_set1_ps(gain_l), _mm256_mul_ps(kk, _mm256_set1_ps(ramp_l)));
+        __m256 gr = _mm256_add_ps(_mm256_set1_ps(gain_r), _mm256_mul_ps(kk, _mm256_set1_ps(ramp_r)));
+        __m256 st = _mm256_set1_ps(step);
+        __m256 of = _mm256_set1_ps(offset);
+        for (; k + 8 <= count; k += 8)
+        {
+            __m256  p  = _mm256_add_ps(of, _mm256_mul_ps(kk, st));
+            __m256i ip = _mm256_cvttps_epi32(p);
+            __m256  t  = _mm256_sub_ps(p, _mm256_cvtepi32_ps(ip));
+            __m256  s0 = _mm256_i32gather_ps(src, ip, 4);
+            __m256  s1 = _mm256_i32gather_ps(src + 1, ip, 4);
+            __m256  s  = _mm256_add_ps(s0, _mm256_mul_ps(t, _mm256_sub_ps(s1, s0)));
+
+            _mm256_storeu_ps(left + k, _mm256_add_ps(_mm256_loadu_ps(left + k), _mm256_mul_ps(s, gl)));
+            _mm256_storeu_ps(right + k, _mm256_add_ps(_mm256_loadu_ps(right + k), _mm256_mul_ps(s, gr)));
+
+            kk = _mm256_add_ps(kk, _mm256_set1_ps(8.0f));
+            gl = _mm256_add_ps(gl, _mm256_set1_ps(8.0f * ramp_l));
+            gr = _mm256_add_ps(gr, _mm256_set1_ps(8.0f * ramp_r));
+        }
+#else
+        __m128 kk = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+        __m128 gl = _mm_add_ps(_mm_set1_ps(gain_l), _mm_mul_ps(kk, _mm_set1_ps(ramp_l)));
+        __m128 gr = _mm_add_ps(_mm_set1_ps(gain_r), _mm_mul_ps(kk, _mm_set1_ps(ramp_r)));
+        __m128 st = _mm_set1_ps(step);
+        __m128 of = _mm_set1_ps(offset);
+        for (; k + 4 <= count; k += 4)
+        {
+            __m128  p  = _mm_add_ps(of, _mm_mul_ps(kk, st));
+            __m128i ip = _mm_cvttps_epi32(p);
+            __m128  t  = _mm_sub_ps(p, _mm_cvtepi32_ps(ip));
+
+            // no gather before AVX2
+            ALIGN(16) int32_t i4[4];
+            _mm_store_si128((__m128i*) i4, ip);
+            __m128 s0 = _mm_setr_ps(src[i4[0]], src[i4[1]], src[i4[2]], src[i4[3]]);
+            __m128 s1 = _mm_setr_ps(src[i4[0] + 1], src[i4[1] + 1], src[i4[2] + 1], src[i4[3] + 1]);
+            __m128 s  = _mm_add_ps(s0, _mm_mul_ps(t, _mm_sub_ps(s1, s0)));
+
+            _mm_storeu_ps(left + k, _mm_add_ps(_mm_loadu_ps(left + k), _mm_mul_ps(s, gl)));
+            _mm_storeu_ps(right + k, _mm_add_ps(_mm_loadu_ps(right + k), _mm_mul_ps(s, gr)));
+
+            kk = _mm_add_ps(kk, _mm_set1_ps(4.0f));
+            gl = _mm_add_ps(gl, _mm_set1_ps(4.0f * ramp_l));
+            gr = _mm_add_ps(gr, _mm_set1_ps(4.0f * ramp_r));
+        }
+#endif
+
+        for (; k < count; ++k)
+        {
+            float p = offset + k * step;
+            uint32_t i = (uint32_t) p;
+            float s = src[i] + (p - i) * (src[i + 1] - src[i]);
+            left[k] += s * (gain_l + k * ramp_l);
+            right[k] += s * (gain_r + k * ramp_r);
+        }
+    }
+
+    static void mix_voice(voice_t* voice, float* left, float* right, uint32_t num_frames)
+    {
+        const sound_t* sound = voice->sound;
+        float ramp_l = (voice->target_l - voice->gain_l) / num_frames;
+        float ramp_r = (voice->target_r - voice->gain_r) / num_frames;
+
+        for (uint32_t i = 0; i < num_frames; )
+        {
+            if (voice->position >= sound->num_samples)
+            {
+                if (!voice->loop)
+                {
+                    voice->finished = true;
+                    break;
+                }
+                voice->position = fmod(voice->position, (double) sound->num_samples);
+            }
+
+            // up to the last output frame that starts before the end of the sound
+            uint32_t count = std::min(num_frames - i, MIX_BLOCK_FRAMES);
+            count = std::min(count, (uint32_t) ceil((sound->num_samples - voice->position) / voice->step));
+
+            mix_block(sound->samples, voice->position, voice->step,
+                      voice->gain_l + i * ramp_l, voice->gain_r + i * ramp_r, ramp_l, ramp_r,
+                      left + i, right + i, count);
+
+            voice->position += count * (double) voice->step;
+            i += count;
+        }
+
+        voice->gain_l = voice->target_l;
+        voice->gain_r = voice->target_r;
+        voice->finished |= voice->stopping;
+    }
+
+    void mix_voices(void* args, uint32_t begin, uint32_t end, uint32_t thread_id)
+    {
+        uint64_t start = MPlatform::asm_rdtscp();
+
+        thread_mix_t* t = &thread_mix[thread_id];
+        float* left = left_buffer(thread_id);
+        float* right = right_buffer(thread_id);
+        if (t->mixed_frame != frame)
+        {
+            memset(left, 0, sizeof(float) * mix_frames);
+            memset(right, 0, sizeof(float) * mix_frames);
+            t->mixed_frame = frame;
+        }
+
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            mix_voice(&voices[active[i]], left, right, mix_frames);
+        }
+
+        t->voice_frames += (end - begin) * mix_frames;
+        t->mix_cycles += MPlatform::asm_rdtscp() - start;
+    }
+
+    // sums the thread buffers into the ring
+    uint64_t output_task(void* args, uint32_t thread_id)
+    {
+        const float* buffers[MAX_NUM_THREADS];
+        uint32_t num_buffers = 0;
+        uint64_t voice_frames = 0;
+        uint64_t mix_cycles = 0;
+        for (uint32_t i = 0; i < MAX_NUM_THREADS; ++i)
+        {
+            thread_mix_t* t = &thread_mix[i];
+            if (t->mixed_frame == frame)
+                buffers[num_buffers++] = left_buffer(i);
+            voice_frames += t->voice_frames;
+            mix_cycles += t->mix_cycles;
+            t->voice_frames = 0;
+            t->mix_cycles = 0;
+        }
+
+        // mix_frames and the write position are multiples of 16, groups of 4 frames never wrap
+        uint64_t w = write_frame.load(std::memory_order_relaxed);
+        __m128 lo = _mm_set1_ps(-1.0f);
+        __m128 hi = _mm_set1_ps(1.0f);
+        for (uint32_t i = 0; i < mix_frames; i += 4)
+        {
+            __m128 l = _mm_setzero_ps();
+            __m128 r = _mm_setzero_ps();
+            for (uint32_t b = 0; b < num_buffers; ++b)
+            {
+                l = _mm_add_ps(l, _mm_load_ps(buffers[b] + i));
+                r = _mm_add_ps(r, _mm_load_ps(buffers[b] + MAX_MIX_FRAMES + i));
+            }
+            l = _mm_min_ps(_mm_max_ps(l, lo), hi);
+            r = _mm_min_ps(_mm_max_ps(r, lo), hi);
+
+            float* out = &ring[((w + i) & (RING_FRAMES - 1)) * 2];
+            _mm_store_ps(out, _mm_unpacklo_ps(l, r));
+            _mm_store_ps(out + 4, _mm_unpackhi_ps(l, r));
+        }
+        write_frame.store(w + mix_frames, std::memory_order_release);
+
+        g_stats.frames_mixed.fetch_add(mix_frames, std::memory_order_relaxed);
+        g_stats.voice_frames.fetch_add(voice_frames, std::memory_order_relaxed);
+        g_stats.mix_cycles.fetch_add(mix_cycles, std::memory_order_relaxed);
+
+        return ECP_SOUND1;
+    }
+}
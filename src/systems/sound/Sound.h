@@ -0,0 +1,76 @@
+#pragma once
+
+#include "managers/TaskScheduling.h"
+
+#include <atomic>
+
+// Mixes voices into a lock-free ring buffer that a sink thread drains at
+// SAMPLE_RATE. each frame tops the ring up to a lead ahead of the sink of at
+// least LATENCY_FRAMES, so frames of up to LATENCY_FRAMES / SAMPLE_RATE
+// seconds do not underrun. while frames are longer the lead grows to twice
+// the frame time, up to MAX_MIX_FRAMES. voices are resampled with linear
+// interpolation, ramped to their gain and panned with SIMD in range tasks,
+// one accumulation buffer per thread:
+//   prepare task    applies play/set/stop commands, sizes the mix
+//   mix range       voices mixed into the thread buffers
+//   ECP_SOUND1      thread buffers summed into the ring
+namespace SSound
+{
+    const uint32_t SAMPLE_RATE        = 48000; // output, interleaved stereo float
+    const uint32_t RING_FRAMES        = 16384; // power of two
+    const uint32_t MAX_MIX_FRAMES     = 8192;  // mixed in one frame at most
+    const uint32_t MAX_VOICES         = 1024;
+    const uint32_t MAX_COMMANDS       = 4096;  // play/set/stop queued and not yet applied
+    const uint32_t VOICES_PER_CHUNK   = 16;    // grain of the mix range
+    const uint32_t SINK_PERIOD_FRAMES = 256;   // consumed per sink wakeup, 5.3 ms
+    const uint32_t INVALID_VOICE      = 0xFFFFFFFF;
+    extern uint32_t LATENCY_FRAMES;//       = 4096, least mixed ahead of the sink, at most MAX_MIX_FRAMES, set before init_sound
+
+    // mono samples followed by two guard samples that repeat the first ones, so
+    // looping voices interpolate across the loop point without a branch
+    typedef struct
+    {
+        float* samples;
+        uint32_t num_samples;
+        uint32_t sample_rate;
+    } sound_t;
+
+    enum sink_t : uint32_t
+    {
+        SINK_NULL, // drains the ring in real time and drops the samples
+        SINK_WAV,  // drains the ring in real time into a 16 bit PCM wav file
+    };
+
+    typedef struct
+    {
+        std::atomic<uint64_t> voice_frames;    // frames mixed summed over voices
+        std::atomic<uint64_t> mix_cycles;      // spent in the mix range
+        std::atomic<uint64_t> frames_mixed;    // written to the ring
+        std::atomic<uint64_t> frames_played;   // taken by the sink, underrun frames included
+        std::atomic<uint64_t> underruns;       // sink periods the ring could not fill
+        std::atomic<uint64_t> underrun_frames; // played as silence
+    } sound_stats_t;
+
+    extern MTaskScheduling::task_stack_t* task_stack;
+    extern sound_stats_t g_stats;
+
+    void init_sound(MTaskScheduling::task_stack_t*);
+    void clear_sound(); // stops the sink
+    bool start_sink(sink_t, const char* wav_path);
+    void stop_sink();
+
+    sound_t* create_sound(const float* samples, uint32_t num_samples, uint32_t sample_rate);
+    void destroy_sound(sound_t*); // after the voices that play it have stopped
+
+    // any thread. pan in [-1, 1], pitch scales the playback rate. one-shot voices
+    // stop at the end of their sound. returns INVALID_VOICE when MAX_VOICES play
+    uint32_t play(const sound_t*, float gain, float pan, float pitch, bool loop);
+    void set_voice(uint32_t voice, float gain, float pan); // ramped over the next mix
+    void stop(uint32_t voice);
+
+    void record_tasks();
+    uint64_t submit_tasks(void*, uint32_t);
+    uint64_t prepare_task(void*, uint32_t);
+    void mix_voices(void*, uint32_t, uint32_t, uint32_t);
+    uint64_t output_task(void*, uint32_t);
+}
@@ -0,0 +1,346 @@
+#include "systems/streaming/Streaming.h"
+#include "managers/TaskScheduling.h"
+#include "managers/Platform.h"
+
+#include <mutex>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using namespace MTaskScheduling;
+
+namespace SStreaming
+{
+    task_stack_t* task_stack;
+    task_recording_t recording;
+    streaming_stats_t g_stats;
+
+    // requests from any thread
+    std::mutex request_mutex;
+    load_t* requests[MAX_REQUESTS];
+    uint32_t request_head;
+    uint32_t request_tail;
+
+    // only touched by the streaming tasks, which run one after another
+    load_t* reads[MAX_READS];      // by read slot, nullptr if free
+    uint32_t num_reads;
+    load_t* finished[MAX_FINISHED]; // this frame
+    uint32_t num_finished;
+
+    range_task_t decompress_range;
+
+    ALIGN(64) const task_dependencies_t submit_dependencies = dependencies({}, {ECP_STREAMING4});
+    ALIGN(64) const task_dependencies_t finalise_dependencies = dependencies({}, {ECP_STREAMING3});
+    ALIGN(64) const task_dependencies_t decompress_dependencies = dependencies({}, {ECP_STREAMING2});
+    ALIGN(64) const task_dependencies_t reap_dependencies = dependencies({}, {ECP_STREAMING1});
+    // open and fstat block on the file system, keep them off the compute workers
+    ALIGN(64) const task_dependencies_t issue_dependencies = with_flags(dependencies({}, {}), TF_BLOCKING);
+
+    MPlatform::io_backend_t init_streaming(task_stack_t* assigned_task_stack, MPlatform::io_backend_t preferred)
+    {
+        task_stack = assigned_task_stack;
+        name_stack(task_stack->index, "streaming");
+
+        request_head = request_tail = 0;
+        for (uint32_t i = 0; i < MAX_READS; ++i)
+        {
+            reads[i] = nullptr;
+        }
+        num_reads = 0;
+        num_finished = 0;
+        g_stats.bytes_read.store(0, std::memory_order_relaxed);
+        g_stats.bytes_loaded.store(0, std::memory_order_relaxed);
+        g_stats.loads_finished.store(0, std::memory_order_relaxed);
+        g_stats.loads_failed.store(0, std::memory_order_relaxed);
+
+        MPlatform::io_backend_t backend = MPlatform::init_async_io(preferred, MAX_READS);
+
+        record_tasks();
+
+        return backend;
+    }
+
+    // a load streaming still holds when it is cleared. not counted in g_stats
+    static void abandon_load(load_t* load)
+    {
+        load->state.store(LS_FAILED, std::memory_order_release);
+        if (load->on_finished)
+            load->on_finished(load, 0);
+    }
+
+    void clear_streaming()
+    {
+        // the kernel or the reader threads still write into the buffers of reads in flight
+        MPlatform::io_completion_t completions[MAX_READS];
+        MPlatform::flush_reads();
+        while (num_reads)
+        {
+            uint32_t n = MPlatform::reap_reads(completions, MAX_READS);
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                load_t* load = reads[completions[i].user_data];
+                reads[completions[i].user_data] = nullptr;
+                --num_reads;
+                close(load->fd);
+                free(load->file_data);
+                abandon_load(load);
+            }
+            if (!n)
+                usleep(100);
+        }
+
+        // read but not finalised. decompress_loads frees the file data once it set data
+        for (uint32_t i = 0; i < num_finished; ++i)
+        {
+            load_t* load = finished[i];
+            if (load->state.load(std::memory_order_relaxed) == LS_DECOMPRESSING)
+                free(load->data ? load->data : load->file_data);
+            load->data = nullptr;
+            load->size = 0;
+            abandon_load(load);
+        }
+        num_finished = 0;
+
+        // never issued. the callbacks may request again, only the loads queued now are failed
+        uint32_t num_requests;
+        {
+            std::unique_lock<std::mutex> l(request_mutex);
+            num_requests = request_head - request_tail;
+        }
+        for (uint32_t i = 0; i < num_requests; ++i)
+        {
+            load_t* load;
+            {
+                std::unique_lock<std::mutex> l(request_mutex);
+                load = requests[request_tail++ % MAX_REQUESTS];
+            }
+            abandon_load(load);
+        }
+
+        MPlatform::clear_async_io();
+        clear_task_recording(&recording);
+    }
+
+    bool request_load(load_t* load)
+    {
+        std::unique_lock<std::mutex> l(request_mutex);
+        if (request_head - request_tail == MAX_REQUESTS)
+            return false;
+
+        load->state.store(LS_REQUESTED, std::memory_order_relaxed);
+        load->data = nullptr;
+        load->size = 0;
+        requests[request_head++ % MAX_REQUESTS] = load;
+
+        return true;
+    }
+
+    void release_load(load_t* load)
+    {
+        free(load->data);
+        load->data = nullptr;
+        load->size = 0;
+        load->state.store(LS_NONE, std::memory_order_relaxed);
+    }
+
+    bool write_compressed_file(const char* path, const uint8_t* data, uint32_t size)
+    {
+        uLongf compressed_size = compressBound(size);
+        uint8_t* file_data = (uint8_t*) malloc(8 + compressed_size);
+        uint32_t header[2] = { COMPRESSED_MAGIC, size };
+        memcpy(file_data, header, 8);
+
+        bool ok = compress(file_data + 8, &compressed_size, data, size) == Z_OK;
+        int fd = ok ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+        ok = fd >= 0 && write(fd, file_data, 8 + compressed_size) == (ssize_t) (8 + compressed_size);
+        if (fd >= 0)
+            close(fd);
+        free(file_data);
+
+        return ok;
+    }
+
+    void record_tasks()
+    {
+        begin_task_recording(task_stack);
+
+        record_task(task_stack, {submit_tasks, nullptr, &submit_dependencies});
+        record_task(task_stack, {finalise_task, nullptr, &finalise_dependencies});
+        // the reap task sizes the range to the finished loads before ECP_STREAMING2 releases it
+        record_range_task(task_stack, &decompress_range, decompress_loads, nullptr, 0, MAX_FINISHED, 1, ECP_STREAMING3, &decompress_dependencies);
+        record_task(task_stack, {reap_task, nullptr, &reap_dependencies});
+        record_task(task_stack, {issue_task, nullptr, &issue_dependencies});
+
+        save_task_recording(task_stack, &recording);
+        submit_task_recording(task_stack);
+    }
+
+    uint64_t submit_tasks(void* args, uint32_t thread_id)
+    {
+        replay_task_recording(task_stack, &recording);
+
+        return ECP_NONE;
+    }
+
+    inline void finish_load(load_t* load, load_state_t state)
+    {
+        load->state.store(state, std::memory_order_relaxed);
+        finished[num_finished++] = load;
+    }
+
+    // opens requested files and starts reading them into memory
+    uint64_t issue_task(void* args, uint32_t thread_id)
+    {
+        load_t* issued[MAX_READS];
+        uint32_t num_issued = 0;
+        {
+            std::unique_lock<std::mutex> l(request_mutex);
+            while (num_issued < MAX_READS - num_reads && request_tail != request_head)
+            {
+                issued[num_issued++] = requests[request_tail++ % MAX_REQUESTS];
+            }
+        }
+
+        uint32_t slot = 0;
+        for (uint32_t i = 0; i < num_issued; ++i)
+        {
+            load_t* load = issued[i];
+            struct stat st;
+            load->fd = open(load->path, O_RDONLY);
+            if (load->fd < 0 || fstat(load->fd, &st) != 0 || st.st_size == 0 || st.st_size > 0x7FFFFFFF)
+            {
+                if (load->fd >= 0)
+                    close(load->fd);
+                finish_load(load, LS_FAILED);
+                continue;
+            }
+
+            load->file_size = (uint32_t) st.st_size;
+            load->file_data = (uint8_t*) malloc(load->file_size);
+            load->bytes_read = 0;
+            load->state.store(LS_READING, std::memory_order_relaxed);
+
+            while (reads[slot])
+            {
+                ++slot;
+            }
+            if (!MPlatform::submit_read(load->fd, load->file_data, load->file_size, 0, slot))
+            {
+                close(load->fd);
+                free(load->file_data);
+                finish_load(load, LS_FAILED);
+                continue;
+            }
+            reads[slot] = load;
+            ++num_reads;
+        }
+
+        MPlatform::flush_reads();
+
+        return ECP_STREAMING1;
+    }
+
+    // collects completed reads. short reads continue where they stopped
+    uint64_t reap_task(void* args, uint32_t thread_id)
+    {
+        MPlatform::io_completion_t completions[MAX_READS];
+        uint32_t n = MPlatform::reap_reads(completions, MAX_READS);
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            uint32_t slot = (uint32_t) completions[i].user_data;
+            load_t* load = reads[slot];
+            int32_t result = completions[i].result;
+
+            if (result > 0)
+            {
+                load->bytes_read += result;
+                g_stats.bytes_read.fetch_add(result, std::memory_order_relaxed);
+                // a read that can not be queued fails the load below
+                if (load->bytes_read < load->file_size)
+                {
+                    if (MPlatform::submit_read(load->fd, load->file_data + load->bytes_read, load->file_size - load->bytes_read, load->bytes_read, slot))
+                        continue;
+                    result = 0;
+                }
+            }
+
+            reads[slot] = nullptr;
+            --num_reads;
+            close(load->fd);
+            if (result <= 0)
+            {
+                free(load->file_data);
+                finish_load(load, LS_FAILED);
+            }
+            else
+            {
+                finish_load(load, LS_DECOMPRESSING);
+            }
+        }
+
+        MPlatform::flush_reads();
+
+        decompress_range.end = num_finished;
+        decompress_range.num_chunks = num_finished;
+
+        return ECP_STREAMING2;
+    }
+
+    void decompress_loads(void* args, uint32_t begin, uint32_t end, uint32_t thread_id)
+    {
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            load_t* load = finished[i];
+            if (load->state.load(std::memory_order_relaxed) != LS_DECOMPRESSING)
+                continue;
+
+            uint32_t header[2];
+            memcpy(header, load->file_data, std::min(load->file_size, (uint32_t) 8));
+            if (load->file_size < 8 || header[0] != COMPRESSED_MAGIC)
+            {
+                // stored as is
+                load->data = load->file_data;
+                load->size = load->file_size;
+                continue;
+            }
+
+            uLongf size = header[1];
+            load->data = (uint8_t*) malloc(size);
+            if (!load->data || uncompress(load->data, &size, load->file_data + 8, load->file_size - 8) != Z_OK || size != header[1])
+            {
+                free(load->data);
+                load->data = nullptr;
+                size = 0;
+                load->state.store(LS_FAILED, std::memory_order_relaxed);
+            }
+            load->size = (uint32_t) size;
+            free(load->file_data);
+        }
+    }
+
+    // publishes this frame's finished loads
+    uint64_t finalise_task(void* args, uint32_t thread_id)
+    {
+        for (uint32_t i = 0; i < num_finished; ++i)
+        {
+            load_t* load = finished[i];
+            load_state_t state = load->state.load(std::memory_order_relaxed) == LS_FAILED ? LS_FAILED : LS_LOADED;
+            if (state == LS_LOADED)
+                g_stats.bytes_loaded.fetch_add(load->size, std::memory_order_relaxed);
+            else
+                g_stats.loads_failed.fetch_add(1, std::memory_order_relaxed);
+            g_stats.loads_finished.fetch_add(1, std::memory_order_relaxed);
+
+            load->state.store(state, std::memory_order_release);
+            if (load->on_finished)
+                load->on_finished(load, thread_id);
+        }
+        num_finished = 0;
+
+        return ECP_STREAMING4;
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "managers/TaskScheduling.h"
+#include "managers/Platform.h"
+
+#include <atomic>
+
+// Streams files in without stalling frames. Requested loads are read
+// asynchronously (io_uring, or a thread pool where it is not available),
+// decompressed in scheduler tasks and finalised once per frame:
+//   ECP_STREAMING1  requests issued as reads
+//   ECP_STREAMING2  completed reads collected
+//   ECP_STREAMING3  collected reads decompressed
+//   ECP_STREAMING4  loads finished this frame are LS_LOADED or LS_FAILED
+// systems that consume loaded data depend on ECP_STREAMING4 of the previous
+// frame and check the state of their loads, they never wait for a read.
+namespace SStreaming
+{
+    const uint32_t MAX_READS = 64;                // reads in flight
+    const uint32_t MAX_REQUESTS = 1024;           // requested and not yet issued
+    const uint32_t MAX_FINISHED = 2 * MAX_READS;  // finished in one frame, failed opens included
+    const uint32_t COMPRESSED_MAGIC = 0x5453475A; // "ZGST", followed by the raw size and a zlib stream
+
+    enum load_state_t : uint32_t
+    {
+        LS_NONE,
+        LS_REQUESTED,
+        LS_READING,
+        LS_DECOMPRESSING,
+        LS_LOADED,
+        LS_FAILED,
+    };
+
+    struct load_t;
+    typedef void (*load_callback_t)(load_t*, uint32_t thread_id);
+
+    // owned by the requester and kept alive until the load is LS_LOADED or LS_FAILED
+    typedef struct load_t
+    {
+        const char* path;
+        load_callback_t on_finished; // nullptr, or called from the finalise task
+        void* user;
+        std::atomic<uint32_t> state;
+        uint8_t* data;               // after LS_LOADED, until release_load
+        uint32_t size;
+
+        // streaming internal
+        int fd;
+        uint8_t* file_data;
+        uint32_t file_size;
+        uint32_t bytes_read;
+    } load_t;
+
+    typedef struct
+    {
+        std::atomic<uint64_t> bytes_read;
+        std::atomic<uint64_t> bytes_loaded; // decompressed
+        std::atomic<uint64_t> loads_finished;
+        std::atomic<uint64_t> loads_failed;
+    } streaming_stats_t;
+
+    extern MTaskScheduling::task_stack_t* task_stack;
+    extern streaming_stats_t g_stats;
+
+    MPlatform::io_backend_t init_streaming(MTaskScheduling::task_stack_t*, MPlatform::io_backend_t preferred);
+    // after the workers stopped. waits for the reads in flight, then fails every
+    // load not yet finished, calling on_finished with thread id 0
+    void clear_streaming();
+    bool request_load(load_t*); // any thread, false if MAX_REQUESTS are queued
+    void release_load(load_t*);
+    bool write_compressed_file(const char* path, const uint8_t* data, uint32_t size);
+
+    void record_tasks();
+    uint64_t submit_tasks(void*, uint32_t);
+    uint64_t issue_task(void*, uint32_t);
+    uint64_t reap_task(void*, uint32_t);
+    void decompress_loads(void*, uint32_t, uint32_t, uint32_t);
+    uint64_t finalise_task(void*, uint32_t);
+}